@@ -0,0 +1,105 @@
+#!/bin/sh
+# bench.sh
+
+# Runs the hollyfs benchmark matrix on an image file, so it never touches a real partition.
+# For every thread count the image is formatted again with mkfs, attached to a loop device and mounted,
+# and then every workload of fs_bench runs once, with the page cache dropped in front of the ones that read.
+# Everything goes to a results directory:
+#   results.csv   one fs_bench line per workload and thread count
+#   counters.csv  the kernel's debugfs stats after every workload (threads,workload,counter,value)
+#   latency.<n>   the kernel's latency histograms after the run with n threads
+#   env.txt       kernel, cpus, git revision and the settings below
+# With BASELINE set to the results.csv of an earlier run, the rates of both runs are printed side by side.
+#
+# Needs root (losetup, mount, insmod and drop_caches), run it through make bench.
+# The settings come from the environment:
+#   IMAGE    the image file (default /var/tmp/hollyfs-bench.img, it is left sparse)
+#   BLOCKS   file system size in 4096 byte blocks (default 524288, 2GiB)
+#   THREADS  the thread counts (default "1 2 4 8")
+#   FILES    files per thread for create, stat and readdir (default 5000)
+#   MIB      data per thread for the read and write workloads (default 64)
+#   IOSIZE   bytes per read or write (default 4096)
+#   OUT      the results directory (default results/<date>-<git revision>)
+
+set -e
+cd "$(dirname "$0")"
+
+IMAGE=${IMAGE:-/var/tmp/hollyfs-bench.img}
+BLOCKS=${BLOCKS:-524288}
+THREADS=${THREADS:-"1 2 4 8"}
+FILES=${FILES:-5000}
+MIB=${MIB:-64}
+IOSIZE=${IOSIZE:-4096}
+REV=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+OUT=${OUT:-results/$(date +%Y%m%d-%H%M%S)-$REV}
+MNT=$(mktemp -d /tmp/hollyfs-bench.XXXXXX)
+WORKLOADS="create stat readdir seqwrite seqread randwrite randread"
+LOOP=
+
+# whatever happens, the file system is unmounted and the loop device goes away
+cleanup() {
+	if mountpoint -q "$MNT"; then umount "$MNT"; fi
+	if [ -n "$LOOP" ]; then losetup -d "$LOOP"; fi
+	rmdir "$MNT"
+}
+trap cleanup EXIT
+
+# the module needs jbd2, and the statistics need debugfs
+if ! grep -qw hollyfs /proc/filesystems; then
+	modprobe jbd2
+	insmod ./hollyfs.ko
+fi
+if ! mountpoint -q /sys/kernel/debug; then
+	mount -t debugfs none /sys/kernel/debug
+fi
+
+mkdir -p "$OUT"
+{
+	echo "kernel: $(uname -r)"
+	echo "cpus: $(nproc)"
+	echo "revision: $REV"
+	echo "blocks: $BLOCKS threads: $THREADS files: $FILES mib: $MIB iosize: $IOSIZE"
+} > "$OUT/env.txt"
+./fs_bench -H > "$OUT/results.csv"
+echo "threads,workload,counter,value" > "$OUT/counters.csv"
+
+for t in $THREADS; do
+	# a fresh file system for every thread count, so no run finds the leftovers of another one
+	rm -f "$IMAGE"
+	./mkfs -b "$BLOCKS" "$IMAGE" > /dev/null
+	LOOP=$(losetup -f --show "$IMAGE")
+	mount -t hollyfs "$LOOP" "$MNT"
+	STATS=/sys/kernel/debug/hollyfs/$(basename "$LOOP")
+	for w in $WORKLOADS; do
+		# the reads are meant to reach the disk, and every workload starts with the earlier writes on it
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+		# no pipe into tee, sh has no pipefail and a workload that fails would go by unnoticed
+		if ! ./fs_bench -n "$FILES" -m "$MIB" -b "$IOSIZE" "$w" "$MNT" "$t" > "$OUT/run.csv"; then
+			echo "bench.sh: $w with $t threads failed" >&2
+			exit 1
+		fi
+		cat "$OUT/run.csv"
+		cat "$OUT/run.csv" >> "$OUT/results.csv"
+		rm -f "$OUT/run.csv"
+		if [ -r "$STATS/stats" ]; then
+			sed "s/^\([^:]*\): */$t,$w,\1,/" "$STATS/stats" >> "$OUT/counters.csv"
+		fi
+	done
+	if [ -r "$STATS/latency" ]; then
+		cp "$STATS/latency" "$OUT/latency.$t"
+	fi
+	umount "$MNT"
+	losetup -d "$LOOP"
+	LOOP=
+done
+rm -f "$IMAGE"
+
+# ops per second of both runs and how this one compares, by workload and thread count
+if [ -n "$BASELINE" ]; then
+	awk -F, 'NR == FNR { if(FNR > 1) base[$1 "," $2] = $6; next }
+		FNR == 1 { printf "%-10s %7s %14s %14s %8s\n", "workload", "threads", "baseline", "now", "ratio"; next }
+		($1 "," $2) in base { printf "%-10s %7s %14.1f %14.1f %8.3f\n", $1, $2, base[$1 "," $2], $6, $6 / base[$1 "," $2] }' \
+		"$BASELINE" "$OUT/results.csv"
+fi
+echo "results are in $OUT"
@@ -0,0 +1,150 @@
+/* create_bench.c */
+
+/* Multi-threaded create benchmark for a mounted hollyfs partition.
+
+Runs rounds with 1, 2, 4, ... threads up to the given maximum. In every round each thread
+creates the same number of empty files, and the program prints creates per second and the
+speedup over the single threaded round. Linear scaling means the speedup matches the thread count.
+
+Every thread works in a directory of its own, because the kernel serializes creates in one
+directory on that directory's lock.
+
+usage: create_bench <directory on hollyfs> [max threads] [files per thread]
+*/
+
+#include <stdio.h> // provides printf
+#include <stdlib.h> // provides atoi and malloc
+#include <string.h> // provides strerror
+#include <errno.h> // provides errno
+#include <fcntl.h> // provides open
+#include <unistd.h> // provides close and sysconf
+#include <pthread.h> // provides the threads
+#include <sys/stat.h> // provides mkdir
+#include <time.h> // provides clock_gettime
+
+
+// what every thread needs to know, one of these per thread
+struct bench_thread {
+	pthread_t tid;
+	char dir[4096]; // where this thread creates its files
+	int round; // goes into the file names so rounds never collide
+	int id;
+	int files;
+	int failed; // errno of the first create that failed, 0 if all went fine
+};
+
+// the threads wait here until all of them are started, so thread creation is not timed
+static pthread_barrier_t start_barrier;
+
+// creates t->files empty files named r<round>.t<thread>.<n> in the thread's directory
+static void *create_files(void *arg)
+{
+	struct bench_thread *t = arg;
+	char path[4200];
+	int i, fd;
+
+	pthread_barrier_wait(&start_barrier);
+	for(i = 0; i < t->files; i++)
+	{
+		snprintf(path, sizeof(path), "%s/r%d.t%d.%d", t->dir, t->round, t->id, i);
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if(fd == -1)
+		{
+			t->failed = errno;
+			break;
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+// seconds since some fixed point, as a double
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// sets up a directory for thread id under base, returns -1 when it can't be made
+static int thread_dir(const char *base, int id, char *dir, size_t size)
+{
+	snprintf(dir, size, "%s/bench.%d", base, id);
+	if(mkdir(dir, 0755) == -1 && errno != EEXIST)
+	{
+		printf("could not make %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_thread *threads;
+	int max_threads, files, nthreads, round, i;
+	double start, elapsed, rate, base_rate = 0;
+
+	if(argc < 2)
+	{
+		printf("usage: %s <directory on hollyfs> [max threads] [files per thread]\n", argv[0]);
+		return 1;
+	}
+	max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	// enough creates per thread that a round takes far longer than starting its threads
+	files = argc > 3 ? atoi(argv[3]) : 4096;
+	if(max_threads < 1 || files < 1)
+	{
+		printf("thread and file counts have to be positive\n");
+		return 1;
+	}
+
+	threads = calloc(max_threads, sizeof(struct bench_thread));
+	if(!threads)
+		return 1;
+	for(i = 0; i < max_threads; i++)
+	{
+		if(thread_dir(argv[1], i, threads[i].dir, sizeof(threads[i].dir)))
+		{
+			free(threads);
+			return 1;
+		}
+		threads[i].id = i;
+		threads[i].files = files;
+	}
+
+	printf("threads  creates/s  speedup\n");
+	for(nthreads = 1, round = 0; nthreads <= max_threads; nthreads *= 2, round++)
+	{
+		pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+		for(i = 0; i < nthreads; i++)
+		{
+			threads[i].round = round;
+			threads[i].failed = 0;
+			pthread_create(&threads[i].tid, NULL, create_files, &threads[i]);
+		}
+		// let them all go at once and time until the last one is done
+		start = now();
+		pthread_barrier_wait(&start_barrier);
+		for(i = 0; i < nthreads; i++)
+			pthread_join(threads[i].tid, NULL);
+		elapsed = now() - start;
+		pthread_barrier_destroy(&start_barrier);
+
+		for(i = 0; i < nthreads; i++)
+		{
+			if(threads[i].failed)
+			{
+				printf("thread %d failed to create a file: %s\n", i, strerror(threads[i].failed));
+				free(threads);
+				return 1;
+			}
+		}
+		rate = nthreads * files / elapsed;
+		if(nthreads == 1)
+			base_rate = rate;
+		printf("%7d  %9.0f  %7.2f\n", nthreads, rate, rate / base_rate);
+	}
+	free(threads);
+	return 0;
+}
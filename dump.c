@@ -0,0 +1,227 @@
+/* dump.c */
+
+/* Shows what is on a hollyfs partition or image file without mounting it, through the userspace library.
+
+usage: dump <device or image file> [command]
+  super           the superblock, the journal and a line per allocation group (the default)
+  inode <file>    an inode and its extent map
+  ls <folder>     the names in a folder with their inode numbers, in readdir order
+  cat <file>      copies a file's contents to stdout
+A file is an absolute path from the root folder, or #<inode number>.
+*/
+
+#include "hollyfs_lib.h"
+#include <stdio.h> // provides printf and fwrite
+#include <stdlib.h> // provides strtoul
+#include <string.h> // provides strcmp and strerror
+#include <sys/stat.h> // provides S_ISDIR
+#include <arpa/inet.h> // provides ntohl, the journal superblock is big endian
+#include <time.h> // provides ctime_r
+
+
+static struct hollyfs_image img;
+
+// looks up a path or a #number, complains when it is not a live inode
+static const hollyfs_inode *find_inode(const char *name, unsigned int *ino_out)
+{
+	const hollyfs_inode *inode;
+	unsigned int ino;
+
+	ino = name[0] == '#' ? strtoul(name + 1, NULL, 0) : hollyfs_path_lookup(&img, name);
+	inode = ino ? hollyfs_inode_slot(&img, ino) : NULL;
+	if(!inode || !hollyfs_inode_live(inode))
+	{
+		printf("%s: no such file\n", name);
+		return NULL;
+	}
+	*ino_out = ino;
+	return inode;
+}
+
+static int dump_super(void)
+{
+	const hollyfs_superblock *sb = img.sb;
+	const struct hollyfs_journal_superblock *jsb = hollyfs_block(&img, sb->journal_block_base);
+	const hollyfs_group_desc *gd;
+	const unsigned char *bitmap;
+	unsigned int g, i, used;
+
+	printf("blocks: %u of %u bytes, %u free at the last sync\n", sb->fs_size, HOLLYFS_BLOCK_SIZE, sb->free_block_count);
+	printf("groups: %u of %u blocks, starting at block %u, descriptors in %u blocks at %u\n", sb->group_count, sb->blocks_per_group,
+	       sb->first_group_block, sb->gdt_blocks, sb->gdt_block_base);
+	printf("inodes: %u per group in %u table blocks\n", sb->inodes_per_group, sb->inode_table_blocks);
+	printf("journal: %u blocks at %u, %s\n", sb->journal_block_count, sb->journal_block_base,
+	       !jsb || ntohl(jsb->h_magic) != HOLLYFS_JBD2_MAGIC ? "no jbd2 superblock" :
+	       img.journal_dirty ? "has transactions to replay" : "clean");
+	if(sb->orphan_head)
+		printf("orphan list: starts at inode %u\n", sb->orphan_head);
+	else
+		printf("orphan list: empty\n");
+	printf("\n%6s %10s %10s %10s %10s %10s %10s %10s\n", "group", "first", "blocks", "free", "inodes", "reusable", "desc free", "refcounts");
+	for(g = 0; g < sb->group_count; g++)
+	{
+		gd = hollyfs_group(&img, g);
+		bitmap = hollyfs_bitmap(&img, g);
+		// the free count in the descriptor is a copy from the last sync, the bitmap has the real one
+		used = 0;
+		for(i = 0; bitmap && i < HOLLYFS_BLOCK_SIZE; i++)
+			used += __builtin_popcount(bitmap[i]);
+		// the refcount table only shows up once a block of the group got shared
+		printf("%6u %10u %10u %10u %10u %10u %10u ", g, gd->bitmap_block, gd->block_count, gd->block_count - used,
+		       gd->inodes_used, gd->free_inodes, gd->free_block_count);
+		if(gd->refcount_block)
+			printf("%10u\n", gd->refcount_block);
+		else
+			printf("%10s\n", "-");
+	}
+	return 0;
+}
+
+static void print_time(const char *what, unsigned long long t)
+{
+	time_t tt = t;
+	char buf[64];
+
+	printf("%s: %s", what, ctime_r(&tt, buf) ? buf : "?\n");
+}
+
+static int dump_inode(const char *name)
+{
+	const hollyfs_inode *inode;
+	const hollyfs_extent *e;
+	unsigned int ino, i, b, shared;
+
+	inode = find_inode(name, &ino);
+	if(!inode)
+		return 1;
+	printf("inode %u, %s, mode 0%o, uid %u, gid %u, %u links, %llu bytes\n", ino, S_ISDIR(inode->mode) ? "folder" : "file",
+	       inode->mode, inode->uid, inode->gid, inode->links_count, inode->file_size);
+	print_time("atime", inode->atime);
+	print_time("mtime", inode->mtime);
+	print_time("ctime", inode->ctime);
+	if(S_ISDIR(inode->mode))
+		printf("%u names, %u hash index blocks\n", inode->dir_child_count, inode->dir_index_blocks);
+	if(inode->flags & HOLLYFS_INODE_PREALLOC)
+		printf("has blocks past its end from fallocate\n");
+	if(inode->flags & HOLLYFS_INODE_SHARED)
+		printf("shares blocks with other files through reflinks\n");
+	if(inode->flags & HOLLYFS_INODE_INLINE_DATA)
+	{
+		printf("inline data\n");
+		return 0;
+	}
+	if(inode->extent_block)
+		printf("extent block %u\n", inode->extent_block);
+	printf("%u extents:\n", inode->extent_count);
+	for(i = 0; i < inode->extent_count; i++)
+	{
+		e = hollyfs_get_extent(&img, inode, i);
+		if(!e)
+		{
+			printf("  the rest can't be read\n");
+			return 1;
+		}
+		// how many of the extent's blocks other files have too
+		shared = 0;
+		for(b = 0; (inode->flags & HOLLYFS_INODE_SHARED) && b < hollyfs_ext_len(e); b++)
+			shared += hollyfs_refcount(&img, e->start_block + b) != 0;
+		printf("  file block %10u  %8u blocks at %10u%s", e->logical_block, hollyfs_ext_len(e), e->start_block,
+		       e->length & HOLLYFS_EXTENT_UNWRITTEN ? "  unwritten" : "");
+		if(shared)
+			printf("  %u shared", shared);
+		printf("\n");
+	}
+	return 0;
+}
+
+static int print_record(void *arg, const hollyfs_directory_record *rec, unsigned int pos)
+{
+	(void)arg;
+	(void)pos;
+	printf("%10u %s %.*s\n", rec->inode_no, rec->file_type == HOLLYFS_FILE_TYPE_DIR ? "d" : "-", rec->name_len, rec->name);
+	return 0;
+}
+
+static int dump_ls(const char *name)
+{
+	const hollyfs_inode *dir;
+	unsigned int ino, bad_pos;
+
+	dir = find_inode(name, &ino);
+	if(!dir)
+		return 1;
+	if(!S_ISDIR(dir->mode))
+	{
+		printf("%s: not a folder\n", name);
+		return 1;
+	}
+	if(hollyfs_dir_iterate(&img, dir, print_record, NULL, &bad_pos) == -1)
+	{
+		printf("%s: broken at offset %u\n", name, bad_pos);
+		return 1;
+	}
+	return 0;
+}
+
+// holes and unwritten blocks read back as zeroes, the last block only as far as the file goes
+static int dump_cat(const char *name)
+{
+	static const unsigned char zeroes[4096];
+	const hollyfs_inode *inode;
+	const unsigned char *block;
+	unsigned long long off;
+	unsigned int ino;
+	size_t n;
+
+	inode = find_inode(name, &ino);
+	if(!inode)
+		return 1;
+	if(inode->flags & HOLLYFS_INODE_INLINE_DATA)
+	{
+		n = inode->file_size < HOLLYFS_INLINE_DATA_MAX ? inode->file_size : HOLLYFS_INLINE_DATA_MAX;
+		fwrite(inode->inline_data, 1, n, stdout);
+		return 0;
+	}
+	for(off = 0; off < inode->file_size; off += HOLLYFS_BLOCK_SIZE)
+	{
+		block = hollyfs_file_block(&img, inode, off / HOLLYFS_BLOCK_SIZE);
+		n = inode->file_size - off < HOLLYFS_BLOCK_SIZE ? inode->file_size - off : HOLLYFS_BLOCK_SIZE;
+		if(fwrite(block ? block : zeroes, 1, n, stdout) != n)
+			return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *why;
+	int err, ret;
+
+	if(argc < 2 || argc > 4)
+	{
+		printf("usage: %s <device or image file> [super | inode <file> | ls <folder> | cat <file>]\n", argv[0]);
+		return 1;
+	}
+	err = hollyfs_open_image(&img, argv[1], &why);
+	if(err)
+	{
+		printf("Could not open %s: %s\n", argv[1], why ? why : strerror(err));
+		return 1;
+	}
+
+	if(argc == 2 || strcmp(argv[2], "super") == 0)
+		ret = dump_super();
+	else if(argc == 4 && strcmp(argv[2], "inode") == 0)
+		ret = dump_inode(argv[3]);
+	else if(argc == 4 && strcmp(argv[2], "ls") == 0)
+		ret = dump_ls(argv[3]);
+	else if(argc == 4 && strcmp(argv[2], "cat") == 0)
+		ret = dump_cat(argv[3]);
+	else
+	{
+		printf("unknown command %s\n", argv[2]);
+		ret = 1;
+	}
+	hollyfs_close_image(&img);
+	return ret;
+}
@@ -0,0 +1,331 @@
+/* fs_bench.c */
+
+/* Runs one workload of the hollyfs benchmark matrix with a given number of threads and prints
+the result as a single CSV line, bench.sh runs it for every workload and thread count on a freshly
+made file system and collects the lines (and the kernel's counters next to them).
+
+Every thread works on names of its own, in the directory t<thread> under the given directory
+for the metadata workloads and in the file t<thread>.data for the data workloads, so the
+workloads that read (stat, readdir, seqread, randread) expect the matching create or write
+workload to have run before with the same thread count and sizes.
+
+  create     creates <files> empty files per thread
+  stat       stats every one of them, the lookup path of names that exist
+  readdir    lists the thread's directory <passes> times
+  seqwrite   writes <MiB> per thread front to back in <io size> chunks, then fsyncs
+  seqread    reads it back front to back
+  randwrite  writes <MiB> worth of <io size> chunks at random aligned offsets inside the file, then fsyncs
+  randread   reads <MiB> worth of chunks at random aligned offsets
+
+The random offsets come from a fixed seed, so two runs do exactly the same I/O.
+
+usage: fs_bench [-n files] [-m MiB] [-b io size] [-p passes] [-s seed] [-H] <workload> <directory on hollyfs> <threads>
+  -H prints the CSV header line and exits, the other arguments are not needed then
+
+output: workload,threads,ops,bytes,seconds,ops_per_sec,mib_per_sec
+*/
+
+#define _GNU_SOURCE // provides pread and pwrite with 64 bit offsets
+#include <stdio.h> // provides printf
+#include <stdlib.h> // provides strtoul and malloc
+#include <string.h> // provides strcmp and strerror
+#include <errno.h> // provides errno
+#include <fcntl.h> // provides open
+#include <unistd.h> // provides getopt, fsync and close
+#include <pthread.h> // provides the threads
+#include <dirent.h> // provides opendir and readdir
+#include <sys/stat.h> // provides mkdir and stat
+#include <time.h> // provides clock_gettime
+
+
+// the sizes every thread of a run works with, they are the same for all threads
+struct bench_params {
+	const char *dir;
+	unsigned long files;
+	unsigned long long bytes; // per thread, for the data workloads
+	size_t io_size;
+	unsigned long passes;
+	unsigned int seed;
+};
+
+// what every thread needs to know, one of these per thread
+struct bench_thread {
+	pthread_t tid;
+	const struct bench_params *p;
+	int id;
+	unsigned long long ops; // what the thread got done
+	unsigned long long bytes;
+	int failed; // errno of the first call that failed, 0 if all went fine
+};
+
+typedef void (*workload_fn)(struct bench_thread *t);
+
+// the threads wait here until all of them are started, so thread creation is not timed
+static pthread_barrier_t start_barrier;
+
+// seconds since some fixed point, as a double
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// builds the path of the thread's directory, or of file n in it when n is not negative
+static void thread_path(struct bench_thread *t, long n, char *path, size_t size)
+{
+	if(n < 0)
+		snprintf(path, size, "%s/t%d", t->p->dir, t->id);
+	else
+		snprintf(path, size, "%s/t%d/f%ld", t->p->dir, t->id, n);
+}
+
+static void do_create(struct bench_thread *t)
+{
+	char path[4200];
+	unsigned long i;
+	int fd;
+
+	for(i = 0; i < t->p->files; i++)
+	{
+		thread_path(t, i, path, sizeof(path));
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if(fd == -1)
+		{
+			t->failed = errno;
+			return;
+		}
+		close(fd);
+		t->ops++;
+	}
+}
+
+static void do_stat(struct bench_thread *t)
+{
+	char path[4200];
+	struct stat st;
+	unsigned long i;
+
+	for(i = 0; i < t->p->files; i++)
+	{
+		thread_path(t, i, path, sizeof(path));
+		if(stat(path, &st) == -1)
+		{
+			t->failed = errno;
+			return;
+		}
+		t->ops++;
+	}
+}
+
+// every name that comes back counts as an op, . and .. included
+static void do_readdir(struct bench_thread *t)
+{
+	char path[4200];
+	unsigned long pass;
+	DIR *d;
+
+	thread_path(t, -1, path, sizeof(path));
+	for(pass = 0; pass < t->p->passes; pass++)
+	{
+		d = opendir(path);
+		if(!d)
+		{
+			t->failed = errno;
+			return;
+		}
+		errno = 0;
+		while(readdir(d))
+			t->ops++;
+		if(errno)
+			t->failed = errno;
+		closedir(d);
+		if(t->failed)
+			return;
+	}
+}
+
+// the data workloads: writing or not, front to back or at random offsets
+static void do_io(struct bench_thread *t, int write, int random)
+{
+	const struct bench_params *p = t->p;
+	unsigned long long chunks = p->bytes / p->io_size, i, chunk;
+	unsigned int seed = p->seed + t->id;
+	char path[4200];
+	ssize_t n;
+	char *buf;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/t%d.data", p->dir, t->id);
+	fd = open(path, write ? O_CREAT | O_WRONLY : O_RDONLY, 0644);
+	buf = malloc(p->io_size);
+	if(fd == -1 || !buf)
+	{
+		t->failed = fd == -1 ? errno : ENOMEM;
+		goto out;
+	}
+	// something other than zeroes, so nothing along the way can tell the blocks are empty
+	memset(buf, 0x5a + t->id, p->io_size);
+	for(i = 0; i < chunks; i++)
+	{
+		chunk = random ? ((unsigned long long)rand_r(&seed) * (RAND_MAX + 1ULL) + rand_r(&seed)) % chunks : i;
+		if(write)
+			n = pwrite(fd, buf, p->io_size, chunk * p->io_size);
+		else
+			n = pread(fd, buf, p->io_size, chunk * p->io_size);
+		if(n != (ssize_t)p->io_size)
+		{
+			t->failed = n == -1 ? errno : EIO;
+			goto out;
+		}
+		t->ops++;
+		t->bytes += n;
+	}
+	// a write is only done once it is on the disk
+	if(write && fsync(fd) == -1)
+		t->failed = errno;
+out:
+	free(buf);
+	if(fd != -1)
+		close(fd);
+}
+
+static void do_seqwrite(struct bench_thread *t) { do_io(t, 1, 0); }
+static void do_seqread(struct bench_thread *t) { do_io(t, 0, 0); }
+static void do_randwrite(struct bench_thread *t) { do_io(t, 1, 1); }
+static void do_randread(struct bench_thread *t) { do_io(t, 0, 1); }
+
+static const struct {
+	const char *name;
+	workload_fn fn;
+} workloads[] = {
+	{ "create", do_create },
+	{ "stat", do_stat },
+	{ "readdir", do_readdir },
+	{ "seqwrite", do_seqwrite },
+	{ "seqread", do_seqread },
+	{ "randwrite", do_randwrite },
+	{ "randread", do_randread },
+};
+
+static workload_fn chosen;
+
+static void *run_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+
+	pthread_barrier_wait(&start_barrier);
+	chosen(t);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-n files] [-m MiB] [-b io size] [-p passes] [-s seed] [-H] <workload> <directory on hollyfs> <threads>\n", prog);
+	printf("workloads: create stat readdir seqwrite seqread randwrite randread\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_params p = { .files = 5000, .bytes = 64ULL << 20, .io_size = 4096, .passes = 20, .seed = 1 };
+	struct bench_thread *threads;
+	unsigned long long ops = 0, bytes = 0;
+	int nthreads, i, opt;
+	const char *workload;
+	char path[4200];
+	double start, elapsed;
+
+	while((opt = getopt(argc, argv, "n:m:b:p:s:H")) != -1)
+	{
+		if(opt == 'n')
+			p.files = strtoul(optarg, NULL, 0);
+		else if(opt == 'm')
+			p.bytes = strtoull(optarg, NULL, 0) << 20;
+		else if(opt == 'b')
+			p.io_size = strtoul(optarg, NULL, 0);
+		else if(opt == 'p')
+			p.passes = strtoul(optarg, NULL, 0);
+		else if(opt == 's')
+			p.seed = strtoul(optarg, NULL, 0);
+		else if(opt == 'H')
+		{
+			printf("workload,threads,ops,bytes,seconds,ops_per_sec,mib_per_sec\n");
+			return 0;
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(argc - optind != 3)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	workload = argv[optind];
+	p.dir = argv[optind + 1];
+	nthreads = atoi(argv[optind + 2]);
+	if(nthreads < 1 || p.files < 1 || p.io_size < 1 || p.bytes < p.io_size || p.passes < 1)
+	{
+		printf("thread count and sizes have to be positive, and the data size at least one io\n");
+		return 1;
+	}
+	for(i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++)
+	{
+		if(strcmp(workloads[i].name, workload) == 0)
+			chosen = workloads[i].fn;
+	}
+	if(!chosen)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	threads = calloc(nthreads, sizeof(struct bench_thread));
+	if(!threads)
+		return 1;
+	for(i = 0; i < nthreads; i++)
+	{
+		threads[i].p = &p;
+		threads[i].id = i;
+		// the directories are made outside of the timing, create only times the creates
+		if(chosen == do_create)
+		{
+			thread_path(&threads[i], -1, path, sizeof(path));
+			if(mkdir(path, 0755) == -1 && errno != EEXIST)
+			{
+				printf("could not make %s: %s\n", path, strerror(errno));
+				free(threads);
+				return 1;
+			}
+		}
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&threads[i].tid, NULL, run_thread, &threads[i]);
+	// let them all go at once and time until the last one is done
+	start = now();
+	pthread_barrier_wait(&start_barrier);
+	for(i = 0; i < nthreads; i++)
+		pthread_join(threads[i].tid, NULL);
+	elapsed = now() - start;
+	pthread_barrier_destroy(&start_barrier);
+
+	for(i = 0; i < nthreads; i++)
+	{
+		if(threads[i].failed)
+		{
+			fprintf(stderr, "%s: thread %d failed: %s\n", workload, i, strerror(threads[i].failed));
+			free(threads);
+			return 1;
+		}
+		ops += threads[i].ops;
+		bytes += threads[i].bytes;
+	}
+	printf("%s,%d,%llu,%llu,%.6f,%.1f,%.2f\n", workload, nthreads, ops, bytes, elapsed, ops / elapsed, bytes / elapsed / (1 << 20));
+	free(threads);
+	return 0;
+}
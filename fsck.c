@@ -0,0 +1,583 @@
+/* fsck.c */
+
+/* Checks a hollyfs partition or image file without mounting it, and without root for an image.
+It only reads, nothing gets repaired, a problem is printed and counted and the exit code says whether there were any.
+
+The work is split by allocation group over worker threads, every group is checked on its own:
+  pass 1  every inode slot the group handed out: the inode itself, its extent map (every block it points at
+          has to be a data block, and no block may belong to two inodes unless its group has a refcount table,
+          then the extra users are counted), and for a folder its records and its hash index, every name counts
+          as a reference to the inode it points at
+  pass 2  the group's bitmap against the blocks pass 1 found in use, its refcount table against the extra
+          users pass 1 counted, the group's free inode list, and the link count of every inode against the
+          references pass 1 counted
+The orphan list goes through inodes of every group, so the main thread walks it in between the passes.
+The blocks found in use and the references are shared arrays that the threads update with atomic operations,
+so the passes need no locks.
+
+usage: fsck [-j threads] [-m max problems to print] <device or image file>
+exit code: 0 clean, 4 problems were found, 8 the check could not run
+*/
+
+#include "hollyfs_lib.h"
+#include <stdio.h> // provides printf
+#include <stdlib.h> // provides calloc and strtoul
+#include <string.h> // provides memchr and strerror
+#include <stdarg.h> // provides va_list for problem
+#include <unistd.h> // provides getopt and sysconf
+#include <pthread.h> // provides the threads
+#include <sys/stat.h> // provides S_ISDIR
+#include <time.h> // provides clock_gettime
+
+
+// what pass 1 learns about an inode that pass 2 and the orphan walk need, one byte per inode number
+#define INODE_LIVE 1 // the slot holds a file or folder
+#define INODE_DIR 2
+#define INODE_ORPHAN 4 // live with no links, it has to be on the orphan list
+#define INODE_ON_ORPHAN_LIST 8
+#define INODE_ON_FREE_LIST 16
+
+// the whole state of a check, shared by every thread
+struct fsck {
+	struct hollyfs_image img;
+	unsigned int threads;
+	unsigned long long max_reports;
+	unsigned long long inode_count; // group_count * inodes_per_group
+	unsigned long long *claimed; // a bit per block of the partition, set for every block something was found to use
+	unsigned short *shared; // users of every block beyond the first, only counted in groups with a refcount table
+	unsigned int *refs; // names pointing at every inode number
+	unsigned char *state; // INODE_ flags of every inode number
+	unsigned int next_group; // the next group a thread takes on
+	int pass;
+	pthread_mutex_t print_lock;
+	// totals for the summary
+	unsigned long long problems, files, dirs, orphans, used_blocks, free_blocks;
+};
+
+// counts a problem and prints it, as long as not too many were printed yet
+__attribute__((format(printf, 2, 3)))
+static void problem(struct fsck *f, const char *fmt, ...)
+{
+	unsigned long long n = __atomic_add_fetch(&f->problems, 1, __ATOMIC_RELAXED);
+	va_list ap;
+
+	if(n > f->max_reports)
+		return;
+	pthread_mutex_lock(&f->print_lock);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+	if(n == f->max_reports)
+		printf("(not printing any more problems, -m changes how many are printed)\n");
+	pthread_mutex_unlock(&f->print_lock);
+}
+
+static void add_total(unsigned long long *total, unsigned long long n)
+{
+	__atomic_add_fetch(total, n, __ATOMIC_RELAXED);
+}
+
+// marks count blocks from block on as used by whoever (for the message), a word at a time, and complains
+// about every block some other user marked before
+static void claim_blocks(struct fsck *f, unsigned int block, unsigned int count, const char *who, unsigned int ino)
+{
+	unsigned long long b = block, end = (unsigned long long)block + count, mask, old;
+	unsigned int n;
+
+	while(b < end)
+	{
+		n = 64 - b % 64;
+		if(n > end - b)
+			n = end - b;
+		mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << (b % 64);
+		old = __atomic_fetch_or(&f->claimed[b / 64], mask, __ATOMIC_RELAXED);
+		if(old & mask)
+			problem(f, "block %llu (%s of inode %u) is used more than once", b + __builtin_ctzll(old & mask) - b % 64, who, ino);
+		b += n;
+	}
+}
+
+// the same for the blocks of a file's extent, in a group with a refcount table a block may belong to more files
+// (reflinks), every user after the first is counted for pass 2 to hold against the table instead
+static void claim_data(struct fsck *f, unsigned int block, unsigned int count, unsigned int ino)
+{
+	const hollyfs_superblock *sb = f->img.sb;
+	const hollyfs_group_desc *gd = hollyfs_group(&f->img, (block - sb->first_group_block) / HOLLYFS_BLOCKS_PER_GROUP);
+	unsigned long long b, mask;
+
+	if(!gd || !gd->refcount_block)
+	{
+		claim_blocks(f, block, count, "data", ino);
+		return;
+	}
+	for(b = block; b < (unsigned long long)block + count; b++)
+	{
+		mask = 1ULL << (b % 64);
+		if(__atomic_fetch_or(&f->claimed[b / 64], mask, __ATOMIC_RELAXED) & mask)
+			__atomic_add_fetch(&f->shared[b], 1, __ATOMIC_RELAXED);
+	}
+}
+
+// whether [block, block + count) lies inside the data blocks of a single group
+static int data_range_ok(struct fsck *f, unsigned int block, unsigned int count)
+{
+	const hollyfs_superblock *sb = f->img.sb;
+	const hollyfs_group_desc *gd;
+	unsigned int g;
+
+	if(!count || block < sb->first_group_block || (unsigned long long)block + count > sb->fs_size)
+		return 0;
+	g = (block - sb->first_group_block) / HOLLYFS_BLOCKS_PER_GROUP;
+	gd = hollyfs_group(&f->img, g);
+	return gd && block >= gd->data_block_base && (unsigned long long)block + count <= (unsigned long long)gd->bitmap_block + gd->block_count;
+}
+
+// the extent map of a live inode: inline data or sorted, non-overlapping extents over data blocks that nothing else uses
+static void check_extents(struct fsck *f, unsigned int ino, const hollyfs_inode *inode)
+{
+	unsigned long long prev_end = 0, blocks = 0;
+	const hollyfs_extent *e;
+	unsigned int i, len;
+
+	if(inode->flags & HOLLYFS_INODE_INLINE_DATA)
+	{
+		if(S_ISDIR(inode->mode))
+			problem(f, "inode %u: a folder with inline data", ino);
+		if(inode->file_size > HOLLYFS_INLINE_DATA_MAX || inode->extent_count || inode->extent_block)
+			problem(f, "inode %u: inline data of %llu bytes with %u extents", ino, inode->file_size, inode->extent_count);
+		return;
+	}
+	if(inode->extent_count > HOLLYFS_MAX_EXTENTS)
+	{
+		problem(f, "inode %u: %u extents, at most %lu fit", ino, inode->extent_count, (unsigned long)HOLLYFS_MAX_EXTENTS);
+		return;
+	}
+	if(inode->extent_count > HOLLYFS_INODE_EXTENTS && !inode->extent_block)
+	{
+		problem(f, "inode %u: %u extents but no extent block", ino, inode->extent_count);
+		return;
+	}
+	if(inode->extent_block)
+	{
+		if(!data_range_ok(f, inode->extent_block, 1))
+		{
+			problem(f, "inode %u: extent block %u is not a data block", ino, inode->extent_block);
+			return;
+		}
+		claim_blocks(f, inode->extent_block, 1, "extent block", ino);
+		blocks++;
+	}
+	for(i = 0; i < inode->extent_count; i++)
+	{
+		e = hollyfs_get_extent(&f->img, inode, i);
+		if(!e)
+			return;
+		len = hollyfs_ext_len(e);
+		if(!len || e->logical_block < prev_end || (unsigned long long)e->logical_block + len > 1ULL << 32)
+		{
+			problem(f, "inode %u: extent %u (file blocks %u+%u) is empty, out of order or overlaps the one before", ino, i, e->logical_block, len);
+			continue;
+		}
+		prev_end = (unsigned long long)e->logical_block + len;
+		// an allocation run never leaves its group, the next group starts with its bitmap block
+		if(!data_range_ok(f, e->start_block, len))
+		{
+			problem(f, "inode %u: extent %u (blocks %u+%u) is not inside the data blocks of one group", ino, i, e->start_block, len);
+			continue;
+		}
+		claim_data(f, e->start_block, len, ino);
+		blocks += len;
+	}
+	add_total(&f->used_blocks, blocks);
+}
+
+// what the record walk of one folder adds up
+struct dir_walk {
+	struct fsck *f;
+	unsigned int ino;
+	unsigned int names, subdirs;
+};
+
+static int check_record(void *arg, const hollyfs_directory_record *rec, unsigned int pos)
+{
+	struct dir_walk *w = arg;
+	struct fsck *f = w->f;
+	const hollyfs_inode *child = hollyfs_inode_slot(&f->img, rec->inode_no);
+	unsigned int type;
+
+	w->names++;
+	if(!rec->name_len || memchr(rec->name, '/', rec->name_len) || memchr(rec->name, '\0', rec->name_len) ||
+	   (rec->name_len <= 2 && rec->name[0] == '.' && (rec->name_len == 1 || rec->name[1] == '.')))
+		problem(f, "folder %u: bad name at offset %u", w->ino, pos);
+	if(!child || !hollyfs_inode_live(child))
+	{
+		problem(f, "folder %u: %.*s points to inode %u, which is free", w->ino, rec->name_len, rec->name, rec->inode_no);
+		return 0;
+	}
+	__atomic_add_fetch(&f->refs[rec->inode_no], 1, __ATOMIC_RELAXED);
+	type = S_ISDIR(child->mode) ? HOLLYFS_FILE_TYPE_DIR : HOLLYFS_FILE_TYPE_FILE;
+	if(rec->file_type != type)
+		problem(f, "folder %u: the record of %.*s has the wrong file type", w->ino, rec->name_len, rec->name);
+	if(type == HOLLYFS_FILE_TYPE_DIR)
+		w->subdirs++;
+	return 0;
+}
+
+// what counting the names of a folder that belong to its overflowed index blocks adds up
+struct overflow_walk {
+	const struct hollyfs_image *img;
+	const hollyfs_inode *dir;
+	unsigned int names;
+};
+
+static int count_overflow(void *arg, const hollyfs_directory_record *rec, unsigned int pos)
+{
+	struct overflow_walk *w = arg;
+	const hollyfs_dir_index_block *ib;
+
+	(void)pos;
+	ib = hollyfs_dir_index(w->img, w->dir, hollyfs_name_hash(rec->name, rec->name_len) & (w->dir->dir_index_blocks - 1));
+	if(ib && (ib->flags & HOLLYFS_INDEX_OVERFLOW))
+		w->names++;
+	return 0;
+}
+
+// the records of a folder, its link and name counts and its hash index
+static void check_dir(struct fsck *f, unsigned int ino, const hollyfs_inode *dir)
+{
+	struct dir_walk w = { f, ino, 0, 0 };
+	struct overflow_walk o = { &f->img, dir, 0 };
+	const hollyfs_dir_index_block *ib;
+	const hollyfs_directory_record *rec;
+	unsigned int k, i, bad_pos, slots = 0, overflow_slots = 0;
+	int overflow = 0;
+
+	if(dir->file_size % HOLLYFS_BLOCK_SIZE || !dir->file_size)
+		problem(f, "folder %u: its size %llu is not a whole number of blocks", ino, dir->file_size);
+	if(hollyfs_dir_iterate(&f->img, dir, check_record, &w, &bad_pos) == -1)
+	{
+		problem(f, "folder %u: broken record or missing block at offset %u", ino, bad_pos);
+		return;
+	}
+	if(dir->links_count != 2 + w.subdirs)
+		problem(f, "folder %u: %u links, it has %u subfolders so it should have %u", ino, dir->links_count, w.subdirs, 2 + w.subdirs);
+	if(dir->dir_child_count != w.names)
+		problem(f, "folder %u: says it has %u names, it has %u", ino, dir->dir_child_count, w.names);
+
+	if(!dir->dir_index_blocks)
+	{
+		if(w.names)
+			problem(f, "folder %u: %u names but no hash index", ino, w.names);
+		return;
+	}
+	if(dir->dir_index_blocks > HOLLYFS_DIR_INDEX_MAX_BLOCKS || (dir->dir_index_blocks & (dir->dir_index_blocks - 1)))
+	{
+		problem(f, "folder %u: %u index blocks, not a power of two up to %u", ino, dir->dir_index_blocks, HOLLYFS_DIR_INDEX_MAX_BLOCKS);
+		return;
+	}
+	// every slot sits in the block its hash picks and points at a live record with that hash,
+	// and there are as many slots as names, so every name is found by a lookup, only the names
+	// of a block marked HOLLYFS_INDEX_OVERFLOW can be without one, a lookup scans for those
+	for(k = 0; k < dir->dir_index_blocks; k++)
+	{
+		ib = hollyfs_dir_index(&f->img, dir, k);
+		if(!ib)
+		{
+			problem(f, "folder %u: index block %u is missing", ino, k);
+			return;
+		}
+		if(ib->flags & ~HOLLYFS_INDEX_OVERFLOW)
+			problem(f, "folder %u: index block %u has unknown flags %#x", ino, k, ib->flags);
+		if(ib->flags & HOLLYFS_INDEX_OVERFLOW)
+		{
+			overflow = 1;
+			overflow_slots += ib->slot_count;
+		}
+		for(i = 0; i < ib->slot_count; i++)
+		{
+			rec = hollyfs_dir_record(&f->img, dir, ib->slots[i].pos);
+			if((ib->slots[i].hash & (dir->dir_index_blocks - 1)) != k || !rec || !rec->inode_no ||
+			   hollyfs_name_hash(rec->name, rec->name_len) != ib->slots[i].hash)
+				problem(f, "folder %u: index slot %u of block %u points to offset %u, where its name is not", ino, i, k, ib->slots[i].pos);
+		}
+		slots += ib->slot_count;
+	}
+	if(overflow)
+		hollyfs_dir_iterate(&f->img, dir, count_overflow, &o, &bad_pos);
+	if(slots - overflow_slots != w.names - o.names || overflow_slots > o.names)
+		problem(f, "folder %u: %u names but %u index slots", ino, w.names, slots);
+}
+
+// pass 1 of group g: the group descriptor and every inode slot it handed out
+static void check_group_inodes(struct fsck *f, unsigned int g)
+{
+	const hollyfs_superblock *sb = f->img.sb;
+	const hollyfs_group_desc *gd = hollyfs_group(&f->img, g);
+	unsigned int ipg = sb->inodes_per_group, slot, ino;
+	const hollyfs_inode *inode;
+	unsigned long long files = 0, dirs = 0, orphans = 0;
+
+	// the same checks the kernel makes at mount
+	if(gd->bitmap_block != sb->first_group_block + g * sb->blocks_per_group || gd->inode_table_block != gd->bitmap_block + 1 ||
+	   gd->data_block_base != gd->inode_table_block + sb->inode_table_blocks || gd->block_count > sb->blocks_per_group ||
+	   gd->block_count <= gd->data_block_base - gd->bitmap_block || gd->inodes_used > ipg || gd->free_inodes > gd->inodes_used ||
+	   (unsigned long long)gd->bitmap_block + gd->block_count > sb->fs_size)
+	{
+		problem(f, "group %u: the group descriptor is corrupted, skipping the group", g);
+		return;
+	}
+	// the bitmap and the inode table are the group's own
+	claim_blocks(f, gd->bitmap_block, 1 + sb->inode_table_blocks, "group metadata", 0);
+	// the refcount table, if any, can be in the data blocks of any group
+	if(gd->refcount_block)
+	{
+		if(data_range_ok(f, gd->refcount_block, HOLLYFS_REFCOUNT_BLOCKS))
+			claim_blocks(f, gd->refcount_block, HOLLYFS_REFCOUNT_BLOCKS, "refcount table", 0);
+		else
+			problem(f, "group %u: refcount table at %u is not inside the data blocks of one group", g, gd->refcount_block);
+	}
+
+	for(slot = 0; slot < gd->inodes_used; slot++)
+	{
+		ino = g * ipg + slot;
+		inode = hollyfs_inode_slot(&f->img, ino);
+		if(!inode || !hollyfs_inode_live(inode))
+			continue;
+		f->state[ino] = INODE_LIVE;
+		if(inode->inode_num != ino)
+			problem(f, "inode %u: says it is inode %u", ino, inode->inode_num);
+		if(S_ISDIR(inode->mode) != (inode->type == HOLLYFS_FILE_TYPE_DIR))
+			problem(f, "inode %u: mode 0%o does not go with type %u", ino, inode->mode, inode->type);
+		if(!inode->links_count)
+		{
+			f->state[ino] |= INODE_ORPHAN;
+			orphans++;
+		}
+		check_extents(f, ino, inode);
+		if(S_ISDIR(inode->mode))
+		{
+			f->state[ino] |= INODE_DIR;
+			dirs++;
+			// an orphaned folder was emptied before its last link went
+			if(inode->links_count)
+				check_dir(f, ino, inode);
+		}
+		else
+		{
+			files++;
+		}
+	}
+	add_total(&f->files, files);
+	add_total(&f->dirs, dirs);
+	add_total(&f->orphans, orphans);
+}
+
+// pass 2 of group g: its bitmap, its free inode list and the link counts of its inodes
+static void check_group_usage(struct fsck *f, unsigned int g)
+{
+	const hollyfs_superblock *sb = f->img.sb;
+	const hollyfs_group_desc *gd = hollyfs_group(&f->img, g);
+	const unsigned char *bitmap = hollyfs_bitmap(&f->img, g);
+	unsigned int ipg = sb->inodes_per_group, bit, ino, n, leaked = 0, free_blocks = 0, refs;
+	unsigned long long block;
+	const hollyfs_inode *inode;
+	int on_disk, used;
+
+	// a group pass 1 skipped has nothing claimed, its bitmap would only give noise
+	block = gd->bitmap_block;
+	if(!bitmap || block >= sb->fs_size || !((f->claimed[block / 64] >> (block % 64)) & 1))
+		return;
+	for(bit = 0; bit < HOLLYFS_BITS_PER_BLOCK; bit++)
+	{
+		on_disk = (bitmap[bit / 8] >> (bit % 8)) & 1;
+		if(bit >= gd->block_count)
+		{
+			if(on_disk)
+			{
+				problem(f, "group %u: bitmap bits past the end of the group are set", g);
+				break;
+			}
+			continue;
+		}
+		block = gd->bitmap_block + bit;
+		used = (f->claimed[block / 64] >> (block % 64)) & 1;
+		if(used && !on_disk)
+			problem(f, "block %llu is in use but free in the bitmap of group %u", block, g);
+		else if(on_disk && !used)
+			leaked++;
+		free_blocks += !on_disk;
+		// a count too high only keeps the block from being freed, one too low frees it under a file that still has it
+		refs = gd->refcount_block ? hollyfs_refcount(&f->img, block) : 0;
+		if(refs != f->shared[block])
+			problem(f, "block %llu: its refcount says %u more files use it, %u do", block, refs, f->shared[block]);
+	}
+	if(leaked)
+		problem(f, "group %u: %u blocks are marked in use but nothing uses them", g, leaked);
+	add_total(&f->free_blocks, free_blocks);
+
+	// the free inode list, only slots the group handed out and that are empty now, as many as the descriptor says
+	for(ino = gd->free_inode_head, n = 0; ino && n <= gd->free_inodes; ino = inode->next_ino, n++)
+	{
+		inode = hollyfs_inode_slot(&f->img, ino);
+		if(ino / ipg != g || !inode || hollyfs_inode_live(inode) || (f->state[ino] & INODE_ON_FREE_LIST))
+		{
+			problem(f, "group %u: the free inode list is corrupted at inode %u", g, ino);
+			break;
+		}
+		f->state[ino] |= INODE_ON_FREE_LIST;
+	}
+	if(!ino && n != gd->free_inodes)
+		problem(f, "group %u: %u inodes on the free list, the descriptor says %u", g, n, gd->free_inodes);
+	// the walk stops one past the count, a list that is still going there is longer than the descriptor says
+	else if(ino && n > gd->free_inodes)
+		problem(f, "group %u: the free inode list goes on past the %u inodes the descriptor says", g, gd->free_inodes);
+
+	// every live inode is reachable by as many names as it has links, a folder by exactly one, the root by none
+	for(ino = g * ipg; ino < g * ipg + gd->inodes_used; ino++)
+	{
+		if(!(f->state[ino] & INODE_LIVE))
+			continue;
+		inode = hollyfs_inode_slot(&f->img, ino);
+		if(f->state[ino] & INODE_ORPHAN)
+		{
+			if(f->refs[ino])
+				problem(f, "inode %u: has no links but %u names point to it", ino, f->refs[ino]);
+			if(!(f->state[ino] & INODE_ON_ORPHAN_LIST))
+				problem(f, "inode %u: has no links and is not on the orphan list, its blocks are lost", ino);
+		}
+		else if(f->state[ino] & INODE_DIR)
+		{
+			if(f->refs[ino] != (ino != HOLLYFS_ROOT_INO))
+				problem(f, "folder %u: %u names point to it", ino, f->refs[ino]);
+		}
+		else if(f->refs[ino] != inode->links_count)
+		{
+			problem(f, "inode %u: %u links, but %u names point to it", ino, inode->links_count, f->refs[ino]);
+		}
+	}
+}
+
+// takes groups off the shared counter until there are none left, doing the current pass on each
+static void *worker(void *arg)
+{
+	struct fsck *f = arg;
+	unsigned int g;
+
+	while((g = __atomic_fetch_add(&f->next_group, 1, __ATOMIC_RELAXED)) < f->img.sb->group_count)
+	{
+		if(f->pass == 1)
+			check_group_inodes(f, g);
+		else
+			check_group_usage(f, g);
+	}
+	return NULL;
+}
+
+static void run_pass(struct fsck *f, int pass)
+{
+	pthread_t *tids = calloc(f->threads, sizeof(pthread_t));
+	unsigned int i;
+
+	f->pass = pass;
+	f->next_group = 0;
+	for(i = 0; i < f->threads; i++)
+		pthread_create(&tids[i], NULL, worker, f);
+	for(i = 0; i < f->threads; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+}
+
+// follows the orphan list from the superblock, every inode on it has to be live with no links
+static void check_orphan_list(struct fsck *f)
+{
+	const hollyfs_inode *inode;
+	unsigned int ino;
+
+	for(ino = f->img.sb->orphan_head; ino; ino = inode->next_ino)
+	{
+		inode = ino < f->inode_count ? hollyfs_inode_slot(&f->img, ino) : NULL;
+		if(!inode || !(f->state[ino] & INODE_ORPHAN) || (f->state[ino] & INODE_ON_ORPHAN_LIST))
+		{
+			problem(f, "the orphan list is corrupted at inode %u", ino);
+			return;
+		}
+		f->state[ino] |= INODE_ON_ORPHAN_LIST;
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-j threads] [-m max problems to print] <device or image file>\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fsck f = { .max_reports = 100, .print_lock = PTHREAD_MUTEX_INITIALIZER };
+	const hollyfs_superblock *sb;
+	const hollyfs_inode *root;
+	struct timespec start, end;
+	const char *why;
+	int opt, err;
+
+	f.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while((opt = getopt(argc, argv, "j:m:")) != -1)
+	{
+		if(opt == 'j')
+			f.threads = strtoul(optarg, NULL, 0);
+		else if(opt == 'm')
+			f.max_reports = strtoull(optarg, NULL, 0);
+		else
+		{
+			usage(argv[0]);
+			return 8;
+		}
+	}
+	if(optind != argc - 1 || f.threads < 1)
+	{
+		usage(argv[0]);
+		return 8;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	err = hollyfs_open_image(&f.img, argv[optind], &why);
+	if(err)
+	{
+		printf("Could not open %s: %s\n", argv[optind], why ? why : strerror(err));
+		return 8;
+	}
+	sb = f.img.sb;
+	if(f.img.journal_dirty)
+		printf("The journal has not been replayed, the last changes are only in there, mount it once to replay them. Checking what is on disk anyway\n");
+	if(f.threads > sb->group_count)
+		f.threads = sb->group_count;
+
+	f.inode_count = (unsigned long long)sb->group_count * sb->inodes_per_group;
+	f.claimed = calloc(sb->fs_size / 64 + 1, sizeof(unsigned long long));
+	f.shared = calloc(sb->fs_size, sizeof(unsigned short));
+	f.refs = calloc(f.inode_count, sizeof(unsigned int));
+	f.state = calloc(f.inode_count, 1);
+	if(!f.claimed || !f.shared || !f.refs || !f.state)
+	{
+		printf("Out of memory\n");
+		return 8;
+	}
+	// the superblock, the group descriptor table and the journal are in front of the groups
+	claim_blocks(&f, 0, sb->first_group_block, "the layout", 0);
+
+	root = hollyfs_inode_slot(&f.img, HOLLYFS_ROOT_INO);
+	if(!root || !hollyfs_inode_live(root) || !S_ISDIR(root->mode))
+		problem(&f, "the root folder is missing or not a folder");
+
+	run_pass(&f, 1);
+	check_orphan_list(&f);
+	run_pass(&f, 2);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%llu files, %llu folders, %llu deleted but not freed yet, %llu blocks used by them, %llu of %u blocks free\n",
+	       f.files, f.dirs, f.orphans, f.used_blocks, f.free_blocks, sb->fs_size);
+	printf("%llu problems, checked with %u threads in %.1f ms\n", f.problems, f.threads,
+	       (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+	hollyfs_close_image(&f.img);
+	return f.problems ? 4 : 0;
+}
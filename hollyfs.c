@@ -8,218 +8,5293 @@
 #include <linux/types.h>
 #include <linux/slab.h>
 #include <linux/buffer_head.h>
+#include <linux/pagemap.h>
+#include <linux/mpage.h>
+#include <linux/pagevec.h>
+#include <linux/falloc.h>
+#include <linux/iomap.h>
+#include <linux/mm.h>
+#include <linux/writeback.h>
+#include <linux/blkdev.h>
+#include <linux/jbd2.h>
+#include <linux/percpu.h>
+#include <linux/percpu_counter.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/statfs.h>
+#include <linux/uaccess.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+
+#define CREATE_TRACE_POINTS
+#include "hollyfs_trace.h"
 
 
 
 // initializing the cache that will contain the newly created inodes
 struct kmem_cache *hollyfs_inode_cache = NULL;
+// /sys/kernel/debug/hollyfs, every mounted partition gets a directory in here
+static struct dentry *hollyfs_debugfs_root;
+
+// an inode on the orphan list, its last name is gone but it may still be open
+struct hollyfs_orphan {
+	struct list_head list; // in orphans of the hollyfs_sb_info, in the same order as the list on disk
+	struct list_head reclaim; // in reclaim_queue once the inode was evicted, empty until then
+	unsigned int ino;
+};
+
+// the in-memory hollyfs inode, the vfs inode is embedded in it so that alloc_inode can hand out
+// both with a single allocation from hollyfs_inode_cache and HOLLYFS_I can get back from one to the other
+// only what the vfs inode has no place for is kept here, the rest (mode, size, times) lives in vfs_inode
+struct hollyfs_inode_info {
+	unsigned int type; // DIR or FILE
+	unsigned int dir_child_count;
+	unsigned int dir_index_blocks; // directories only: number of hash index blocks, 0 if not indexed yet
+	unsigned int dir_add_block; // directories only: record block the last name went into (or the first one a removal made room in), adding starts looking there
+	unsigned int extent_count; // extents in use, sorted by logical_block across extents[] and then extent_block
+	unsigned int extent_block; // block holding extents HOLLYFS_INODE_EXTENTS and up, 0 if there is none
+	unsigned int flags; // HOLLYFS_INODE_INLINE_DATA, HOLLYFS_INODE_PREALLOC, HOLLYFS_INODE_SHARED
+	bool speculative; // writeback allocated unwritten blocks past the end of the file, the last writer to close it gives them back
+	struct hollyfs_orphan *orphan; // set once the inode's last name is gone, evicting it hands it to the reclaim worker
+	union {
+		hollyfs_extent extents[HOLLYFS_INODE_EXTENTS];
+		char inline_data[HOLLYFS_INLINE_DATA_MAX]; // an inline file's contents, the same bytes as in its inode table slot
+	};
+	struct rw_semaphore extent_sem; // readers map file blocks, writers add or drop extents, also guards inline_data
+	struct inode vfs_inode; // has to stay last, alloc_inode zeroes everything in front of it
+};
+
+// gets the hollyfs inode that a vfs inode is embedded in
+static inline struct hollyfs_inode_info *HOLLYFS_I(struct inode *inode)
+{
+	return container_of(inode, struct hollyfs_inode_info, vfs_inode);
+}
+
+// checks if a file keeps its contents in the inode instead of in extents
+static inline bool hollyfs_has_inline_data(struct inode *inode)
+{
+	return HOLLYFS_I(inode)->flags & HOLLYFS_INODE_INLINE_DATA;
+}
+
+// inode numbers a cpu has reserved but not handed out yet, [next, end)
+struct hollyfs_ino_batch {
+	unsigned int next;
+	unsigned int end;
+};
+
+// in-memory state of one allocation group
+struct hollyfs_group_info {
+	struct buffer_head *bitmap_bh; // the group's bitmap block, read in at mount time and pinned
+	atomic_t free_blocks; // clear bits in the bitmap, the group descriptor only gets a copy at sync and unmount
+	unsigned int alloc_cursor; // next-fit cursor inside the group, only a hint so every cpu reads and moves it without a lock
+	unsigned int trim_start, trim_end; // the free bits a discard is working on right now, the allocator keeps out, trim_end is 0 when there is none
+	unsigned int free_tid; // the newest transaction that freed blocks here, they can only be discarded once it has committed
+	atomic_t needs_discard; // blocks were freed since the background discard last went over the group
+};
+
+// the operations whose latency goes into a histogram
+enum {
+	HOLLYFS_LAT_CREATE,
+	HOLLYFS_LAT_LOOKUP,
+	HOLLYFS_LAT_READDIR,
+	HOLLYFS_LAT_ALLOC,
+	HOLLYFS_LAT_WRITEBACK,
+	HOLLYFS_LAT_OPS
+};
+// bucket b counts the operations that took [2^b, 2^(b+1)) microseconds, the first one everything faster and the last one everything slower
+#define HOLLYFS_LAT_BUCKETS 16
+
+// statistics counters of one cpu, every cpu only ever bumps its own so they cost no shared cache lines,
+// the debugfs files add them up over all cpus
+struct hollyfs_stats {
+	u64 bread; // metadata blocks read through the buffer cache
+	u64 bread_miss; // of those, the ones that were not cached and had to come from the disk
+	u64 sync_commits; // fsyncs, O_SYNC writes and inode writebacks that waited for a journal commit
+	u64 alloc_calls; // block allocations
+	u64 alloc_blocks; // blocks they handed out
+	u64 alloc_groups; // groups they looked at
+	u64 alloc_runs; // free runs they measured
+	u64 freed_blocks; // blocks given back
+	u64 shared_blocks; // blocks that a reflink put into one more file
+	u64 cow_blocks; // blocks that got a copy because a shared one was written
+	u64 lat[HOLLYFS_LAT_OPS][HOLLYFS_LAT_BUCKETS];
+};
+
+// in-memory information about a mounted hollyfs partition, this is what sb->s_fs_info points to
+struct hollyfs_sb_info {
+	struct buffer_head *sb_bh; // buffer holding block 0, kept for the whole mount so sb_ondisk stays valid
+	hollyfs_superblock *sb_ondisk; // the superblock data inside sb_bh
+	struct buffer_head **gdt_bh; // the group descriptor table blocks, pinned like the superblock
+	struct hollyfs_group_info *groups; // one per allocation group
+	struct percpu_counter free_blocks; // free blocks of all groups together, so a full file system fails fast
+	struct percpu_counter dirty_blocks; // blocks reserved by buffered writes that writeback has not allocated yet
+	spinlock_t ino_lock; // guards inodes_used in the group descriptors while a cpu reserves a new batch of inode numbers
+	struct hollyfs_ino_batch __percpu *ino_batch; // every cpu's reserved inode numbers
+	journal_t *journal; // every metadata change goes through this write-ahead journal
+	struct super_block *sb; // the vfs super block, for the reclaim worker
+	struct mutex reclaim_lock; // guards the orphan list (on disk and in orphans), reclaim_queue and the groups' free inode lists
+	struct list_head orphans; // a hollyfs_orphan for every inode on the orphan list
+	struct list_head reclaim_queue; // orphans that were evicted, their blocks and slots are up for freeing
+	struct work_struct reclaim_work; // frees what is in reclaim_queue in the background
+	bool discard; // the discard mount option, freed blocks are discarded in the background
+	struct mutex trim_lock; // one discard pass at a time, FITRIM or background
+	struct delayed_work discard_work; // the background discard pass
+	bool debug; // the debug mount option, a message in the log for every create, lookup and mkdir
+	struct hollyfs_stats __percpu *stats; // every cpu's counters
+	struct dentry *debugfs_dir; // /sys/kernel/debug/hollyfs/<device>
+	spinlock_t refcount_lock; // guards the counts in the refcount tables, a reflink adds to them while other files drop theirs
+	struct mutex refcount_mutex; // held while a group gets its refcount table, so it only gets one
+};
+
+// the chatter about every operation only goes to the log with the debug mount option, it costs latency otherwise
+#define hollyfs_debug(sb, fmt, ...) \
+	do { \
+		if(HOLLYFS_SB(sb)->debug) \
+			printk(KERN_DEBUG fmt, ##__VA_ARGS__); \
+	} while(0)
+
+// bumps a statistics counter of the cpu we run on
+#define hollyfs_stat_add(sbi, name, n) this_cpu_add((sbi)->stats->name, (n))
+
+// how many inode numbers a cpu reserves at a time, a whole inode table block, so creates
+// running on different cpus log different inode table blocks as well
+#define HOLLYFS_INO_BATCH HOLLYFS_INODES_PER_BLOCK
+
+// journal credits are the number of metadata blocks an operation may change, jbd2 reserves log space for them up front
+// a create touches a group descriptor block (when its cpu reserves new inode numbers), both inode table blocks, a record block and an index block,
+// when the directory is full a new record block with its bitmap and the directory's extent block (and that one's bitmap when it is new),
+// and when the directory first gets its hash index a new index block and its bitmap as well
+#define HOLLYFS_CREATE_CREDITS 13
+// an unlink touches the record block, the index block and both inodes, and the superblock when the inode goes on the orphan list
+#define HOLLYFS_UNLINK_CREDITS 5
+// a rename adds a name like a create does and takes away two like an unlink does, the old one and the one it replaces
+#define HOLLYFS_RENAME_CREDITS (HOLLYFS_CREATE_CREDITS + 2 * HOLLYFS_UNLINK_CREDITS)
+// how many directory blocks readdir keeps reading ahead of the one it is working on
+#define HOLLYFS_DIR_READAHEAD 32
+// readdir positions 0 and 1 are . and .., the records' byte offsets are moved up past them
+#define HOLLYFS_DIR_POS_DOTS 2
+// giving a file a new block touches the bitmap, the extent block and the inode, and when the extent block
+// itself is new it can come from a second bitmap block, a block copied on write gives back the shared one on top,
+// which touches its bitmap or its refcount table
+#define HOLLYFS_WRITE_CREDITS 6
+// dirty_inode only rewrites the inode's slot in the inode table
+#define HOLLYFS_INODE_CREDITS 1
+// writeback allocating a run for delayed blocks: the run and the speculative blocks after it can come from two bitmaps,
+// turning unwritten blocks into written ones can add extents, and the extent block, its bitmap and the inode on top,
+// a run copied on write gives back the shared blocks as well, a run of HOLLYFS_DA_MAX_PAGES can touch two bitmaps
+// and two refcount table blocks for that
+#define HOLLYFS_DA_CREDITS 12
+// the reclaim worker keeps this many credits of its handle for an inode's table block, its extent block and that
+// block's bitmap block, the orphan in front of it (or the superblock) and the group descriptor block, and revokes at
+// most HOLLYFS_RECLAIM_REVOKES blocks of a directory per transaction
+#define HOLLYFS_RECLAIM_CREDITS 5
+#define HOLLYFS_RECLAIM_REVOKES 4096
+// blocks a reservation always leaves free, for the extent blocks that writeback may still have to allocate
+#define HOLLYFS_DA_SLACK 32
+// the most pages writeback gathers into one run of delayed blocks
+#define HOLLYFS_DA_MAX_PAGES 256
+// the unwritten blocks writeback allocates past the end of a file it has just extended, as many as the file
+// already has but at least HOLLYFS_PREALLOC_MIN and at most HOLLYFS_PREALLOC_MAX, so the next appends find their blocks
+// right behind the file, that is only done while more than 1/HOLLYFS_PREALLOC_FREE_SHARE of the partition is free
+#define HOLLYFS_PREALLOC_MIN 16
+#define HOLLYFS_PREALLOC_MAX 256
+#define HOLLYFS_PREALLOC_FREE_SHARE 16
+// the background discard waits this long after blocks were freed, so the frees of an rm -rf all go out in one pass,
+// and only discards free runs of at least HOLLYFS_DISCARD_MIN_BLOCKS, shorter ones are left to a FITRIM
+#define HOLLYFS_DISCARD_DELAY (10 * HZ)
+#define HOLLYFS_DISCARD_MIN_BLOCKS 16
+// the refcount table blocks a run of n blocks can have counts in, it may start near the end of one and go over into
+// the next one or into the next group's table
+#define HOLLYFS_REFCOUNT_CREDITS(n) (DIV_ROUND_UP(n, HOLLYFS_REFCOUNTS_PER_BLOCK) + 2)
+// a reflink shares at most this many blocks per transaction
+#define HOLLYFS_CLONE_CHUNK 8192
+// sharing a chunk: its refcount blocks, and when the chunk goes over into a new group two new refcount tables with
+// two bitmaps each (a table is allocated like any other run) and their group descriptor blocks, then the inodes of
+// both files, on top of what dropping the target's old blocks in the range takes
+#define HOLLYFS_CLONE_CREDITS (HOLLYFS_REFCOUNT_CREDITS(HOLLYFS_CLONE_CHUNK) + 2 * (HOLLYFS_REFCOUNT_BLOCKS + 3) + 2)
+// a delayed buffer is not mapped, this only goes into its b_blocknr so clean_bdev_bh_alias finds nothing to clean,
+// it is past the end of every partition a 32 bit block number can describe
+#define HOLLYFS_DELAY_BLOCK (~(sector_t)0xffff)
+
+// small helper to get our private super block info out of the vfs super block
+static inline struct hollyfs_sb_info *HOLLYFS_SB(struct super_block *sb)
+{
+	return sb->s_fs_info;
+}
+
+// puts the time since start (a ktime_get_ns) into the latency histogram of op and returns it
+static u64 hollyfs_stat_latency(struct hollyfs_sb_info *sbi, unsigned int op, u64 start)
+{
+	u64 ns = ktime_get_ns() - start;
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+
+	this_cpu_inc(sbi->stats->lat[op][us ? min_t(unsigned int, ilog2(us), HOLLYFS_LAT_BUCKETS - 1) : 0]);
+	return ns;
+}
+
+// sb_bread that counts the metadata reads, and the ones among them that the buffer cache could not serve
+static struct buffer_head *hollyfs_bread(struct super_block *sb, sector_t block)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct buffer_head *bh;
+
+	hollyfs_stat_add(sbi, bread, 1);
+	bh = sb_getblk(sb, block);
+	if(!bh || buffer_uptodate(bh))
+		return bh;
+	hollyfs_stat_add(sbi, bread_miss, 1);
+	brelse(bh);
+	return sb_bread(sb, block);
+}
+
+// returns the descriptor of group g, and in *bhp (when asked for) the group descriptor table block it is in
+static inline hollyfs_group_desc *hollyfs_get_group_desc(struct hollyfs_sb_info *sbi, unsigned int g, struct buffer_head **bhp)
+{
+	struct buffer_head *bh = sbi->gdt_bh[g / HOLLYFS_GROUP_DESCS_PER_BLOCK];
+
+	if(bhp)
+		*bhp = bh;
+	return (hollyfs_group_desc *)bh->b_data + g % HOLLYFS_GROUP_DESCS_PER_BLOCK;
+}
+
+// works out which group block is in and which bit of that group's bitmap stands for it
+// returns false for the blocks in front of group 0 (superblock, group descriptors, journal) and past the last group
+static bool hollyfs_block_group(struct hollyfs_sb_info *sbi, unsigned int block, unsigned int *group, unsigned int *bit)
+{
+	hollyfs_superblock *sb_ondisk = sbi->sb_ondisk;
+	hollyfs_group_desc *gd;
+
+	if(block < sb_ondisk->first_group_block)
+		return false;
+	*group = (block - sb_ondisk->first_group_block) / sb_ondisk->blocks_per_group;
+	if(*group >= sb_ondisk->group_count)
+		return false;
+	gd = hollyfs_get_group_desc(sbi, *group, NULL);
+	*bit = block - gd->bitmap_block;
+	return *bit < gd->block_count;
+}
+
+// starts a journal handle, all the metadata changes made until the matching jbd2_journal_stop commit
+// (or are lost in a crash) together, revokes is how many freed metadata blocks the operation may revoke
+// while a handle is running jbd2 batches every other handle started meanwhile into the same transaction,
+// so many concurrent creates end up as one sequential journal write when the transaction commits
+// a task that already holds a handle just gets it back, so helpers can start their own without caring
+static handle_t *hollyfs_journal_start(struct super_block *sb, int credits, int revokes)
+{
+	return jbd2__journal_start(HOLLYFS_SB(sb)->journal, credits, 0, revokes, GFP_NOFS, 0, 0);
+}
+
+// the most credits one handle asks for, jbd2 refuses a handle bigger than j_max_transaction_buffers and the other
+// handles of the transaction want their share of it too
+static inline int hollyfs_max_credits(struct super_block *sb)
+{
+	return HOLLYFS_SB(sb)->journal->j_max_transaction_buffers / 2;
+}
+
+// has to be called before a metadata buffer is changed, so the journal can hold on to the old contents
+// when the transaction that is committing right now still has to write them
+static int hollyfs_journal_get_write_access(struct buffer_head *bh)
+{
+	return jbd2_journal_get_write_access(journal_current_handle(), bh);
+}
+
+// the same for a buffer of a freshly allocated block whose old contents don't matter
+static int hollyfs_journal_get_create_access(struct buffer_head *bh)
+{
+	return jbd2_journal_get_create_access(journal_current_handle(), bh);
+}
+
+// takes the place of mark_buffer_dirty for metadata: the buffer is logged with the running transaction and
+// the checkpoint writes it to its own block only after the commit, so a crash can never leave half an operation
+static int hollyfs_journal_dirty(struct buffer_head *bh)
+{
+	return jbd2_journal_dirty_metadata(journal_current_handle(), bh);
+}
+
+// a metadata block that was just freed, drops it from the transaction and makes sure a replay never writes
+// its old contents over whatever the block is used for next, this eats the caller's reference to bh
+static int hollyfs_journal_revoke(unsigned int block, struct buffer_head *bh)
+{
+	return jbd2_journal_revoke(journal_current_handle(), block, bh);
+}
+
+// claims a run of up to want clear bits from a group's bitmap and stores its first bit in *bit_out and its length in *got
+// the run starts at the first clear bit in [start, end) that begins at least want clear bits in a row, or at the
+// longest run seen there when none is that long, runs are measured up to bit limit (the end of the group)
+// find_next_zero_bit_le and find_next_bit_le do the word-at-a-time scanning, and there is no lock around the bitmap:
+// the bits are set with an atomic test_and_set one after the other, so when another cpu took a bit of the run between
+// our search and our claim the run just ends there, and when it took the first one we lost the race and search again
+// *runs counts the free runs looked at, for the allocator statistics
+static int hollyfs_claim_free_run(struct hollyfs_group_info *grp, unsigned int start, unsigned int end, unsigned int limit, unsigned int want, unsigned int *bit_out, unsigned int *got, unsigned int *runs)
+{
+	struct buffer_head *bmap_bh = grp->bitmap_bh;
+	unsigned int bit, next, best, best_len, n, trim_start, trim_end;
+	int err;
+
+	for(;;)
+	{
+		best = best_len = 0;
+		for(bit = find_next_zero_bit_le(bmap_bh->b_data, end, start); bit < end; bit = find_next_zero_bit_le(bmap_bh->b_data, end, next))
+		{
+			next = find_next_bit_le(bmap_bh->b_data, limit, bit);
+			(*runs)++;
+			if(next - bit > best_len)
+			{
+				best = bit;
+				best_len = next - bit;
+			}
+			if(best_len >= want || next >= end)
+				break;
+		}
+		if(!best_len)
+			return -ENOSPC;
+
+		// the journal has to know about the bitmap block before the bits change
+		err = hollyfs_journal_get_write_access(bmap_bh);
+		if(err)
+			return err;
+		for(n = 0; n < min(want, best_len) && !test_and_set_bit_le(best + n, bmap_bh->b_data); n++)
+			;
+		// a discard may be running on a free run of this group, it publishes the run before it checks the bits one last
+		// time and the bits were set above before looking at the run, so either it sees our bits or we see its run,
+		// blocks that fall into the run are given back and the search goes on past it
+		smp_mb__after_atomic();
+		trim_start = READ_ONCE(grp->trim_start);
+		trim_end = READ_ONCE(grp->trim_end);
+		if(n && best < trim_end && best + n > trim_start)
+		{
+			while(n--)
+				clear_bit_le(best + n, bmap_bh->b_data);
+			if(trim_end >= end)
+				return -ENOSPC;
+			start = max(start, trim_end);
+			continue;
+		}
+		if(n)
+		{
+			hollyfs_journal_dirty(bmap_bh);
+			*bit_out = best;
+			*got = n;
+			return 0;
+		}
+	}
+}
+
+// allocates a run of up to want contiguous blocks, stores its first block number in *block_out and its length in *got
+// the search starts in the group that goal falls in, at goal itself, which is how a growing file asks for the
+// blocks right after its last one so that its extents stay contiguous, and how a new file asks for blocks in
+// the group of its inode, a goal outside of every group (0 for example) means no preference and starts in group 0
+// a free goal block is always taken, however short the run there is, since continuing the file in place is worth more
+// than a longer run somewhere else, otherwise a group is searched next-fit from the starting point to its end and then
+// from its beginning for a run of want blocks, and gives its longest run when it has none that long
+// after that the other groups follow in turn, each from its own cursor, and full groups are skipped on their
+// free count without reading a single bitmap word
+// nothing here takes a lock, so allocations on different cpus only meet when they go for the very same bits
+// *groups and *runs count the groups whose bitmap was searched and the free runs looked at in them
+static int hollyfs_search_blocks(struct super_block *sb, unsigned int goal, unsigned int want, unsigned int *block_out, unsigned int *got, unsigned int *groups, unsigned int *runs)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	unsigned int group_count = sbi->sb_ondisk->group_count;
+	struct hollyfs_group_info *grp;
+	hollyfs_group_desc *gd;
+	unsigned int first, g, n, start, count, bit;
+	bool at_goal;
+	int err;
+
+	// the cheap read of the counter can be off by a few blocks per cpu, only sum it up when it says there is nothing left
+	if(percpu_counter_read_positive(&sbi->free_blocks) == 0 && percpu_counter_sum_positive(&sbi->free_blocks) == 0)
+		return -ENOSPC;
+
+	at_goal = hollyfs_block_group(sbi, goal, &first, &start);
+	if(!at_goal)
+	{
+		first = 0;
+		start = READ_ONCE(sbi->groups[0].alloc_cursor);
+	}
+
+	for(n = 0; n < group_count; n++)
+	{
+		g = (first + n) % group_count;
+		grp = &sbi->groups[g];
+		if(atomic_read(&grp->free_blocks) <= 0)
+			continue;
+		gd = hollyfs_get_group_desc(sbi, g, NULL);
+		count = gd->block_count;
+		if(n > 0)
+			start = READ_ONCE(grp->alloc_cursor);
+		if(start >= count)
+			start = 0;
+		(*groups)++;
+
+		// the bitmap and inode table bits are always set, so only data blocks can come out of this
+		err = -ENOSPC;
+		if(n == 0 && at_goal)
+			err = hollyfs_claim_free_run(grp, start, start + 1, count, want, &bit, got, runs);
+		if(err == -ENOSPC)
+			err = hollyfs_claim_free_run(grp, start, count, count, want, &bit, got, runs);
+		if(err == -ENOSPC)
+			err = hollyfs_claim_free_run(grp, 0, start, count, want, &bit, got, runs);
+		if(err == -ENOSPC)
+			continue;
+		if(err)
+			return err;
+
+		// the next search in this group starts right after the blocks we just handed out
+		WRITE_ONCE(grp->alloc_cursor, (bit + *got < count) ? bit + *got : 0);
+		atomic_sub(*got, &grp->free_blocks);
+		percpu_counter_sub(&sbi->free_blocks, *got);
+		*block_out = gd->bitmap_block + bit;
+		return 0;
+	}
+	return -ENOSPC;
+}
+
+// hollyfs_search_blocks with the bookkeeping around it: the allocator counters in debugfs, its latency histogram and
+// the hollyfs_alloc_blocks tracepoint, which shows where every run came from and how much searching it took
+static int hollyfs_alloc_blocks(struct super_block *sb, unsigned int goal, unsigned int want, unsigned int *block_out, unsigned int *got)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	unsigned int groups = 0, runs = 0;
+	u64 start = ktime_get_ns(), ns;
+	int err;
+
+	err = hollyfs_search_blocks(sb, goal, want, block_out, got, &groups, &runs);
+	ns = hollyfs_stat_latency(sbi, HOLLYFS_LAT_ALLOC, start);
+	hollyfs_stat_add(sbi, alloc_calls, 1);
+	hollyfs_stat_add(sbi, alloc_groups, groups);
+	hollyfs_stat_add(sbi, alloc_runs, runs);
+	if(!err)
+		hollyfs_stat_add(sbi, alloc_blocks, *got);
+	trace_hollyfs_alloc_blocks(sb, goal, want, err ? 0 : *block_out, err ? 0 : *got, groups, runs, err, ns);
+	return err;
+}
+
+// allocates a single block, for metadata and for the odd page that reclaim writes out on its own
+static int hollyfs_alloc_block(struct super_block *sb, unsigned int goal, unsigned int *block_out)
+{
+	unsigned int got;
+
+	return hollyfs_alloc_blocks(sb, goal, 1, block_out, &got);
+}
+
+// delayed allocation: a buffered write only reserves its blocks and writeback picks them later, when it knows how many
+// blocks of the file are dirty and can allocate all of them as one run
+// the reserved blocks are counted in dirty_blocks, a reservation only succeeds while what is free minus what is
+// reserved covers it with HOLLYFS_DA_SLACK blocks to spare for the extent blocks the writeback itself may need
+static int hollyfs_reserve_blocks(struct super_block *sb, unsigned int count)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	s64 avail;
+
+	avail = percpu_counter_read_positive(&sbi->free_blocks) - percpu_counter_read_positive(&sbi->dirty_blocks);
+	// the cheap reads can each be off by a batch per cpu, sum the counters up when it is getting close
+	if(avail < (s64)count + HOLLYFS_DA_SLACK + 2 * percpu_counter_batch * num_online_cpus())
+		avail = percpu_counter_sum_positive(&sbi->free_blocks) - percpu_counter_sum_positive(&sbi->dirty_blocks);
+	if(avail < (s64)count + HOLLYFS_DA_SLACK)
+		return -ENOSPC;
+	percpu_counter_add(&sbi->dirty_blocks, count);
+	return 0;
+}
+
+// gives back count reserved blocks, because they got allocated or because their dirty data was thrown away
+static void hollyfs_release_blocks(struct super_block *sb, unsigned int count)
+{
+	percpu_counter_sub(&HOLLYFS_SB(sb)->dirty_blocks, count);
+}
+
+// notes that the running transaction frees blocks in a group, a discard of those blocks has to wait for its commit,
+// or a crash before the commit would bring back a file whose blocks the device already threw away
+// free_tid only ever moves forward, a handle of the transaction that is committing can still free blocks after
+// one of the next transaction did
+static void hollyfs_note_free(struct hollyfs_sb_info *sbi, struct hollyfs_group_info *grp)
+{
+	tid_t tid = journal_current_handle()->h_transaction->t_tid;
+	tid_t old = READ_ONCE(grp->free_tid), prev;
+
+	while(tid_gt(tid, old))
+	{
+		prev = cmpxchg(&grp->free_tid, old, tid);
+		if(prev == old)
+			break;
+		old = prev;
+	}
+	if(sbi->discard && !atomic_xchg(&grp->needs_discard, 1))
+		queue_delayed_work(system_unbound_wq, &sbi->discard_work, HOLLYFS_DISCARD_DELAY);
+}
+
+// finds the refcount table block with the count of bit of group g and the count's index in it, *bhp is reused when it
+// is that block already and read (the one before it released) otherwise, returns 1, or 0 when the group has no table
+// and so no shared blocks, or -EIO
+// the descriptor only points at a table once its zeroes are logged (hollyfs_refcount_table), nobody has to lock for this
+static int hollyfs_refcount_bh(struct super_block *sb, unsigned int g, unsigned int bit, struct buffer_head **bhp, unsigned int *idx)
+{
+	hollyfs_group_desc *gd = hollyfs_get_group_desc(HOLLYFS_SB(sb), g, NULL);
+	unsigned int table = smp_load_acquire(&gd->refcount_block), block;
+
+	if(!table)
+		return 0;
+	block = table + bit / HOLLYFS_REFCOUNTS_PER_BLOCK;
+	*idx = bit % HOLLYFS_REFCOUNTS_PER_BLOCK;
+	if(*bhp && (*bhp)->b_blocknr == block)
+		return 1;
+	brelse(*bhp);
+	*bhp = hollyfs_bread(sb, block);
+	return *bhp ? 1 : -EIO;
+}
+
+// checks if other files have block in their extent maps too, then it must not be written in place
+// a count that can't be read says shared, a needless copy is better than writing into somebody else's file
+static bool hollyfs_block_shared(struct super_block *sb, unsigned int block)
+{
+	struct buffer_head *bh = NULL;
+	unsigned int g, bit, idx;
+	bool shared;
+	int ret;
+
+	if(!hollyfs_block_group(HOLLYFS_SB(sb), block, &g, &bit))
+		return false;
+	ret = hollyfs_refcount_bh(sb, g, bit, &bh, &idx);
+	if(ret <= 0)
+		return ret < 0;
+	shared = READ_ONCE(((unsigned short *)bh->b_data)[idx]) != 0;
+	brelse(bh);
+	return shared;
+}
+
+// takes a reference off block bit of group g when other files share it, returns false when nobody does and the
+// block can go back to the bitmap, *bhp keeps the table block from one call to the next
+// a count that can't be read or logged keeps the block, leaking it is better than freeing what another file still has
+static bool hollyfs_unshare_block(struct super_block *sb, unsigned int g, unsigned int bit, struct buffer_head **bhp)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	unsigned short *count;
+	unsigned int idx;
+	bool shared;
+	int ret;
+
+	ret = hollyfs_refcount_bh(sb, g, bit, bhp, &idx);
+	if(ret < 0)
+		printk_ratelimited("hollyfs: could not read the refcount of block %u of group %u, keeping it\n", bit, g);
+	if(ret <= 0)
+		return ret < 0;
+	count = (unsigned short *)(*bhp)->b_data + idx;
+	// a count only goes up through a reflink of a file that has the block, and that is the caller's file, so a 0 stays 0
+	if(!READ_ONCE(*count))
+		return false;
+	if(hollyfs_journal_get_write_access(*bhp))
+		return true;
+	spin_lock(&sbi->refcount_lock);
+	shared = *count != 0;
+	if(shared)
+		(*count)--;
+	spin_unlock(&sbi->refcount_lock);
+	if(shared)
+		hollyfs_journal_dirty(*bhp);
+	return shared;
+}
+
+// gives count blocks starting at absolute block number block back to their group's bitmap
+// a block other files share as well only loses the caller's reference, it stays in use until the last one goes
+static void hollyfs_free_blocks(struct super_block *sb, unsigned int block, unsigned int count)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct hollyfs_group_info *grp;
+	struct buffer_head *ref_bh = NULL;
+	unsigned int g, bit, last_g = UINT_MAX;
+
+	trace_hollyfs_free_blocks(sb, block, count);
+	for(; count; block++, count--)
+	{
+		// refuse to touch anything that is not a data block of some group, that would be a corrupted extent
+		if(!hollyfs_block_group(sbi, block, &g, &bit) || block < hollyfs_get_group_desc(sbi, g, NULL)->data_block_base)
+		{
+			printk("hollyfs: trying to free blocks %u-%u outside of the data area\n", block, block + count - 1);
+			break;
+		}
+		if(hollyfs_unshare_block(sb, g, bit, &ref_bh))
+			continue;
+		grp = &sbi->groups[g];
+		// asking again for a buffer the handle already has is cheap, so this is done for every block
+		if(hollyfs_journal_get_write_access(grp->bitmap_bh))
+			break;
+		// before the bit is cleared, a discard that finds it clear then also finds our transaction
+		if(g != last_g)
+		{
+			hollyfs_note_free(sbi, grp);
+			last_g = g;
+		}
+		// atomic, other cpus may be claiming bits in the same word right now
+		if(!test_and_clear_bit_le(bit, grp->bitmap_bh->b_data))
+		{
+			printk("hollyfs: freeing block %u which is already free\n", block);
+			continue;
+		}
+		hollyfs_journal_dirty(grp->bitmap_bh);
+		atomic_inc(&grp->free_blocks);
+		percpu_counter_inc(&sbi->free_blocks);
+		hollyfs_stat_add(sbi, freed_blocks, 1);
+	}
+	brelse(ref_bh);
+}
+
+// gives group g its refcount table the first time one of its blocks gets shared, HOLLYFS_REFCOUNT_BLOCKS zeroed blocks
+// in a row, from the group's own data blocks when it has a run that long, the caller holds refcount_mutex
+static int hollyfs_refcount_table(struct super_block *sb, unsigned int g)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct buffer_head *gdt_bh, *bh;
+	hollyfs_group_desc *gd = hollyfs_get_group_desc(sbi, g, &gdt_bh);
+	unsigned int table, got, i, j;
+	int err = 0;
+
+	if(gd->refcount_block)
+		return 0;
+	err = hollyfs_alloc_blocks(sb, gd->data_block_base, HOLLYFS_REFCOUNT_BLOCKS, &table, &got);
+	if(err)
+		return err;
+	if(got < HOLLYFS_REFCOUNT_BLOCKS)
+	{
+		hollyfs_free_blocks(sb, table, got);
+		return -ENOSPC;
+	}
+	// brand new blocks, nothing on disk worth reading
+	for(i = 0; i < HOLLYFS_REFCOUNT_BLOCKS && !err; i++)
+	{
+		bh = sb_getblk(sb, table + i);
+		err = bh ? hollyfs_journal_get_create_access(bh) : -ENOMEM;
+		if(!err)
+		{
+			lock_buffer(bh);
+			memset(bh->b_data, 0, bh->b_size);
+			set_buffer_uptodate(bh);
+			unlock_buffer(bh);
+			hollyfs_journal_dirty(bh);
+		}
+		brelse(bh);
+	}
+	if(!err)
+		err = hollyfs_journal_get_write_access(gdt_bh);
+	if(err)
+	{
+		// the zeroes must not come back in a replay over whatever the blocks hold next
+		for(j = 0; j < i; j++)
+			hollyfs_journal_revoke(table + j, NULL);
+		hollyfs_free_blocks(sb, table, HOLLYFS_REFCOUNT_BLOCKS);
+		return err;
+	}
+	// only now can anybody find the table, see hollyfs_refcount_bh
+	smp_store_release(&gd->refcount_block, table);
+	hollyfs_journal_dirty(gdt_bh);
+	return 0;
+}
+
+// adds a reference to every block of the run [block, block + count), which a reflink puts into one more file, the
+// groups get their refcount tables on the way, *done is how many blocks got theirs before a count was full or
+// something failed, which is only an error when it is none
+// the caller holds the source file so none of the blocks can be freed meanwhile
+static int hollyfs_share_blocks(struct super_block *sb, unsigned int block, unsigned int count, unsigned int *done)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct buffer_head *bh = NULL;
+	unsigned short *counts;
+	unsigned int g, bit, idx;
+	bool full;
+	int err = 0;
+
+	for(*done = 0; *done < count; (*done)++, block++)
+	{
+		if(!hollyfs_block_group(sbi, block, &g, &bit))
+		{
+			err = -EIO;
+			break;
+		}
+		err = hollyfs_refcount_bh(sb, g, bit, &bh, &idx);
+		if(err == 0)
+		{
+			mutex_lock(&sbi->refcount_mutex);
+			err = hollyfs_refcount_table(sb, g);
+			mutex_unlock(&sbi->refcount_mutex);
+			if(!err)
+				err = hollyfs_refcount_bh(sb, g, bit, &bh, &idx);
+		}
+		if(err < 0)
+			break;
+		err = hollyfs_journal_get_write_access(bh);
+		if(err)
+			break;
+		counts = (unsigned short *)bh->b_data;
+		spin_lock(&sbi->refcount_lock);
+		full = counts[idx] == HOLLYFS_REFCOUNT_MAX;
+		if(!full)
+			counts[idx]++;
+		spin_unlock(&sbi->refcount_lock);
+		if(full)
+		{
+			err = -EMLINK;
+			break;
+		}
+		hollyfs_journal_dirty(bh);
+	}
+	brelse(bh);
+	hollyfs_stat_add(sbi, shared_blocks, *done);
+	return *done ? 0 : err;
+}
+
+// discards the free blocks of group g in bits [start, end) that come in runs of at least minlen and adds how many
+// it discarded to *trimmed, the caller holds trim_lock
+// every free run goes to the device as one discard, and while it is out the allocator keeps away from it (trim_start,
+// trim_end), so the bitmap is never touched for this and none of it goes through the journal
+static int hollyfs_trim_group(struct super_block *sb, unsigned int g, unsigned int start, unsigned int end, unsigned int minlen, u64 *trimmed)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct hollyfs_group_info *grp = &sbi->groups[g];
+	hollyfs_group_desc *gd = hollyfs_get_group_desc(sbi, g, NULL);
+	void *bmap = grp->bitmap_bh->b_data;
+	unsigned int bit, next;
+	int err = 0;
+
+	for(bit = find_next_zero_bit_le(bmap, end, start); bit < end; bit = find_next_zero_bit_le(bmap, end, next))
+	{
+		next = find_next_bit_le(bmap, end, bit);
+		if(next - bit < minlen)
+			continue;
+		WRITE_ONCE(grp->trim_start, bit);
+		WRITE_ONCE(grp->trim_end, next);
+		smp_mb();
+		// an allocation that claimed blocks before it could see the run ends the run there
+		next = find_next_bit_le(bmap, next, bit);
+		smp_rmb();
+		if(next - bit >= minlen)
+		{
+			// blocks freed by a transaction that has not committed yet are still the file's after a crash
+			if(tid_gt(READ_ONCE(grp->free_tid), READ_ONCE(sbi->journal->j_commit_sequence)))
+				err = jbd2_journal_force_commit(sbi->journal);
+			if(!err)
+				err = sb_issue_discard(sb, gd->bitmap_block + bit, next - bit, GFP_NOFS, 0);
+			if(!err)
+				*trimmed += next - bit;
+		}
+		smp_store_release(&grp->trim_end, 0);
+		if(err)
+			return err;
+		if(fatal_signal_pending(current))
+			return -ERESTARTSYS;
+		cond_resched();
+	}
+	return 0;
+}
+
+// discards the free runs of at least minlen blocks in blocks [start, end) of the partition, group by group
+static int hollyfs_trim_fs(struct super_block *sb, unsigned int start, unsigned int end, unsigned int minlen, u64 *trimmed)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	hollyfs_group_desc *gd;
+	unsigned int g, first, last;
+	int err = 0;
+
+	mutex_lock(&sbi->trim_lock);
+	for(g = 0; g < sbi->sb_ondisk->group_count && !err; g++)
+	{
+		gd = hollyfs_get_group_desc(sbi, g, NULL);
+		first = max(start, gd->bitmap_block);
+		last = min(end, gd->bitmap_block + gd->block_count);
+		// a full group has nothing to discard, and the free count says so without a look at the bitmap
+		if(first >= last || atomic_read(&sbi->groups[g].free_blocks) <= 0)
+			continue;
+		err = hollyfs_trim_group(sb, g, first - gd->bitmap_block, last - gd->bitmap_block, minlen, trimmed);
+	}
+	mutex_unlock(&sbi->trim_lock);
+	return err;
+}
+
+// the background discard of the discard mount option, goes over the groups that had blocks freed since its last run
+// by the time it runs the frees of a whole rm -rf are usually in, so they go out as a few big discards instead of one per
+// file, and nobody deleting anything waits for the device
+static void hollyfs_discard_work(struct work_struct *work)
+{
+	struct hollyfs_sb_info *sbi = container_of(to_delayed_work(work), struct hollyfs_sb_info, discard_work);
+	struct super_block *sb = sbi->sb;
+	unsigned int g, minlen;
+	u64 trimmed = 0;
+	int err = 0;
+
+	minlen = max_t(unsigned int, HOLLYFS_DISCARD_MIN_BLOCKS, DIV_ROUND_UP(bdev_discard_granularity(sb->s_bdev), sb->s_blocksize));
+	mutex_lock(&sbi->trim_lock);
+	for(g = 0; g < sbi->sb_ondisk->group_count && !err; g++)
+	{
+		if(!atomic_xchg(&sbi->groups[g].needs_discard, 0))
+			continue;
+		err = hollyfs_trim_group(sb, g, 0, hollyfs_get_group_desc(sbi, g, NULL)->block_count, minlen, &trimmed);
+	}
+	mutex_unlock(&sbi->trim_lock);
+	if(err)
+		printk("hollyfs: background discard failed, error %d\n", err);
+}
+
+// returns extent number idx of a file, the first HOLLYFS_INODE_EXTENTS are inside the inode and the rest
+// are inside the indirect extent block, whose data the caller passes in as ind
+static inline hollyfs_extent *hollyfs_extent_at(struct hollyfs_inode_info *hfs_inode, hollyfs_extent *ind, unsigned int idx)
+{
+	if(idx < HOLLYFS_INODE_EXTENTS)
+		return &hfs_inode->extents[idx];
+	return &ind[idx - HOLLYFS_INODE_EXTENTS];
+}
+
+// reads the indirect extent block of a file if it has one, *bhp is left NULL if it does not
+static int hollyfs_read_extent_block(struct super_block *sb, struct hollyfs_inode_info *hfs_inode, struct buffer_head **bhp)
+{
+	*bhp = NULL;
+	if(!hfs_inode->extent_block)
+		return 0;
+	*bhp = hollyfs_bread(sb, hfs_inode->extent_block);
+	return *bhp ? 0 : -EIO;
+}
+
+// binary search over the sorted extents for the last one that starts at or before file block iblock
+// returns extent_count when iblock comes before the first extent (or there are no extents at all)
+static unsigned int hollyfs_search_extent(struct hollyfs_inode_info *hfs_inode, hollyfs_extent *ind, unsigned int iblock)
+{
+	unsigned int lo = 0, hi = hfs_inode->extent_count, mid;
+
+	// find the first extent that starts after iblock, the one before it is the answer
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if(hollyfs_extent_at(hfs_inode, ind, mid)->logical_block <= iblock)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? lo - 1 : hfs_inode->extent_count;
+}
+
+// the number of blocks in an extent, without the unwritten bit
+static inline unsigned int hollyfs_ext_len(hollyfs_extent *e)
+{
+	return e->length & ~HOLLYFS_EXTENT_UNWRITTEN;
+}
+
+// checks if an extent's blocks are allocated but were never written
+static inline bool hollyfs_ext_unwritten(hollyfs_extent *e)
+{
+	return e->length & HOLLYFS_EXTENT_UNWRITTEN;
+}
+
+// works out i_blocks (in 512 byte units) from the extent map, since it is not stored on disk
+static void hollyfs_count_blocks(struct inode *inode)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	struct buffer_head *bh;
+	hollyfs_extent *ind;
+	blkcnt_t blocks = 0;
+	unsigned int i;
+
+	if(hollyfs_read_extent_block(inode->i_sb, hfs_inode, &bh))
+		bh = NULL;
+	ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+	for(i = 0; i < hfs_inode->extent_count; i++)
+	{
+		// without the indirect block only the extents in the inode can be counted
+		if(i >= HOLLYFS_INODE_EXTENTS && !ind)
+			break;
+		blocks += hollyfs_ext_len(hollyfs_extent_at(hfs_inode, ind, i));
+	}
+	if(hfs_inode->extent_block)
+		blocks++;
+	brelse(bh);
+	inode->i_blocks = blocks << (inode->i_blkbits - 9);
+}
+
+// maps file block iblock of inode to a block on the partition
+// on return *phys is the block number and *len is how many blocks from iblock on are contiguous on disk,
+// or *phys is 0 when iblock is in a hole and *len is how many blocks until the next extent (0 if there is none)
+// blocks of an unwritten extent are reported with *unwritten set, or as a hole as long as the extent when the
+// caller passes NULL for it, reading them has to give zeroes either way
+static int hollyfs_lookup_extent(struct inode *inode, unsigned int iblock, unsigned int *phys, unsigned int *len, bool *unwritten)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	struct buffer_head *bh;
+	hollyfs_extent *ind, *e;
+	unsigned int idx;
+	int err;
+
+	down_read(&hfs_inode->extent_sem);
+	err = hollyfs_read_extent_block(inode->i_sb, hfs_inode, &bh);
+	if(err)
+	{
+		up_read(&hfs_inode->extent_sem);
+		return err;
+	}
+	ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+
+	*phys = 0;
+	*len = 0;
+	if(unwritten)
+		*unwritten = false;
+	idx = hollyfs_search_extent(hfs_inode, ind, iblock);
+	e = (idx < hfs_inode->extent_count) ? hollyfs_extent_at(hfs_inode, ind, idx) : NULL;
+	if(e && iblock - e->logical_block < hollyfs_ext_len(e))
+	{
+		// iblock is inside this extent
+		*len = e->logical_block + hollyfs_ext_len(e) - iblock;
+		if(!hollyfs_ext_unwritten(e) || unwritten)
+			*phys = e->start_block + (iblock - e->logical_block);
+		if(unwritten)
+			*unwritten = hollyfs_ext_unwritten(e);
+	}
+	else
+	{
+		// iblock is in a hole, the next extent (if any) tells how long the hole is
+		idx = (idx == hfs_inode->extent_count) ? 0 : idx + 1;
+		if(idx < hfs_inode->extent_count)
+			*len = hollyfs_extent_at(hfs_inode, ind, idx)->logical_block - iblock;
+	}
+	brelse(bh);
+	up_read(&hfs_inode->extent_sem);
+	return 0;
+}
+
+// inserts the extent (logical, start, length) at index pos of a file's extent map, everything from pos on moves up by one
+// the first extent that no longer fits into the inode gets the indirect extent block allocated, *bhp and *indp are the
+// caller's buffer and data of that block and get set when it is new, the caller holds extent_sem for writing
+static int hollyfs_insert_extent(struct inode *inode, struct buffer_head **bhp, hollyfs_extent **indp, unsigned int pos, unsigned int logical, unsigned int start, unsigned int length)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	struct buffer_head *bh;
+	hollyfs_extent *e;
+	unsigned int i;
+	int err;
+
+	if(hfs_inode->extent_count >= HOLLYFS_MAX_EXTENTS)
+		return -EFBIG;
+	if(hfs_inode->extent_count >= HOLLYFS_INODE_EXTENTS && !*bhp)
+	{
+		// the inode is full, this is the first extent that has to go into the indirect extent block
+		err = hollyfs_alloc_block(sb, start, &hfs_inode->extent_block);
+		if(err)
+			return err;
+		bh = sb_getblk(sb, hfs_inode->extent_block);
+		if(!bh)
+		{
+			hollyfs_free_blocks(sb, hfs_inode->extent_block, 1);
+			hfs_inode->extent_block = 0;
+			return -ENOMEM;
+		}
+		// brand new block, there is nothing on disk worth reading so just zero it
+		err = hollyfs_journal_get_create_access(bh);
+		if(err)
+		{
+			brelse(bh);
+			hollyfs_free_blocks(sb, hfs_inode->extent_block, 1);
+			hfs_inode->extent_block = 0;
+			return err;
+		}
+		lock_buffer(bh);
+		memset(bh->b_data, 0, bh->b_size);
+		set_buffer_uptodate(bh);
+		unlock_buffer(bh);
+		*bhp = bh;
+		*indp = (hollyfs_extent *)bh->b_data;
+		inode->i_blocks += sb->s_blocksize >> 9;
+	}
+	// shift everything from pos on up by one to keep the extents sorted
+	for(i = hfs_inode->extent_count; i > pos; i--)
+		*hollyfs_extent_at(hfs_inode, *indp, i) = *hollyfs_extent_at(hfs_inode, *indp, i - 1);
+	e = hollyfs_extent_at(hfs_inode, *indp, pos);
+	e->logical_block = logical;
+	e->start_block = start;
+	e->length = length;
+	hfs_inode->extent_count++;
+	return 0;
+}
+
+// drops extent idx from the map, everything after it moves down by one
+static void hollyfs_remove_extent(struct hollyfs_inode_info *hfs_inode, hollyfs_extent *ind, unsigned int idx)
+{
+	unsigned int i;
+
+	for(i = idx; i + 1 < hfs_inode->extent_count; i++)
+		*hollyfs_extent_at(hfs_inode, ind, i) = *hollyfs_extent_at(hfs_inode, ind, i + 1);
+	hfs_inode->extent_count--;
+}
+
+// merges extent idx into the one in front of it when it continues that one both in the file and on disk and both
+// are written or both unwritten, returns whether it did
+static bool hollyfs_merge_extent(struct hollyfs_inode_info *hfs_inode, hollyfs_extent *ind, unsigned int idx)
+{
+	hollyfs_extent *prev, *e;
+
+	if(idx == 0 || idx >= hfs_inode->extent_count)
+		return false;
+	prev = hollyfs_extent_at(hfs_inode, ind, idx - 1);
+	e = hollyfs_extent_at(hfs_inode, ind, idx);
+	if(prev->logical_block + hollyfs_ext_len(prev) != e->logical_block || prev->start_block + hollyfs_ext_len(prev) != e->start_block ||
+	   hollyfs_ext_unwritten(prev) != hollyfs_ext_unwritten(e) || hollyfs_ext_len(prev) + hollyfs_ext_len(e) >= HOLLYFS_EXTENT_UNWRITTEN)
+		return false;
+	prev->length += hollyfs_ext_len(e);
+	hollyfs_remove_extent(hfs_inode, ind, idx);
+	return true;
+}
+
+// splits extent idx in two at file block at, which has to be inside it past its first block, both halves keep their
+// blocks and the unwritten bit, the caller holds extent_sem for writing and has the extent block under write access
+static int hollyfs_split_extent(struct inode *inode, struct buffer_head **bhp, hollyfs_extent **indp, unsigned int idx, unsigned int at)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	hollyfs_extent *e = hollyfs_extent_at(hfs_inode, *indp, idx);
+	unsigned int front = at - e->logical_block, flag = e->length & HOLLYFS_EXTENT_UNWRITTEN;
+	int err;
+
+	err = hollyfs_insert_extent(inode, bhp, indp, idx + 1, at, e->start_block + front, (hollyfs_ext_len(e) - front) | flag);
+	if(err)
+		return err;
+	// the insert may have allocated the extent block just now, extent idx is still where it was though
+	hollyfs_extent_at(hfs_inode, *indp, idx)->length = front | flag;
+	return 0;
+}
+
+// turns blocks [off, off + n) of unwritten extent idx into written ones, which leaves up to three extents behind:
+// the unwritten front, the written middle and the unwritten back, a written part that continues the extent before
+// or after it on disk joins that one instead, so a preallocated file written front to back keeps a single written extent
+// the caller holds extent_sem for writing and has the extent block (if any) under journal write access
+static int hollyfs_convert_extent(struct inode *inode, struct buffer_head **bhp, hollyfs_extent **indp, unsigned int idx, unsigned int off, unsigned int n)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	hollyfs_extent *e = hollyfs_extent_at(hfs_inode, *indp, idx), *prev, *next;
+	unsigned int logical = e->logical_block, start = e->start_block, len = hollyfs_ext_len(e);
+	int err;
+
+	if(off == 0 && n == len)
+	{
+		// the whole extent got written
+		e->length = len;
+		hollyfs_merge_extent(hfs_inode, *indp, idx + 1);
+		hollyfs_merge_extent(hfs_inode, *indp, idx);
+		return 0;
+	}
+	if(off == 0)
+	{
+		// the front got written, the most common case by far for a file filled front to back
+		prev = idx ? hollyfs_extent_at(hfs_inode, *indp, idx - 1) : NULL;
+		e->logical_block += n;
+		e->start_block += n;
+		e->length = (len - n) | HOLLYFS_EXTENT_UNWRITTEN;
+		if(prev && !hollyfs_ext_unwritten(prev) && prev->logical_block + hollyfs_ext_len(prev) == logical && prev->start_block + hollyfs_ext_len(prev) == start)
+		{
+			prev->length += n;
+			return 0;
+		}
+		err = hollyfs_insert_extent(inode, bhp, indp, idx, logical, start, n);
+		if(err)
+		{
+			e->logical_block = logical;
+			e->start_block = start;
+			e->length = len | HOLLYFS_EXTENT_UNWRITTEN;
+		}
+		return err;
+	}
+	if(off + n == len)
+	{
+		// the back got written
+		next = (idx + 1 < hfs_inode->extent_count) ? hollyfs_extent_at(hfs_inode, *indp, idx + 1) : NULL;
+		e->length = off | HOLLYFS_EXTENT_UNWRITTEN;
+		if(next && !hollyfs_ext_unwritten(next) && next->logical_block == logical + len && next->start_block == start + len)
+		{
+			next->logical_block -= n;
+			next->start_block -= n;
+			next->length += n;
+			return 0;
+		}
+		err = hollyfs_insert_extent(inode, bhp, indp, idx + 1, logical + off, start + off, n);
+		if(err)
+			e->length = len | HOLLYFS_EXTENT_UNWRITTEN;
+		return err;
+	}
+
+	// somewhere in the middle, the extent becomes three
+	if(hfs_inode->extent_count + 2 > HOLLYFS_MAX_EXTENTS)
+		return -EFBIG;
+	e->length = off | HOLLYFS_EXTENT_UNWRITTEN;
+	err = hollyfs_insert_extent(inode, bhp, indp, idx + 1, logical + off, start + off, n);
+	if(!err)
+	{
+		err = hollyfs_insert_extent(inode, bhp, indp, idx + 2, logical + off + n, start + off + n, (len - off - n) | HOLLYFS_EXTENT_UNWRITTEN);
+		if(err)
+			hollyfs_remove_extent(hfs_inode, *indp, idx + 1);
+	}
+	if(err)
+		hollyfs_extent_at(hfs_inode, *indp, idx)->length = len | HOLLYFS_EXTENT_UNWRITTEN;
+	return err;
+}
+
+// makes sure file blocks from iblock on are backed by blocks on disk, up to want of them, and stores the first
+// block in *phys and how many blocks from there on are done in *got
+// blocks that are already mapped are just reported (and unwritten ones become written unless unwritten is asked for),
+// a hole gets a newly allocated run of up to want blocks, written or unwritten as asked, which ends at the next extent
+// the blocks right after the previous extent are asked for first, so a file written front to back keeps growing one
+// extent instead of getting a new extent per run
+static int hollyfs_alloc_extent_run(struct inode *inode, unsigned int iblock, unsigned int want, bool unwritten, unsigned int *phys, unsigned int *got)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	struct buffer_head *bh;
+	hollyfs_extent *ind, *prev = NULL, *next = NULL, *e;
+	unsigned int idx, pos, g, goal, block, flag;
+	u64 hole;
+	int err;
+
+	// readers of the map must not see extents half shifted, and two writers must not grow the same hole
+	down_write(&hfs_inode->extent_sem);
+	err = hollyfs_read_extent_block(sb, hfs_inode, &bh);
+	if(err)
+		goto out;
+	// the indirect extent block may change below, the journal has to see it first
+	if(bh)
+	{
+		err = hollyfs_journal_get_write_access(bh);
+		if(err)
+			goto out;
+	}
+	ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+
+	idx = hollyfs_search_extent(hfs_inode, ind, iblock);
+	e = (idx < hfs_inode->extent_count) ? hollyfs_extent_at(hfs_inode, ind, idx) : NULL;
+	if(e && iblock - e->logical_block < hollyfs_ext_len(e))
+	{
+		// already mapped, somebody else filled this part of the hole first or the blocks were preallocated
+		*phys = e->start_block + (iblock - e->logical_block);
+		*got = min(want, e->logical_block + hollyfs_ext_len(e) - iblock);
+		if(!unwritten && hollyfs_ext_unwritten(e))
+		{
+			err = hollyfs_convert_extent(inode, &bh, &ind, idx, iblock - e->logical_block, *got);
+			if(!err)
+				goto out_dirty;
+		}
+		goto out;
+	}
+
+	// pos is where a new extent for iblock would go, prev and next are its neighbours
+	pos = (idx == hfs_inode->extent_count) ? 0 : idx + 1;
+	if(pos > 0)
+	{
+		prev = hollyfs_extent_at(hfs_inode, ind, pos - 1);
+		goal = prev->start_block + hollyfs_ext_len(prev) + (iblock - (prev->logical_block + hollyfs_ext_len(prev)));
+	}
+	else
+	{
+		// nothing in front of this block, keep the file near its inode and start where that group's last allocation stopped
+		g = inode->i_ino / HOLLYFS_SB(sb)->sb_ondisk->inodes_per_group;
+		goal = hollyfs_get_group_desc(HOLLYFS_SB(sb), g, NULL)->bitmap_block + READ_ONCE(HOLLYFS_SB(sb)->groups[g].alloc_cursor);
+	}
+	// the run must not run into the next extent
+	hole = (u64)U32_MAX + 1 - iblock;
+	if(pos < hfs_inode->extent_count)
+	{
+		next = hollyfs_extent_at(hfs_inode, ind, pos);
+		hole = next->logical_block - iblock;
+	}
+	want = min_t(u64, min(want, HOLLYFS_EXTENT_UNWRITTEN - 1), hole);
+
+	err = hollyfs_alloc_blocks(sb, goal, want, &block, got);
+	if(err)
+		goto out;
+	flag = unwritten ? HOLLYFS_EXTENT_UNWRITTEN : 0;
+
+	// the new run directly follows prev both in the file and on disk, just make prev longer,
+	// and when it closes the hole in front of next too, next joins prev as well
+	if(prev && prev->logical_block + hollyfs_ext_len(prev) == iblock && prev->start_block + hollyfs_ext_len(prev) == block &&
+	   hollyfs_ext_unwritten(prev) == unwritten && hollyfs_ext_len(prev) + *got < HOLLYFS_EXTENT_UNWRITTEN)
+	{
+		prev->length += *got;
+		hollyfs_merge_extent(hfs_inode, ind, pos);
+		goto out_grew;
+	}
+	// the new run sits directly before next both in the file and on disk, grow next downwards
+	if(next && next->logical_block == iblock + *got && next->start_block == block + *got &&
+	   hollyfs_ext_unwritten(next) == unwritten && hollyfs_ext_len(next) + *got < HOLLYFS_EXTENT_UNWRITTEN)
+	{
+		next->logical_block -= *got;
+		next->start_block -= *got;
+		next->length += *got;
+		goto out_grew;
+	}
+
+	// otherwise the run needs an extent of its own at pos
+	err = hollyfs_insert_extent(inode, &bh, &ind, pos, iblock, block, *got | flag);
+	if(err)
+	{
+		hollyfs_free_blocks(sb, block, *got);
+		goto out;
+	}
+
+out_grew:
+	inode->i_blocks += (blkcnt_t)*got << (sb->s_blocksize_bits - 9);
+	*phys = block;
+out_dirty:
+	if(bh)
+		hollyfs_journal_dirty(bh);
+	brelse(bh);
+	up_write(&hfs_inode->extent_sem);
+	// logging the inode reads the extent map, so that has to wait until the lock is dropped
+	mark_inode_dirty(inode);
+	return 0;
+out:
+	brelse(bh);
+	up_write(&hfs_inode->extent_sem);
+	return err;
+}
+
+// fills the hole at file block iblock with a single newly allocated block, for directories
+static int hollyfs_alloc_extent_block(struct inode *inode, unsigned int iblock, unsigned int *phys)
+{
+	unsigned int got;
+
+	return hollyfs_alloc_extent_run(inode, iblock, 1, false, phys, &got);
+}
+
+// gives back the indirect extent block once every extent fits into the inode again and logs it otherwise,
+// this eats the reference to bh (which may be NULL), the caller holds extent_sem for writing
+static void hollyfs_put_extent_block(struct inode *inode, struct buffer_head *bh)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+
+	if(bh && hfs_inode->extent_count <= HOLLYFS_INODE_EXTENTS)
+	{
+		// revoking it drops the buffer without writing it and keeps replay from bringing it back
+		hollyfs_free_blocks(sb, hfs_inode->extent_block, 1);
+		inode->i_blocks -= sb->s_blocksize >> 9;
+		hollyfs_journal_revoke(hfs_inode->extent_block, bh);
+		hfs_inode->extent_block = 0;
+		return;
+	}
+	if(bh)
+		hollyfs_journal_dirty(bh);
+	brelse(bh);
+}
+
+// drops file blocks [first, end) from the extent map and gives their blocks back (blocks shared with other files only
+// lose this file's reference), an extent that reaches out of the range is split and keeps its part outside of it
+// a reflink makes room with this for the blocks it puts into the target, the caller holds extent_sem for writing
+// and has the extent block under write access
+static int hollyfs_punch_extents(struct inode *inode, struct buffer_head **bhp, hollyfs_extent **indp, unsigned int first, unsigned int end)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	hollyfs_extent *e;
+	unsigned int idx, len;
+	int err;
+
+	for(;;)
+	{
+		// the first extent that ends past first, nothing to do when there is none or it starts at end or later
+		idx = hollyfs_search_extent(hfs_inode, *indp, first);
+		if(idx == hfs_inode->extent_count)
+			idx = 0;
+		else if((u64)hollyfs_extent_at(hfs_inode, *indp, idx)->logical_block + hollyfs_ext_len(hollyfs_extent_at(hfs_inode, *indp, idx)) <= first)
+			idx++;
+		if(idx >= hfs_inode->extent_count || hollyfs_extent_at(hfs_inode, *indp, idx)->logical_block >= end)
+			return 0;
+		if(hollyfs_extent_at(hfs_inode, *indp, idx)->logical_block < first)
+		{
+			err = hollyfs_split_extent(inode, bhp, indp, idx, first);
+			if(err)
+				return err;
+			idx++;
+		}
+		e = hollyfs_extent_at(hfs_inode, *indp, idx);
+		if((u64)e->logical_block + hollyfs_ext_len(e) > end)
+		{
+			err = hollyfs_split_extent(inode, bhp, indp, idx, end);
+			if(err)
+				return err;
+			e = hollyfs_extent_at(hfs_inode, *indp, idx);
+		}
+		len = hollyfs_ext_len(e);
+		hollyfs_free_blocks(sb, e->start_block, len);
+		inode->i_blocks -= (blkcnt_t)len << (sb->s_blocksize_bits - 9);
+		hollyfs_remove_extent(hfs_inode, *indp, idx);
+	}
+}
+
+// copy on write: gives file blocks from iblock on new blocks in place of the ones they share with other files, up to
+// want of them but not past the extent iblock is in, and stores the first new block in *phys and how many in *got
+// the new run gets an extent of its own cut out of the old one and the old blocks lose this file's reference, the
+// pages then go to the new blocks, *got is 0 when iblock is not in a written extent and there is nothing to copy
+// the caller's handle has HOLLYFS_WRITE_CREDITS at least
+static int hollyfs_cow_extent_run(struct inode *inode, unsigned int iblock, unsigned int want, unsigned int *phys, unsigned int *got)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	struct buffer_head *bh;
+	hollyfs_extent *ind, *e;
+	unsigned int idx, block, old;
+	int err;
+
+	*got = 0;
+	down_write(&hfs_inode->extent_sem);
+	err = hollyfs_read_extent_block(sb, hfs_inode, &bh);
+	if(err)
+		goto out;
+	if(bh)
+	{
+		err = hollyfs_journal_get_write_access(bh);
+		if(err)
+			goto out;
+	}
+	ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+
+	idx = hollyfs_search_extent(hfs_inode, ind, iblock);
+	e = (idx < hfs_inode->extent_count) ? hollyfs_extent_at(hfs_inode, ind, idx) : NULL;
+	if(!e || iblock - e->logical_block >= hollyfs_ext_len(e) || hollyfs_ext_unwritten(e))
+		goto out;
+	// cutting the run out of the middle of the extent takes two more
+	if(hfs_inode->extent_count + 2 > HOLLYFS_MAX_EXTENTS)
+	{
+		err = -EFBIG;
+		goto out;
+	}
+	want = min(want, e->logical_block + hollyfs_ext_len(e) - iblock);
+	// near the old blocks, a file copied block by block stays in the same place
+	err = hollyfs_alloc_blocks(sb, e->start_block + (iblock - e->logical_block), want, &block, got);
+	if(err)
+		goto out;
+
+	if(iblock > e->logical_block)
+	{
+		err = hollyfs_split_extent(inode, &bh, &ind, idx, iblock);
+		if(err)
+			goto out_free;
+		idx++;
+	}
+	if(hollyfs_ext_len(hollyfs_extent_at(hfs_inode, ind, idx)) > *got)
+	{
+		err = hollyfs_split_extent(inode, &bh, &ind, idx, iblock + *got);
+		if(err)
+		{
+			// the front that was split off joins again
+			hollyfs_merge_extent(hfs_inode, ind, idx);
+			goto out_free;
+		}
+	}
+	e = hollyfs_extent_at(hfs_inode, ind, idx);
+	old = e->start_block;
+	e->start_block = block;
+	hollyfs_free_blocks(sb, old, *got);
+	hollyfs_merge_extent(hfs_inode, ind, idx + 1);
+	hollyfs_merge_extent(hfs_inode, ind, idx);
+	hollyfs_stat_add(HOLLYFS_SB(sb), cow_blocks, *got);
+	*phys = block;
+	goto out_dirty;
+
+out_free:
+	hollyfs_free_blocks(sb, block, *got);
+	*got = 0;
+out_dirty:
+	// a split may have left the extent block changed (or new) even when the copy failed
+	if(bh)
+		hollyfs_journal_dirty(bh);
+	brelse(bh);
+	up_write(&hfs_inode->extent_sem);
+	mark_inode_dirty(inode);
+	return err;
+out:
+	brelse(bh);
+	up_write(&hfs_inode->extent_sem);
+	return err;
+}
+
+// the journal credits giving back the run of len blocks at block takes: the bitmap block of every group the run is in,
+// and for a file that shares blocks the refcount table blocks their counts are in, a group without a table has none
+static int hollyfs_free_credits(struct super_block *sb, unsigned int block, unsigned int len, bool shared)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	hollyfs_group_desc *gd;
+	unsigned int g, bit, n;
+	int credits = 0;
+
+	while(len && hollyfs_block_group(sbi, block, &g, &bit))
+	{
+		gd = hollyfs_get_group_desc(sbi, g, NULL);
+		n = min(len, gd->block_count - bit);
+		credits++;
+		if(shared && smp_load_acquire(&gd->refcount_block))
+			credits += (bit + n - 1) / HOLLYFS_REFCOUNTS_PER_BLOCK - bit / HOLLYFS_REFCOUNTS_PER_BLOCK + 1;
+		block += n;
+		len -= n;
+	}
+	return credits;
+}
+
+// how many blocks from the end of the run of len blocks at block can be given back with credits journal credits,
+// the credits a tail of the run takes only grow with it
+static unsigned int hollyfs_free_fits(struct super_block *sb, unsigned int block, unsigned int len, bool shared, int credits)
+{
+	unsigned int lo = 0, hi = len, mid;
+
+	if(hollyfs_free_credits(sb, block, len, shared) <= credits)
+		return len;
+	while(lo < hi)
+	{
+		mid = hi - (hi - lo) / 2;
+		if(hollyfs_free_credits(sb, block + len - mid, mid, shared) <= credits)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+// frees blocks of inode from file block first_block on and drops those extents from the map, from the last one on
+// and as far as the credits left in the caller's handle go, returns 1 when some are left for another transaction
+// (hollyfs_truncate_blocks goes on with them)
+static int hollyfs_truncate_extents(struct inode *inode, unsigned int first_block)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	bool shared = hfs_inode->flags & HOLLYFS_INODE_SHARED;
+	struct buffer_head *bh;
+	hollyfs_extent *ind, *e;
+	unsigned int keep, len, n;
+	int credits, err;
+
+	down_write(&hfs_inode->extent_sem);
+	err = hollyfs_read_extent_block(sb, hfs_inode, &bh);
+	if(err)
+		goto out;
+	if(bh)
+	{
+		err = hollyfs_journal_get_write_access(bh);
+		if(err)
+		{
+			brelse(bh);
+			goto out;
+		}
+	}
+	ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+	// the extent block, its bitmap block and the inode are always in
+	credits = jbd2_handle_buffer_credits(journal_current_handle()) - 3;
+
+	// walk back from the last extent since the extents are sorted by file block
+	while(hfs_inode->extent_count)
+	{
+		e = hollyfs_extent_at(hfs_inode, ind, hfs_inode->extent_count - 1);
+		len = hollyfs_ext_len(e);
+		if(e->logical_block + len <= first_block)
+			break;
+		// the new end may fall inside this extent, its front part stays (written or not, as it was)
+		keep = e->logical_block >= first_block ? 0 : first_block - e->logical_block;
+		n = hollyfs_free_fits(sb, e->start_block + keep, len - keep, shared, credits);
+		credits -= hollyfs_free_credits(sb, e->start_block + len - n, n, shared);
+		hollyfs_free_blocks(sb, e->start_block + len - n, n);
+		inode->i_blocks -= (blkcnt_t)n << (sb->s_blocksize_bits - 9);
+		if(n == len)
+		{
+			hfs_inode->extent_count--;
+			continue;
+		}
+		e->length = (len - n) | (e->length & HOLLYFS_EXTENT_UNWRITTEN);
+		// the handle ran out of credits before the new end
+		if(len - n > keep)
+			err = 1;
+		break;
+	}
+
+	// everything may fit in the inode again, then the indirect block is not needed anymore
+	hollyfs_put_extent_block(inode, bh);
+out:
+	up_write(&hfs_inode->extent_sem);
+	if(err >= 0)
+		mark_inode_dirty(inode);
+	return err;
+}
+
+// journal credits for dropping the blocks of inode between file blocks first and last: what giving back each run takes
+// (see hollyfs_free_credits), and the extent block, its bitmap block and the inode on top
+static int hollyfs_range_credits(struct inode *inode, unsigned int first, unsigned int last)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	bool shared = hfs_inode->flags & HOLLYFS_INODE_SHARED;
+	struct buffer_head *bh;
+	hollyfs_extent *ind, *e;
+	unsigned int i, from, to;
+	int credits = 3;
+
+	down_read(&hfs_inode->extent_sem);
+	if(!hollyfs_read_extent_block(inode->i_sb, hfs_inode, &bh))
+	{
+		ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+		for(i = 0; i < hfs_inode->extent_count && (ind || i < HOLLYFS_INODE_EXTENTS); i++)
+		{
+			e = hollyfs_extent_at(hfs_inode, ind, i);
+			from = max(first, e->logical_block);
+			to = min_t(u64, last, (u64)e->logical_block + hollyfs_ext_len(e));
+			if(from < to)
+				credits += hollyfs_free_credits(inode->i_sb, e->start_block + (from - e->logical_block), to - from, shared);
+		}
+		brelse(bh);
+	}
+	up_read(&hfs_inode->extent_sem);
+	return credits;
+}
+
+// the credits a truncate to file block first_block starts its handle with, never more than one handle may have,
+// hollyfs_truncate_blocks goes on in new transactions with what did not fit
+static int hollyfs_truncate_credits(struct inode *inode, unsigned int first_block)
+{
+	return min(hollyfs_range_credits(inode, first_block, U32_MAX), hollyfs_max_credits(inode->i_sb));
+}
+
+// frees every block of inode from file block first_block on, restarting the caller's handle as often as that takes
+// used by truncate, by a failed direct write to get rid of the blocks it allocated past the end of the file, and by the last
+// writer closing a file to give back the blocks writeback preallocated past its end
+// the extents go from the last one on, so a crash in between only leaves blocks past the new end of the file, like
+// preallocated ones, and never a hole in the middle of it
+static int hollyfs_truncate_blocks(struct inode *inode, unsigned int first_block)
+{
+	handle_t *handle = journal_current_handle();
+	int err;
+
+	while((err = hollyfs_truncate_extents(inode, first_block)) > 0)
+	{
+		err = jbd2__journal_restart(handle, hollyfs_truncate_credits(inode, first_block), 1, GFP_NOFS);
+		if(err)
+			break;
+	}
+	return err;
+}
+
+// the get_block callback that the generic page cache helpers (mpage, block_write_full_page) use
+// to find out where a file block lives, it never allocates: it is called with the page locked, and a handle started
+// under a page lock waits for a commit that may be waiting for a writer who waits for that very page
+// a whole contiguous extent is reported at once through b_size so mpage can build one big bio for it
+// unwritten blocks look like a hole, blocks get allocated by hollyfs_da_alloc_range, which starts its handle before
+// it locks any page, and writeback only sends pages that hollyfs_page_ready let through, so create finds a block too
+static int hollyfs_get_block(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create)
+{
+	unsigned int phys, len, max_blocks;
+	int err;
+
+	// file blocks are 32 bit in the extents, anything past that is beyond s_maxbytes anyway
+	if(iblock > U32_MAX)
+		return -EFBIG;
+
+	err = hollyfs_lookup_extent(inode, iblock, &phys, &len, NULL);
+	if(err)
+		return err;
+	if(phys)
+	{
+		// report as much of the extent as the caller asked for
+		max_blocks = bh_result->b_size >> inode->i_blkbits;
+		map_bh(bh_result, inode->i_sb, phys);
+		bh_result->b_size = (size_t)min(len, max_blocks ? max_blocks : 1) << inode->i_blkbits;
+		return 0;
+	}
+	// a hole, reads just see zeroes, a write that gets here went around hollyfs_page_ready
+	if(WARN_ON_ONCE(create))
+		return -EIO;
+	return 0;
+}
+
+// the get_block of buffered writes, which delay the allocation: a hole only gets a block reserved and the buffer
+// is marked delayed, writeback allocates the blocks of all the delayed buffers of a file in long runs later
+// a block of an unwritten extent needs no reservation, its buffer is marked unwritten and writeback turns the
+// extent into a written one, so appends into the blocks preallocated past the end of a file don't touch metadata either
+// those buffers stay unmapped, so a page that writeback gets to before the delayed allocation pass is redirtied
+// (hollyfs_page_ready), b_bdev and b_blocknr are only set for clean_bdev_bh_alias, which finds nothing there
+// a written block that other files share is copied on write: the buffer is filled from it, since it won't be mapped to
+// it anymore, and becomes a delayed one with a block reserved, which writeback gives a block of its own
+static int hollyfs_get_block_delay(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create)
+{
+	struct super_block *sb = inode->i_sb;
+	unsigned int phys, len;
+	bool unwritten;
+	int err;
+
+	// an earlier write into this page already took care of the block
+	if(buffer_delay(bh_result) || buffer_unwritten(bh_result))
+		return 0;
+	if(iblock > U32_MAX)
+		return -EFBIG;
+
+	err = hollyfs_lookup_extent(inode, iblock, &phys, &len, &unwritten);
+	if(err)
+		return err;
+	if(phys && !unwritten && (!(HOLLYFS_I(inode)->flags & HOLLYFS_INODE_SHARED) || !hollyfs_block_shared(sb, phys)))
+	{
+		map_bh(bh_result, sb, phys);
+		return 0;
+	}
+	if(phys && !unwritten)
+	{
+		err = hollyfs_reserve_blocks(sb, 1);
+		if(err)
+			return err;
+		// the parts the write does not cover keep what the shared block has
+		if(!buffer_uptodate(bh_result) && !PageUptodate(bh_result->b_page))
+		{
+			map_bh(bh_result, sb, phys);
+			lock_buffer(bh_result);
+			err = bh_submit_read(bh_result);
+			clear_buffer_mapped(bh_result);
+			if(err)
+			{
+				hollyfs_release_blocks(sb, 1);
+				return err;
+			}
+		}
+		set_buffer_delay(bh_result);
+		bh_result->b_bdev = sb->s_bdev;
+		bh_result->b_blocknr = HOLLYFS_DELAY_BLOCK;
+		return 0;
+	}
+	if(phys)
+	{
+		set_buffer_unwritten(bh_result);
+	}
+	else
+	{
+		err = hollyfs_reserve_blocks(sb, 1);
+		if(err)
+			return err;
+		set_buffer_delay(bh_result);
+	}
+	bh_result->b_bdev = sb->s_bdev;
+	bh_result->b_blocknr = HOLLYFS_DELAY_BLOCK;
+	// the parts of the block the write does not cover must be zeroed in the page, there is nothing to read
+	set_buffer_new(bh_result);
+	return 0;
+}
+
+// a page whose buffers are still mapped to blocks the file shares now (they were read before a reflink) must not be
+// written there, those buffers lose their mapping so that __block_write_begin asks hollyfs_get_block_delay about
+// them again, which copies, the page is locked
+static void hollyfs_cow_page(struct inode *inode, struct page *page)
+{
+	struct buffer_head *head, *bh;
+
+	if(!(HOLLYFS_I(inode)->flags & HOLLYFS_INODE_SHARED) || !page_has_buffers(page))
+		return;
+	head = bh = page_buffers(page);
+	do
+	{
+		if(buffer_mapped(bh) && !buffer_delay(bh) && hollyfs_block_shared(inode->i_sb, bh->b_blocknr))
+			clear_buffer_mapped(bh);
+		bh = bh->b_this_page;
+	} while(bh != head);
+}
+
+// fills page 0 of an inline file from the copy of its contents in the inode, there is nothing to read from the disk
+// inline data past i_size is always zero, so the whole inline area can be copied and the rest of the page is zeroed
+static void hollyfs_inline_fill_page(struct inode *inode, struct page *page)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	void *kaddr;
+
+	kaddr = kmap_local_page(page);
+	down_read(&hfs_inode->extent_sem);
+	memcpy(kaddr, hfs_inode->inline_data, HOLLYFS_INLINE_DATA_MAX);
+	up_read(&hfs_inode->extent_sem);
+	memset(kaddr + HOLLYFS_INLINE_DATA_MAX, 0, PAGE_SIZE - HOLLYFS_INLINE_DATA_MAX);
+	kunmap_local(kaddr);
+	flush_dcache_page(page);
+	SetPageUptodate(page);
+}
+
+// moves an inline file over to extents, its contents go to page 0 of the page cache, which is marked dirty
+// so that writeback gives it a block like any other file data, page is page 0, locked, or NULL for an empty file
+// every conversion of a file with data holds the lock of page 0, so does an inline write from write_begin to write_end,
+// that is what keeps a write fault (which can't take i_rwsem) from converting the file under a write
+static void hollyfs_inline_convert_page(struct inode *inode, struct page *page)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+
+	// somebody else got to it while we waited for the page
+	if(!hollyfs_has_inline_data(inode))
+		return;
+	if(page && !PageUptodate(page))
+		hollyfs_inline_fill_page(inode, page);
+	// the inline bytes share their space with the extents, an empty extent map has to be all zeroes
+	down_write(&hfs_inode->extent_sem);
+	hfs_inode->flags &= ~HOLLYFS_INODE_INLINE_DATA;
+	memset(hfs_inode->inline_data, 0, sizeof(hfs_inode->inline_data));
+	up_write(&hfs_inode->extent_sem);
+	// from here on the data only lives in the page, dirty it so it is not dropped before it has a block
+	if(page)
+		set_page_dirty(page);
+	mark_inode_dirty(inode);
+}
+
+// the same for callers that hold i_rwsem and don't have page 0 yet: a write or a truncate that is about to take
+// the file past HOLLYFS_INLINE_DATA_MAX, or fallocate
+// the conversion logs the inode, its handle is started before page 0 is locked (a write's handle is joined)
+static int hollyfs_inline_convert(struct inode *inode)
+{
+	struct page *page = NULL;
+	handle_t *handle;
+
+	handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_INODE_CREDITS, 0);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	// an empty file has nothing to move
+	if(i_size_read(inode))
+	{
+		page = grab_cache_page_write_begin(inode->i_mapping, 0);
+		if(!page)
+		{
+			jbd2_journal_stop(handle);
+			return -ENOMEM;
+		}
+	}
+	hollyfs_inline_convert_page(inode, page);
+	if(page)
+	{
+		unlock_page(page);
+		put_page(page);
+	}
+	return jbd2_journal_stop(handle);
+}
+
+// reads a page worth of file data, all the blocks of an extent go out in one bio
+// an inline file is copied out of the inode without any block I/O
+static int hollyfs_read_folio(struct file *file, struct folio *folio)
+{
+	struct inode *inode = folio->mapping->host;
+
+	if(hollyfs_has_inline_data(inode))
+	{
+		if(folio->index == 0)
+			hollyfs_inline_fill_page(inode, &folio->page);
+		else
+		{
+			folio_zero_range(folio, 0, folio_size(folio));
+			folio_mark_uptodate(folio);
+		}
+		folio_unlock(folio);
+		return 0;
+	}
+	return mpage_read_folio(folio, hollyfs_get_block);
+}
+
+// reads ahead a window of pages for sequential readers, again merging contiguous blocks into big bios
+// an inline file is a single page that read_folio fills from memory, there is nothing worth reading ahead
+static void hollyfs_readahead(struct readahead_control *rac)
+{
+	if(hollyfs_has_inline_data(rac->mapping->host))
+		return;
+	mpage_readahead(rac, hollyfs_get_block);
+}
+
+// checks that writeback can send a locked dirty page as it is, with every dirty buffer inside i_size mapped to a
+// written block, a page is locked here so nothing may start a handle, dirty buffers that were never looked up
+// (a page dirtied without buffers) go through hollyfs_get_block_delay, which only reserves
+// returns 1 when the page can go, 0 when some of it waits for the delayed allocation pass, or an error
+static int hollyfs_page_ready(struct inode *inode, struct page *page)
+{
+	unsigned int blocks_per_page = PAGE_SIZE >> inode->i_blkbits;
+	sector_t blk, last = DIV_ROUND_UP(i_size_read(inode), 1 << inode->i_blkbits);
+	struct buffer_head *head, *bh;
+	int ready = 1, err;
+
+	if(!page_has_buffers(page))
+		create_empty_buffers(page, 1 << inode->i_blkbits, (1 << BH_Dirty) | (1 << BH_Uptodate));
+	blk = (sector_t)page->index * blocks_per_page;
+	head = bh = page_buffers(page);
+	do
+	{
+		// block_write_full_page leaves the buffers past the end of the file alone
+		if(blk < last && buffer_dirty(bh))
+		{
+			if(!buffer_mapped(bh) && !buffer_delay(bh) && !buffer_unwritten(bh))
+			{
+				err = hollyfs_get_block_delay(inode, blk, bh, 1);
+				if(err)
+					return err;
+				// the page is uptodate, there is nothing to zero
+				clear_buffer_new(bh);
+			}
+			if(!buffer_mapped(bh) || buffer_delay(bh) || buffer_unwritten(bh))
+				ready = 0;
+		}
+		blk++;
+		bh = bh->b_this_page;
+	} while(bh != head);
+	return ready;
+}
+
+// writes a single dirty page, used when memory reclaim wants a specific page cleaned
+// a page with blocks that are not allocated yet is redirtied, the next hollyfs_writepages allocates them first
+static int hollyfs_writepage(struct page *page, struct writeback_control *wbc)
+{
+	int ready = hollyfs_page_ready(page->mapping->host, page);
+
+	if(ready <= 0)
+	{
+		redirty_page_for_writepage(wbc, page);
+		unlock_page(page);
+		return ready;
+	}
+	return block_write_full_page(page, hollyfs_get_block, wbc);
+}
+
+// looks through the dirty pages of [*index, end] for the next run of delayed (or unwritten) blocks that follow each other in the file,
+// locks the pages that hold it and returns them in pages[] and their number, the run starts at file block *run_start
+// and is *run_len blocks long, *index is left past the pages that were looked at
+// the run ends at the first page or buffer that is neither, so its pages are consecutive in the file
+static unsigned int hollyfs_da_gather(struct address_space *mapping, pgoff_t *index, pgoff_t end, struct page **pages, unsigned int *run_start, unsigned int *run_len)
+{
+	unsigned int blocks_per_page = PAGE_SIZE >> mapping->host->i_blkbits;
+	struct buffer_head *head, *bh;
+	struct pagevec pvec;
+	struct page *page;
+	unsigned int nr = 0, i;
+	unsigned long blk;
+	bool in_run, done = false;
+
+	*run_len = 0;
+	pagevec_init(&pvec);
+	while(!done && pagevec_lookup_range_tag(&pvec, mapping, index, end, PAGECACHE_TAG_DIRTY))
+	{
+		for(i = 0; i < pagevec_count(&pvec) && !done; i++)
+		{
+			page = pvec.pages[i];
+			// a page that does not follow the last one ends the run
+			if(nr && page->index != pages[nr - 1]->index + 1)
+			{
+				done = true;
+				break;
+			}
+			lock_page(page);
+			if(page->mapping != mapping || !PageDirty(page) || !page_has_buffers(page))
+			{
+				unlock_page(page);
+				done = nr > 0;
+				continue;
+			}
+			in_run = false;
+			blk = page->index * blocks_per_page;
+			head = bh = page_buffers(page);
+			do
+			{
+				if((buffer_delay(bh) || buffer_unwritten(bh)) && blk <= U32_MAX && (!*run_len || blk == *run_start + *run_len))
+				{
+					if(!*run_len)
+						*run_start = blk;
+					(*run_len)++;
+					in_run = true;
+				}
+				else if(*run_len)
+				{
+					// a block that is not delayed (or does not follow) after the run has started ends it
+					done = true;
+				}
+				blk++;
+				bh = bh->b_this_page;
+			} while(bh != head && !done);
+			if(in_run)
+			{
+				get_page(page);
+				pages[nr++] = page;
+				if(nr == HOLLYFS_DA_MAX_PAGES)
+					done = true;
+			}
+			else
+			{
+				unlock_page(page);
+			}
+		}
+		pagevec_release(&pvec);
+	}
+	return nr;
+}
+
+// gives the delayed blocks [run_start, run_start + run_len) blocks on disk, as one extent when the allocator finds a run
+// that long, and maps the buffers of the locked pages to them, *done is how many blocks of the run got mapped
+// unwritten blocks in the run already have theirs and only become written, both end up as one extent when they line up
+// when the run ends at the end of the file a window of unwritten blocks is allocated behind it as well, so the
+// next appends continue the same extent instead of starting a new one wherever the allocator is by then
+// delayed blocks over written ones are copies on write (hollyfs_get_block_delay), they get new blocks in their place
+static int hollyfs_da_map_run(struct inode *inode, struct page **pages, unsigned int nr, unsigned int run_start, unsigned int run_len, unsigned int *done)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	unsigned int blocks_per_page = PAGE_SIZE >> inode->i_blkbits;
+	struct buffer_head *head, *bh;
+	unsigned int phys, got = 0, i, reserved = 0, end, window, spare;
+	unsigned long blk;
+	s64 avail;
+	int err;
+
+	if(hfs_inode->flags & HOLLYFS_INODE_SHARED)
+	{
+		err = hollyfs_cow_extent_run(inode, run_start, run_len, &phys, &got);
+		if(err)
+			return err;
+	}
+	if(!got)
+	{
+		err = hollyfs_alloc_extent_run(inode, run_start, run_len, false, &phys, &got);
+		if(err)
+			return err;
+	}
+	trace_hollyfs_da_map_run(inode, run_start, phys, got);
+	for(i = 0; i < nr; i++)
+	{
+		blk = pages[i]->index * blocks_per_page;
+		head = bh = page_buffers(pages[i]);
+		do
+		{
+			if((buffer_delay(bh) || buffer_unwritten(bh)) && blk >= run_start && blk < run_start + got)
+			{
+				if(buffer_delay(bh))
+					reserved++;
+				clear_buffer_delay(bh);
+				clear_buffer_unwritten(bh);
+				map_bh(bh, sb, phys + (blk - run_start));
+			}
+			blk++;
+			bh = bh->b_this_page;
+		} while(bh != head);
+	}
+	hollyfs_release_blocks(sb, reserved);
+	*done = got;
+
+	// the speculative window behind the end of the file
+	end = run_start + got;
+	if(got < run_len || end < DIV_ROUND_UP(i_size_read(inode), HOLLYFS_BLOCK_SIZE) || end == U32_MAX)
+		return 0;
+	avail = percpu_counter_read_positive(&sbi->free_blocks) - percpu_counter_read_positive(&sbi->dirty_blocks);
+	if(avail < sbi->sb_ondisk->fs_size / HOLLYFS_PREALLOC_FREE_SHARE)
+		return 0;
+	window = clamp_t(unsigned int, end, HOLLYFS_PREALLOC_MIN, HOLLYFS_PREALLOC_MAX);
+	window = min(window, U32_MAX - end);
+	// running out of space here is fine, the window is only a hint
+	if(!hollyfs_alloc_extent_run(inode, end, window, true, &phys, &spare))
+		WRITE_ONCE(hfs_inode->speculative, true);
+	return 0;
+}
+
+// allocates the blocks of every delayed buffer in the pages [index, end] of a file, run by run, each run in a handle of its own
+// the pages of a run stay locked until their buffers are mapped, so they can't be written out (or invalidated) half way
+static int hollyfs_da_alloc_range(struct address_space *mapping, pgoff_t index, pgoff_t end)
+{
+	struct inode *inode = mapping->host;
+	unsigned int blocks_per_page = PAGE_SIZE >> inode->i_blkbits;
+	struct page **pages;
+	unsigned int nr, i, run_start, run_len, done;
+	handle_t *handle;
+	int err = 0, err2;
+
+	pages = kmalloc_array(HOLLYFS_DA_MAX_PAGES, sizeof(*pages), GFP_NOFS);
+	if(!pages)
+		return -ENOMEM;
+	while(index <= end && !err)
+	{
+		// the handle is started before any page is locked, the same order write_begin takes them in
+		handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_DA_CREDITS, 0);
+		if(IS_ERR(handle))
+		{
+			err = PTR_ERR(handle);
+			break;
+		}
+		nr = hollyfs_da_gather(mapping, &index, end, pages, &run_start, &run_len);
+		if(!nr)
+		{
+			jbd2_journal_stop(handle);
+			break;
+		}
+		done = 0;
+		err = hollyfs_da_map_run(inode, pages, nr, run_start, run_len, &done);
+		for(i = 0; i < nr; i++)
+		{
+			unlock_page(pages[i]);
+			put_page(pages[i]);
+		}
+		err2 = jbd2_journal_stop(handle);
+		if(!err)
+			err = err2;
+		// the page with the first block that is still delayed may have more of the run in it
+		index = (run_start + done) / blocks_per_page;
+		cond_resched();
+	}
+	kfree(pages);
+	return err;
+}
+
+// what write_cache_pages calls for every dirty page of hollyfs_writepages, the page is locked
+static int hollyfs_writepages_page(struct page *page, struct writeback_control *wbc, void *data)
+{
+	return hollyfs_writepage(page, wbc);
+}
+
+// writes back a range of dirty pages, the delayed blocks in the range get their blocks first, in runs as long as the
+// dirty data allows, every run in a handle that is started before its pages are locked
+// the pages are written after that, a page that still has blocks without a place on disk (it got dirty after the
+// allocation pass, or the pass failed) is redirtied and not written, no handle is ever started under a page lock
+// the pages go out one by one under a plug, so the block layer still merges contiguous blocks into big requests
+static int hollyfs_writepages(struct address_space *mapping, struct writeback_control *wbc)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(mapping->host->i_sb);
+	pgoff_t start = 0, end = -1;
+	long nr_to_write = wbc->nr_to_write;
+	u64 t0 = ktime_get_ns(), ns;
+	struct blk_plug plug;
+	int err, da_err = 0;
+
+	if(!wbc->range_cyclic)
+	{
+		start = wbc->range_start >> PAGE_SHIFT;
+		end = wbc->range_end >> PAGE_SHIFT;
+	}
+	if(!hollyfs_has_inline_data(mapping->host))
+	{
+		da_err = hollyfs_da_alloc_range(mapping, start, end);
+		if(da_err && da_err != -ENOSPC)
+			printk_ratelimited("hollyfs: delayed allocation for inode %lu failed with %d\n", mapping->host->i_ino, da_err);
+	}
+	blk_start_plug(&plug);
+	err = write_cache_pages(mapping, wbc, hollyfs_writepages_page, NULL);
+	blk_finish_plug(&plug);
+	// the pages the allocation pass could not place stay dirty, fsync has to hear that they were not written
+	if(!err)
+		err = da_err;
+	ns = hollyfs_stat_latency(sbi, HOLLYFS_LAT_WRITEBACK, t0);
+	trace_hollyfs_writepages(mapping->host, nr_to_write, nr_to_write - wbc->nr_to_write, err, ns);
+	return err;
+}
+
+// drops (part of) a page from the page cache, the delayed blocks in the dropped part give back their reservation
+// block_invalidate_folio only drops the buffers that lie completely inside [offset, offset + length) as well
+static void hollyfs_invalidate_folio(struct folio *folio, size_t offset, size_t length)
+{
+	struct buffer_head *head, *bh;
+	size_t pos = 0;
+	unsigned int n = 0;
+
+	head = folio_buffers(folio);
+	if(head)
+	{
+		bh = head;
+		do
+		{
+			if(pos >= offset && pos + bh->b_size <= offset + length && buffer_delay(bh))
+			{
+				clear_buffer_delay(bh);
+				n++;
+			}
+			pos += bh->b_size;
+			bh = bh->b_this_page;
+		} while(bh != head);
+		if(n)
+			hollyfs_release_blocks(folio->mapping->host->i_sb, n);
+	}
+	block_invalidate_folio(folio, offset, length);
+}
+
+// a write that failed must not leave pages past the end of the file, dropping them gives back the blocks they had
+// reserved (see hollyfs_invalidate_folio), a buffered write allocates nothing itself, and the blocks that are past
+// the end already were put there by fallocate or by writeback on purpose, so they stay
+static void hollyfs_write_failed(struct address_space *mapping, loff_t to)
+{
+	struct inode *inode = mapping->host;
+
+	if(to > inode->i_size)
+		truncate_pagecache(inode, inode->i_size);
+}
+
+// gets the page for a buffered write ready, holes it covers only get blocks reserved (see hollyfs_get_block_delay)
+// the journal handle is started before the page is locked and held until write_end, so the new i_size commits
+// in the same transaction, failing writes may revoke an extent block
+// a write that keeps an inline file within HOLLYFS_INLINE_DATA_MAX bytes only needs page 0 filled from the inode,
+// a write past that moves the file to extents first
+// otherwise this is block_write_begin, with the page's buffers checked for shared blocks in between
+static int hollyfs_write_begin(struct file *file, struct address_space *mapping, loff_t pos, unsigned len, struct page **pagep, void **fsdata)
+{
+	struct inode *inode = mapping->host;
+	struct page *page;
+	handle_t *handle;
+	int ret;
+
+	handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_WRITE_CREDITS, 1);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	if(hollyfs_has_inline_data(inode))
+	{
+		if(pos + len <= HOLLYFS_INLINE_DATA_MAX)
+		{
+			page = grab_cache_page_write_begin(mapping, 0);
+			if(!page)
+			{
+				jbd2_journal_stop(handle);
+				return -ENOMEM;
+			}
+			// a write fault may have converted the file while we waited for the page
+			if(hollyfs_has_inline_data(inode))
+			{
+				// the whole page is made uptodate, so a short copy in the middle of it can't leave garbage behind
+				if(!PageUptodate(page))
+					hollyfs_inline_fill_page(inode, page);
+				*pagep = page;
+				return 0;
+			}
+			unlock_page(page);
+			put_page(page);
+		}
+		else
+		{
+			ret = hollyfs_inline_convert(inode);
+			if(ret)
+			{
+				jbd2_journal_stop(handle);
+				return ret;
+			}
+		}
+	}
+	page = grab_cache_page_write_begin(mapping, pos >> PAGE_SHIFT);
+	if(!page)
+	{
+		ret = -ENOMEM;
+		goto out_failed;
+	}
+	hollyfs_cow_page(inode, page);
+	ret = __block_write_begin(page, pos, len, hollyfs_get_block_delay);
+	if(ret < 0)
+	{
+		unlock_page(page);
+		put_page(page);
+		goto out_failed;
+	}
+	*pagep = page;
+	return ret;
+out_failed:
+	hollyfs_write_failed(mapping, pos + len);
+	jbd2_journal_stop(handle);
+	return ret;
+}
+
+// finishes a write into an inline file, the new bytes go from the page into the inode and the page stays clean,
+// the inode is logged in the running handle so the data commits with it and no data block is ever written
+static int hollyfs_inline_write_end(struct inode *inode, loff_t pos, unsigned copied, struct page *page)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	void *kaddr;
+
+	kaddr = kmap_local_page(page);
+	down_write(&hfs_inode->extent_sem);
+	memcpy(hfs_inode->inline_data + pos, kaddr + pos, copied);
+	up_write(&hfs_inode->extent_sem);
+	kunmap_local(kaddr);
+	if(pos + copied > inode->i_size)
+		i_size_write(inode, pos + copied);
+	unlock_page(page);
+	put_page(page);
+	mark_inode_dirty(inode);
+	return copied;
+}
+
+// finishes a buffered write, generic_write_end updates i_size and marks the inode dirty when the file grew
+static int hollyfs_write_end(struct file *file, struct address_space *mapping, loff_t pos, unsigned len, unsigned copied, struct page *page, void *fsdata)
+{
+	handle_t *handle = journal_current_handle();
+	int ret, err;
+
+	if(hollyfs_has_inline_data(mapping->host))
+	{
+		ret = hollyfs_inline_write_end(mapping->host, pos, copied, page);
+		err = jbd2_journal_stop(handle);
+		return err ? err : ret;
+	}
+	ret = generic_write_end(file, mapping, pos, len, copied, page, fsdata);
+	if(ret < len)
+		hollyfs_write_failed(mapping, pos + len);
+	err = jbd2_journal_stop(handle);
+	return err ? err : ret;
+}
+
+// describes the blocks behind [offset, offset + length) of a file for the iomap code, which drives direct I/O,
+// SEEK_HOLE / SEEK_DATA, fiemap and bmap with it, as one extent (or the hole up to the next one) at a time
+// so a direct read or write of a contiguous range goes out as bios as large as the extent allows
+// a direct write into a hole gets a run of unwritten blocks here, they only become written once the data is on disk
+// (hollyfs_dio_write_end_io), so a crash in between can never show what the blocks held before
+static int hollyfs_iomap_begin(struct inode *inode, loff_t offset, loff_t length, unsigned flags, struct iomap *iomap, struct iomap *srcmap)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	unsigned int blkbits = inode->i_blkbits;
+	unsigned int iblock, last, phys, len, got;
+	bool unwritten;
+	handle_t *handle;
+	int err;
+
+	iomap->bdev = sb->s_bdev;
+	iomap->flags = 0;
+	if(hollyfs_has_inline_data(inode))
+	{
+		// direct I/O never sees an inline file, the read and write paths send those through the page cache
+		if(flags & IOMAP_DIRECT)
+			return -EIO;
+		iomap->offset = 0;
+		iomap->length = i_size_read(inode);
+		iomap->type = IOMAP_INLINE;
+		iomap->addr = IOMAP_NULL_ADDR;
+		iomap->inline_data = hfs_inode->inline_data;
+		if(offset < iomap->length)
+			return 0;
+		// past the end of the data there is only a hole
+		iomap->offset = offset;
+		iomap->length = length;
+		iomap->type = IOMAP_HOLE;
+		iomap->inline_data = NULL;
+		return 0;
+	}
+
+	if((offset >> blkbits) > U32_MAX)
+		return -EFBIG;
+	iblock = offset >> blkbits;
+	last = min_t(u64, (offset + length - 1) >> blkbits, U32_MAX);
+	err = hollyfs_lookup_extent(inode, iblock, &phys, &len, &unwritten);
+	if(err)
+		return err;
+
+	if(phys)
+	{
+		iomap->type = unwritten ? IOMAP_UNWRITTEN : IOMAP_MAPPED;
+		len = min_t(u64, len, (u64)last - iblock + 1);
+	}
+	else if((flags & (IOMAP_WRITE | IOMAP_DIRECT)) == (IOMAP_WRITE | IOMAP_DIRECT))
+	{
+		// filling a hole allocates, and that has to wait for the journal
+		if(flags & IOMAP_NOWAIT)
+			return -EAGAIN;
+		// no further than the next extent, the rest of the write gets its own mapping
+		if(len)
+			last = min(last, iblock + len - 1);
+		handle = hollyfs_journal_start(sb, HOLLYFS_WRITE_CREDITS, 0);
+		if(IS_ERR(handle))
+			return PTR_ERR(handle);
+		err = hollyfs_alloc_extent_run(inode, iblock, min_t(u64, (u64)last - iblock + 1, U32_MAX), true, &phys, &got);
+		jbd2_journal_stop(handle);
+		if(err)
+			return err;
+		iomap->type = IOMAP_UNWRITTEN;
+		iomap->flags |= IOMAP_F_NEW;
+		len = got;
+	}
+	else
+	{
+		// a hole up to the next extent, or up to the end of the range when there is none
+		iomap->type = IOMAP_HOLE;
+		iomap->addr = IOMAP_NULL_ADDR;
+		iomap->offset = (loff_t)iblock << blkbits;
+		iomap->length = len ? min_t(u64, len, (u64)last - iblock + 1) : (u64)last - iblock + 1;
+		iomap->length <<= blkbits;
+		return 0;
+	}
+	iomap->addr = (u64)phys << blkbits;
+	iomap->offset = (loff_t)iblock << blkbits;
+	iomap->length = (u64)len << blkbits;
+	return 0;
+}
+
+// a direct write that came up short leaves the unwritten blocks iomap_begin allocated for the rest of it,
+// the ones past the end of the file go again unless fallocate put blocks there on purpose
+static int hollyfs_iomap_end(struct inode *inode, loff_t pos, loff_t length, ssize_t written, unsigned flags, struct iomap *iomap)
+{
+	handle_t *handle;
+	loff_t end;
+	int err, err2;
+
+	if(!(flags & IOMAP_WRITE) || !(iomap->flags & IOMAP_F_NEW) || written >= length)
+		return 0;
+	end = max(pos + (written > 0 ? written : 0), i_size_read(inode));
+	if(end >= iomap->offset + iomap->length || (HOLLYFS_I(inode)->flags & HOLLYFS_INODE_PREALLOC))
+		return 0;
+	handle = hollyfs_journal_start(inode->i_sb, hollyfs_truncate_credits(inode, DIV_ROUND_UP(end, HOLLYFS_BLOCK_SIZE)), 1);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	err = hollyfs_truncate_blocks(inode, DIV_ROUND_UP(end, HOLLYFS_BLOCK_SIZE));
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
+}
+
+static const struct iomap_ops hollyfs_iomap_ops = {
+	.iomap_begin = hollyfs_iomap_begin,
+	.iomap_end = hollyfs_iomap_end,
+};
+
+// called once the data of a direct write is on disk: the unwritten blocks it went to become written ones, one run
+// per transaction, and a write past the end of the file moves i_size after that, so a crash in between can
+// only lose the tail of the write, never make the file cover blocks that don't hold its data
+static int hollyfs_dio_write_end_io(struct kiocb *iocb, ssize_t size, int error, unsigned flags)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	unsigned int iblock, last, phys, got;
+	loff_t pos = iocb->ki_pos;
+	handle_t *handle;
+	int err = 0, err2;
+
+	if(error || size <= 0)
+		return error;
+	if(flags & IOMAP_DIO_UNWRITTEN)
+	{
+		iblock = pos >> inode->i_blkbits;
+		last = (pos + size - 1) >> inode->i_blkbits;
+		for(;;)
+		{
+			handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_WRITE_CREDITS, 0);
+			if(IS_ERR(handle))
+				return PTR_ERR(handle);
+			err = hollyfs_alloc_extent_run(inode, iblock, min_t(u64, (u64)last - iblock + 1, U32_MAX), false, &phys, &got);
+			err2 = jbd2_journal_stop(handle);
+			if(!err)
+				err = err2;
+			if(err || last - iblock < got)
+				break;
+			iblock += got;
+		}
+		if(err)
+			return err;
+	}
+	if(pos + size > i_size_read(inode))
+	{
+		handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_INODE_CREDITS, 0);
+		if(IS_ERR(handle))
+			return PTR_ERR(handle);
+		i_size_write(inode, pos + size);
+		mark_inode_dirty(inode);
+		err = jbd2_journal_stop(handle);
+	}
+	return err;
+}
+
+static const struct iomap_dio_ops hollyfs_dio_write_ops = {
+	.end_io = hollyfs_dio_write_end_io,
+};
+
+// FIBMAP support, mostly useful for checking how a file ended up laid out on disk
+// iomap_bmap writes the dirty pages out first, so delayed blocks have their blocks by the time it looks
+static sector_t hollyfs_bmap(struct address_space *mapping, sector_t block)
+{
+	// an inline file has no blocks to show
+	if(hollyfs_has_inline_data(mapping->host))
+		return 0;
+	return iomap_bmap(mapping, block, &hollyfs_iomap_ops);
+}
+
+// page cache operations for regular files, everything goes through hollyfs_get_block except buffered writes,
+// which only reserve their blocks through hollyfs_get_block_delay
+static const struct address_space_operations hollyfs_aops = {
+	.dirty_folio = block_dirty_folio,
+	.invalidate_folio = hollyfs_invalidate_folio,
+	.read_folio = hollyfs_read_folio,
+	.readahead = hollyfs_readahead,
+	.writepage = hollyfs_writepage,
+	.writepages = hollyfs_writepages,
+	.write_begin = hollyfs_write_begin,
+	.write_end = hollyfs_write_end,
+	.bmap = hollyfs_bmap,
+	.direct_IO = noop_direct_IO, // only lets open accept O_DIRECT, hollyfs_file_read_iter and hollyfs_file_write_iter do the work
+	.migrate_folio = buffer_migrate_folio,
+	.is_partially_uptodate = block_is_partially_uptodate,
+	.error_remove_page = generic_error_remove_page,
+};
+
+// zeroes the last block of a file past size like block_truncate_page does, but when the block is shared with other
+// files the zeroes go through hollyfs_get_block_delay like a write, so they end up in a copy and not in the other files
+static int hollyfs_truncate_page(struct inode *inode, loff_t size)
+{
+	unsigned int off = size & (HOLLYFS_BLOCK_SIZE - 1), phys, len;
+	struct page *page;
+	bool unwritten;
+	int err;
+
+	if(!off || !(HOLLYFS_I(inode)->flags & HOLLYFS_INODE_SHARED))
+		return block_truncate_page(inode->i_mapping, size, hollyfs_get_block);
+	err = hollyfs_lookup_extent(inode, size >> inode->i_blkbits, &phys, &len, &unwritten);
+	if(err)
+		return err;
+	if(!phys || unwritten || !hollyfs_block_shared(inode->i_sb, phys))
+		return block_truncate_page(inode->i_mapping, size, hollyfs_get_block);
+
+	page = grab_cache_page(inode->i_mapping, size >> PAGE_SHIFT);
+	if(!page)
+		return -ENOMEM;
+	hollyfs_cow_page(inode, page);
+	err = __block_write_begin(page, size, HOLLYFS_BLOCK_SIZE - off, hollyfs_get_block_delay);
+	if(!err)
+	{
+		zero_user(page, offset_in_page(size), HOLLYFS_BLOCK_SIZE - off);
+		block_commit_write(page, offset_in_page(size), offset_in_page(size) + HOLLYFS_BLOCK_SIZE - off);
+	}
+	unlock_page(page);
+	put_page(page);
+	return err;
+}
+
+// changes the size of a regular file, the part of the last block past the new end is zeroed
+// and every block after it goes back to the bitmap
+// the new size and the freed blocks go into one transaction, so a crash can't leave blocks past the end still in use
+static int hollyfs_truncate(struct inode *inode, loff_t size)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	handle_t *handle;
+	int err, err2;
+
+	// direct writes still in flight must not land in blocks that are about to go
+	inode_dio_wait(inode);
+	if(hollyfs_has_inline_data(inode) && size > HOLLYFS_INLINE_DATA_MAX)
+	{
+		err = hollyfs_inline_convert(inode);
+		if(err)
+			return err;
+	}
+	if(hollyfs_has_inline_data(inode))
+	{
+		// an inline file only changes its inode, the bytes past the new end are zeroed to keep them zero
+		handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_INODE_CREDITS, 0);
+		if(IS_ERR(handle))
+			return PTR_ERR(handle);
+		down_write(&hfs_inode->extent_sem);
+		// a write fault can still convert the file, it does not take i_rwsem
+		if(hollyfs_has_inline_data(inode) && size < HOLLYFS_INLINE_DATA_MAX)
+			memset(hfs_inode->inline_data + size, 0, HOLLYFS_INLINE_DATA_MAX - size);
+		up_write(&hfs_inode->extent_sem);
+		truncate_setsize(inode, size);
+		inode->i_mtime = inode->i_ctime = current_time(inode);
+		mark_inode_dirty(inode);
+		return jbd2_journal_stop(handle);
+	}
+
+	err = hollyfs_truncate_page(inode, size);
+	if(err)
+		return err;
+	handle = hollyfs_journal_start(inode->i_sb, hollyfs_truncate_credits(inode, DIV_ROUND_UP(size, HOLLYFS_BLOCK_SIZE)), 1);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	truncate_setsize(inode, size);
+	err = hollyfs_truncate_blocks(inode, DIV_ROUND_UP(size, HOLLYFS_BLOCK_SIZE));
+	// nothing is left past the end now, neither fallocated nor speculative blocks
+	hfs_inode->flags &= ~HOLLYFS_INODE_PREALLOC;
+	WRITE_ONCE(hfs_inode->speculative, false);
+	inode->i_mtime = inode->i_ctime = current_time(inode);
+	mark_inode_dirty(inode);
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
+}
+
+// chmod / chown / truncate on a regular file
+static int hollyfs_setattr(struct user_namespace *mnt_userns, struct dentry *dentry, struct iattr *attr)
+{
+	struct inode *inode = d_inode(dentry);
+	int err;
+
+	err = setattr_prepare(mnt_userns, dentry, attr);
+	if(err)
+		return err;
+
+	if((attr->ia_valid & ATTR_SIZE) && attr->ia_size != i_size_read(inode))
+	{
+		err = hollyfs_truncate(inode, attr->ia_size);
+		if(err)
+			return err;
+	}
+	setattr_copy(mnt_userns, inode, attr);
+	mark_inode_dirty(inode);
+	return 0;
+}
+
+// fsync for files and directories
+// file data is written in place, every metadata change (blocks, size, directory records) is already in the journal,
+// so once the data is out committing the journal makes the file durable, the commit ends with a cache flush
+// when there was nothing left to commit the data still needs a cache flush of its own
+static int hollyfs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	journal_t *journal = HOLLYFS_SB(sb)->journal;
+	bool running;
+	int err;
+
+	err = file_write_and_wait_range(file, start, end);
+	if(err)
+		return err;
+	read_lock(&journal->j_state_lock);
+	running = journal->j_running_transaction != NULL;
+	read_unlock(&journal->j_state_lock);
+	// this also waits for a commit that is already under way
+	hollyfs_stat_add(HOLLYFS_SB(sb), sync_commits, 1);
+	err = jbd2_journal_force_commit(journal);
+	if(!err && !running)
+		err = blkdev_issue_flush(sb->s_bdev);
+	return err;
+}
+
+// reads from a regular file, O_DIRECT reads go straight from the device into the user's buffer through iomap,
+// after iomap_dio_rw wrote out any dirty pages in the range, everything else goes through the page cache
+static ssize_t hollyfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	ssize_t ret;
+
+	if(!(iocb->ki_flags & IOCB_DIRECT))
+		return generic_file_read_iter(iocb, to);
+	if(!iov_iter_count(to))
+		return 0;
+
+	if(iocb->ki_flags & IOCB_NOWAIT)
+	{
+		if(!inode_trylock_shared(inode))
+			return -EAGAIN;
+	}
+	else
+	{
+		inode_lock_shared(inode);
+	}
+	// an inline file has no blocks to read from, its data only ever lives in the inode and the page cache
+	if(hollyfs_has_inline_data(inode))
+	{
+		inode_unlock_shared(inode);
+		iocb->ki_flags &= ~IOCB_DIRECT;
+		return generic_file_read_iter(iocb, to);
+	}
+	ret = iomap_dio_rw(iocb, to, &hollyfs_iomap_ops, NULL, 0, NULL, 0);
+	inode_unlock_shared(inode);
+	file_accessed(iocb->ki_filp);
+	return ret;
+}
+
+// a direct write that does not cover whole blocks, or goes to an inline file or one that shares blocks (which have to
+// be copied first), is done through the page cache instead
+// and written out and dropped from it right away, which is what O_DIRECT promises the caller, just not as fast
+static ssize_t hollyfs_dio_fallback(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct address_space *mapping = iocb->ki_filp->f_mapping;
+	loff_t pos = iocb->ki_pos;
+	ssize_t ret;
+	int err;
+
+	iocb->ki_flags &= ~IOCB_DIRECT;
+	ret = generic_perform_write(iocb, from);
+	if(ret <= 0)
+		return ret;
+	iocb->ki_pos += ret;
+	err = filemap_write_and_wait_range(mapping, pos, pos + ret - 1);
+	if(err)
+		return err;
+	invalidate_mapping_pages(mapping, pos >> PAGE_SHIFT, (pos + ret - 1) >> PAGE_SHIFT);
+	return ret;
+}
+
+// writes to a regular file, block aligned O_DIRECT writes go straight from the user's buffer to the device through iomap
+// writes that grow the file wait for their I/O before i_rwsem is dropped, so the end_io that moves i_size can't race
+// with another write or a truncate, writes inside the file may complete asynchronously
+static ssize_t hollyfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	unsigned int dio_flags = 0;
+	ssize_t ret;
+
+	if(!(iocb->ki_flags & IOCB_DIRECT))
+		return generic_file_write_iter(iocb, from);
+
+	if(iocb->ki_flags & IOCB_NOWAIT)
+	{
+		if(!inode_trylock(inode))
+			return -EAGAIN;
+	}
+	else
+	{
+		inode_lock(inode);
+	}
+	ret = generic_write_checks(iocb, from);
+	if(ret <= 0)
+		goto out;
+	ret = file_modified(iocb->ki_filp);
+	if(ret)
+		goto out;
+
+	if(hollyfs_has_inline_data(inode) || (HOLLYFS_I(inode)->flags & HOLLYFS_INODE_SHARED) ||
+	   ((iocb->ki_pos | iov_iter_count(from)) & (inode->i_sb->s_blocksize - 1)))
+	{
+		ret = hollyfs_dio_fallback(iocb, from);
+		inode_unlock(inode);
+		return ret > 0 ? generic_write_sync(iocb, ret) : ret;
+	}
+	if(iocb->ki_pos + iov_iter_count(from) > i_size_read(inode))
+		dio_flags |= IOMAP_DIO_FORCE_WAIT;
+	// iomap_dio_rw syncs O_DSYNC writes itself
+	ret = iomap_dio_rw(iocb, from, &hollyfs_iomap_ops, &hollyfs_dio_write_ops, dio_flags, NULL, 0);
+out:
+	inode_unlock(inode);
+	return ret;
+}
+
+// SEEK_HOLE and SEEK_DATA walk the extent map through iomap, unwritten extents count as holes unless
+// the page cache has data for them, the other whences are the generic ones
+static loff_t hollyfs_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct inode *inode = file_inode(file);
+
+	if(whence != SEEK_HOLE && whence != SEEK_DATA)
+		return generic_file_llseek(file, offset, whence);
+
+	inode_lock_shared(inode);
+	// delayed blocks are not in the extent map yet, writing them out puts them there
+	if(mapping_tagged(inode->i_mapping, PAGECACHE_TAG_DIRTY))
+		filemap_write_and_wait(inode->i_mapping);
+	if(whence == SEEK_HOLE)
+		offset = iomap_seek_hole(inode, offset, &hollyfs_iomap_ops);
+	else
+		offset = iomap_seek_data(inode, offset, &hollyfs_iomap_ops);
+	inode_unlock_shared(inode);
+	if(offset < 0)
+		return offset;
+	return vfs_setpos(file, offset, inode->i_sb->s_maxbytes);
+}
+
+// FS_IOC_FIEMAP, lists the extents of a file, written ones and unwritten ones (FIEMAP_EXTENT_UNWRITTEN)
+// dirty pages are written out first so their delayed blocks show up too
+static int hollyfs_fiemap(struct inode *inode, struct fiemap_extent_info *fieinfo, u64 start, u64 len)
+{
+	int err;
+
+	inode_lock_shared(inode);
+	err = filemap_write_and_wait(inode->i_mapping);
+	if(!err)
+		err = iomap_fiemap(inode, fieinfo, start, len, &hollyfs_iomap_ops);
+	inode_unlock_shared(inode);
+	return err;
+}
+
+// the first write to a page of a shared writable mapping, the page gets its blocks reserved (or its unwritten
+// blocks noted) just like a buffered write would, so writeback allocates them later with the rest of the dirty data
+// page faults run under mmap_lock and can't take i_rwsem, an inline file is converted under the lock of page 0 instead
+// a reflink holds the invalidate lock while it shares blocks, so no page of the file gets dirty in the middle of one,
+// and a page that still has buffers mapped to blocks that are shared now gets them copied like a buffered write does
+static vm_fault_t hollyfs_page_mkwrite(struct vm_fault *vmf)
+{
+	struct page *page = vmf->page;
+	struct inode *inode = file_inode(vmf->vma->vm_file);
+	handle_t *handle = NULL;
+	int err = 0;
+
+	sb_start_pagefault(inode->i_sb);
+	filemap_invalidate_lock_shared(inode->i_mapping);
+	file_update_time(vmf->vma->vm_file);
+	if(hollyfs_has_inline_data(inode) || (HOLLYFS_I(inode)->flags & HOLLYFS_INODE_SHARED))
+	{
+		// the conversion logs the inode, so its handle comes before the page lock, in the order write_begin takes them
+		if(hollyfs_has_inline_data(inode))
+		{
+			handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_INODE_CREDITS, 0);
+			if(IS_ERR(handle))
+			{
+				err = PTR_ERR(handle);
+				goto out;
+			}
+		}
+		lock_page(page);
+		// a page that truncate took away in the meantime is caught by block_page_mkwrite
+		if(page->mapping == inode->i_mapping && page->index == 0)
+			hollyfs_inline_convert_page(inode, page);
+		if(page->mapping == inode->i_mapping)
+			hollyfs_cow_page(inode, page);
+		unlock_page(page);
+		if(handle)
+			err = jbd2_journal_stop(handle);
+		if(err)
+			goto out;
+	}
+	err = block_page_mkwrite(vmf->vma, vmf, hollyfs_get_block_delay);
+out:
+	filemap_invalidate_unlock_shared(inode->i_mapping);
+	sb_end_pagefault(inode->i_sb);
+	return block_page_mkwrite_return(err);
+}
+
+// faults read pages in through read_folio (and readahead), so a mapped file is read without a copy in between
+static const struct vm_operations_struct hollyfs_file_vm_ops = {
+	.fault = filemap_fault,
+	.map_pages = filemap_map_pages,
+	.page_mkwrite = hollyfs_page_mkwrite,
+};
+
+// mmap of a regular file, generic_file_mmap with our own page_mkwrite
+static int hollyfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	file_accessed(file);
+	vma->vm_ops = &hollyfs_file_vm_ops;
+	return 0;
+}
+
+// preallocates the blocks of [offset, offset + len) as unwritten extents, which read back as zeroes until they are
+// written, so a file that gets filled in later (in any order, or by several writers) still ends up in a few long extents
+// only plain preallocation is supported, with or without FALLOC_FL_KEEP_SIZE, punching and zeroing ranges are not
+// without KEEP_SIZE the file grows to cover the new blocks, with it the blocks past the end are left for later appends
+// every run of blocks is allocated and (without KEEP_SIZE) covered by i_size in a transaction of its own, so a crash
+// can't leave the file's size pointing past blocks it does not have
+static long hollyfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
+{
+	struct inode *inode = file_inode(file);
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	unsigned int iblock, last, phys, got;
+	loff_t end = offset + len, covered;
+	handle_t *handle;
+	int err = 0, err2;
+
+	if(mode & ~FALLOC_FL_KEEP_SIZE)
+		return -EOPNOTSUPP;
+	if(end > inode->i_sb->s_maxbytes)
+		return -EFBIG;
+
+	inode_lock(inode);
+	if(!(mode & FALLOC_FL_KEEP_SIZE))
+	{
+		err = inode_newsize_ok(inode, end);
+		if(err)
+			goto out;
+	}
+	// strips suid and sgid like a write does and updates mtime and ctime
+	err = file_modified(file);
+	if(err)
+		goto out;
+	// preallocated blocks need an extent map to go into
+	if(hollyfs_has_inline_data(inode))
+	{
+		err = hollyfs_inline_convert(inode);
+		if(err)
+			goto out;
+	}
+
+	iblock = offset >> inode->i_blkbits;
+	last = (end - 1) >> inode->i_blkbits;
+	for(;;)
+	{
+		handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_WRITE_CREDITS, 0);
+		if(IS_ERR(handle))
+		{
+			err = PTR_ERR(handle);
+			break;
+		}
+		err = hollyfs_alloc_extent_run(inode, iblock, min_t(u64, (u64)last - iblock + 1, U32_MAX), true, &phys, &got);
+		if(!err)
+		{
+			covered = min(end, ((loff_t)iblock + got) << inode->i_blkbits);
+			if(!(mode & FALLOC_FL_KEEP_SIZE) && covered > inode->i_size)
+				i_size_write(inode, covered);
+			// blocks past the end that are there on purpose, closing the file must leave them alone
+			if((mode & FALLOC_FL_KEEP_SIZE) && covered > inode->i_size)
+				hfs_inode->flags |= HOLLYFS_INODE_PREALLOC;
+			inode->i_ctime = current_time(inode);
+			mark_inode_dirty(inode);
+		}
+		err2 = jbd2_journal_stop(handle);
+		if(!err)
+			err = err2;
+		if(err || last - iblock < got)
+			break;
+		iblock += got;
+		if(fatal_signal_pending(current))
+		{
+			err = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+out:
+	inode_unlock(inode);
+	return err;
+}
+
+// puts blocks [src_blk, src_blk + count) of src into dst at dst_blk as more references to the same blocks, whatever dst
+// had there is dropped first, holes and unwritten blocks of src leave holes in dst
+// it goes a chunk of at most HOLLYFS_CLONE_CHUNK blocks (and never more than one extent of src) per transaction, dst
+// grows towards new_size as the chunks land, so a crash leaves a shorter clone and never a size over blocks it lacks
+// *done is how many blocks made it, the caller holds both inodes and their invalidate locks and has dropped the
+// page cache of the range in dst
+static int hollyfs_clone_blocks(struct inode *src, unsigned int src_blk, struct inode *dst, unsigned int dst_blk, unsigned int count, loff_t new_size, unsigned int *done)
+{
+	struct super_block *sb = dst->i_sb;
+	struct hollyfs_inode_info *hfs_dst = HOLLYFS_I(dst);
+	struct buffer_head *bh;
+	hollyfs_extent *ind;
+	unsigned int phys, len, n, shared, idx, pos;
+	bool unwritten;
+	loff_t covered;
+	handle_t *handle;
+	int credits, err = 0, err2;
+
+	for(*done = 0; *done < count; )
+	{
+		err = hollyfs_lookup_extent(src, src_blk + *done, &phys, &len, &unwritten);
+		if(err)
+			break;
+		n = count - *done;
+		if(len && len < n)
+			n = len;
+		n = min_t(unsigned int, n, HOLLYFS_CLONE_CHUNK);
+		// the punch in front of the clone frees blocks like a truncate would, and it can't stop half way, so the chunk
+		// gets smaller until giving back what dst has in it fits into one handle
+		for(;;)
+		{
+			credits = hollyfs_range_credits(dst, dst_blk + *done, dst_blk + *done + n) + HOLLYFS_CLONE_CREDITS;
+			if(n == 1 || credits <= hollyfs_max_credits(sb))
+				break;
+			n /= 2;
+		}
+		handle = hollyfs_journal_start(sb, credits, 2 * HOLLYFS_REFCOUNT_BLOCKS + 1);
+		if(IS_ERR(handle))
+		{
+			err = PTR_ERR(handle);
+			break;
+		}
+		down_write(&hfs_dst->extent_sem);
+		err = hollyfs_read_extent_block(sb, hfs_dst, &bh);
+		if(!err && bh)
+		{
+			err = hollyfs_journal_get_write_access(bh);
+			if(err)
+			{
+				brelse(bh);
+				bh = NULL;
+			}
+		}
+		ind = bh ? (hollyfs_extent *)bh->b_data : NULL;
+		if(!err)
+			err = hollyfs_punch_extents(dst, &bh, &ind, dst_blk + *done, dst_blk + *done + n);
+		if(!err && phys && !unwritten)
+		{
+			// both files may share blocks from now on, which sends their writes through copy on write
+			HOLLYFS_I(src)->flags |= HOLLYFS_INODE_SHARED;
+			hfs_dst->flags |= HOLLYFS_INODE_SHARED;
+			err = hollyfs_share_blocks(sb, phys, n, &shared);
+			if(!err)
+			{
+				// a count that is full cuts the chunk short, the next round gets the error
+				n = shared;
+				idx = hollyfs_search_extent(hfs_dst, ind, dst_blk + *done);
+				pos = (idx == hfs_dst->extent_count) ? 0 : idx + 1;
+				err = hollyfs_insert_extent(dst, &bh, &ind, pos, dst_blk + *done, phys, n);
+				if(err)
+				{
+					// dst does not get the blocks after all, they lose the references again
+					hollyfs_free_blocks(sb, phys, n);
+				}
+				else
+				{
+					hollyfs_merge_extent(hfs_dst, ind, pos + 1);
+					hollyfs_merge_extent(hfs_dst, ind, pos);
+					dst->i_blocks += (blkcnt_t)n << (sb->s_blocksize_bits - 9);
+				}
+			}
+		}
+		hollyfs_put_extent_block(dst, bh);
+		up_write(&hfs_dst->extent_sem);
+		if(!err)
+		{
+			covered = min(new_size, ((loff_t)dst_blk + *done + n) << dst->i_blkbits);
+			if(covered > dst->i_size)
+				i_size_write(dst, covered);
+		}
+		mark_inode_dirty(dst);
+		mark_inode_dirty(src);
+		err2 = jbd2_journal_stop(handle);
+		if(!err)
+			err = err2;
+		if(err)
+			break;
+		*done += n;
+		if(fatal_signal_pending(current))
+		{
+			err = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+	return err;
+}
+
+// FICLONE, FICLONERANGE, FIDEDUPERANGE and copy_file_range between two files of the same hollyfs all come here,
+// the target gets the blocks of the source instead of copies of them and a write to either file copies the block it
+// goes to first (see hollyfs_cow_extent_run), for a dedupe the VFS has made sure both ranges hold the same bytes
+// an inline source has no blocks to share, -EOPNOTSUPP makes copy_file_range fall back to copying it
+static loff_t hollyfs_remap_file_range(struct file *file_in, loff_t pos_in, struct file *file_out, loff_t pos_out, loff_t len, unsigned int remap_flags)
+{
+	struct inode *src = file_inode(file_in), *dst = file_inode(file_out);
+	unsigned int done = 0;
+	int err;
+
+	if(remap_flags & ~(REMAP_FILE_DEDUP | REMAP_FILE_ADVISORY))
+		return -EINVAL;
+	lock_two_nondirectories(src, dst);
+	// no page of either file can be faulted in or made dirty while their blocks change hands
+	filemap_invalidate_lock_two(src->i_mapping, dst->i_mapping);
+	err = -EOPNOTSUPP;
+	if(hollyfs_has_inline_data(src))
+		goto out;
+	if(hollyfs_has_inline_data(dst))
+	{
+		err = hollyfs_inline_convert(dst);
+		if(err)
+			goto out;
+	}
+	// checks the ranges and flags, writes back both ranges and waits for direct I/O, len may come back shorter
+	err = generic_remap_file_range_prep(file_in, pos_in, file_out, pos_out, &len, remap_flags);
+	if(err || !len)
+		goto out;
+	// the pages of the range still point at the blocks dst had until now
+	truncate_pagecache_range(dst, pos_out, round_up(pos_out + len, HOLLYFS_BLOCK_SIZE) - 1);
+	err = hollyfs_clone_blocks(src, pos_in >> src->i_blkbits, dst, pos_out >> dst->i_blkbits,
+				   (len + HOLLYFS_BLOCK_SIZE - 1) >> dst->i_blkbits, pos_out + len, &done);
+out:
+	filemap_invalidate_unlock_two(src->i_mapping, dst->i_mapping);
+	unlock_two_nondirectories(src, dst);
+	// a clone that got cut short still reports what it did
+	if(done)
+		return min_t(loff_t, len, (loff_t)done << dst->i_blkbits);
+	return err;
+}
+
+// called when the last reference to an open file goes away
+// the last writer to close a file gives back the unwritten blocks that writeback preallocated past its end, a file
+// that is appended to all the time keeps getting new ones while it is open, and one that is done growing gets trimmed
+static int hollyfs_release(struct inode *inode, struct file *filp)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	handle_t *handle;
+
+	// i_writecount still counts this file while it is being released
+	if(!(filp->f_mode & FMODE_WRITE) || atomic_read(&inode->i_writecount) != 1 || !READ_ONCE(hfs_inode->speculative))
+		return 0;
+	inode_lock(inode);
+	if(!(hfs_inode->flags & HOLLYFS_INODE_PREALLOC) && !hollyfs_has_inline_data(inode))
+	{
+		handle = hollyfs_journal_start(inode->i_sb, hollyfs_truncate_credits(inode, DIV_ROUND_UP(i_size_read(inode), HOLLYFS_BLOCK_SIZE)), 1);
+		if(!IS_ERR(handle))
+		{
+			hollyfs_truncate_blocks(inode, DIV_ROUND_UP(i_size_read(inode), HOLLYFS_BLOCK_SIZE));
+			jbd2_journal_stop(handle);
+		}
+	}
+	WRITE_ONCE(hfs_inode->speculative, false);
+	inode_unlock(inode);
+	return 0;
+}
+
+// FITRIM, fstrim(8) asks for the free space in a byte range of the partition to be discarded in runs of at least minlen
+// bytes, the number of bytes that went to the device comes back in len
+static int hollyfs_ioctl_fitrim(struct super_block *sb, struct fstrim_range __user *argp)
+{
+	unsigned int fs_size = HOLLYFS_SB(sb)->sb_ondisk->fs_size;
+	struct fstrim_range range;
+	u64 start, end, minlen, trimmed = 0;
+	int err;
+
+	if(!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if(!bdev_max_discard_sectors(sb->s_bdev))
+		return -EOPNOTSUPP;
+	if(copy_from_user(&range, argp, sizeof(range)))
+		return -EFAULT;
+	start = range.start >> sb->s_blocksize_bits;
+	if(start >= fs_size)
+		return -EINVAL;
+	end = min_t(u64, fs_size, start + (range.len >> sb->s_blocksize_bits));
+	// the device throws away nothing smaller than its granularity anyway
+	minlen = max_t(u64, DIV_ROUND_UP(max_t(u64, range.minlen, bdev_discard_granularity(sb->s_bdev)), sb->s_blocksize), 1);
+	if(minlen > HOLLYFS_BLOCKS_PER_GROUP)
+		return -EINVAL;
+
+	err = hollyfs_trim_fs(sb, start, end, minlen, &trimmed);
+	range.len = trimmed << sb->s_blocksize_bits;
+	if(copy_to_user(argp, &range, sizeof(range)))
+		return -EFAULT;
+	return err;
+}
+
+// the ioctls of files and folders alike, fstrim(8) opens the mount point
+static long hollyfs_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	if(cmd == FITRIM)
+		return hollyfs_ioctl_fitrim(file_inode(filp)->i_sb, (struct fstrim_range __user *)arg);
+	return -ENOTTY;
+}
+
+// the file operations of regular files, reads and writes go through the page cache unless the file was opened with O_DIRECT
+const struct file_operations hollyfs_file_ops = {
+	.owner = THIS_MODULE,
+	.llseek = hollyfs_llseek,
+	.read_iter = hollyfs_file_read_iter,
+	.write_iter = hollyfs_file_write_iter,
+	.mmap = hollyfs_file_mmap,
+	.fsync = hollyfs_fsync,
+	.fallocate = hollyfs_fallocate,
+	.remap_file_range = hollyfs_remap_file_range,
+	.release = hollyfs_release,
+	.unlocked_ioctl = hollyfs_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+};
+
+// the inode operations of regular files
+static const struct inode_operations hollyfs_file_inode_ops = {
+	.setattr = hollyfs_setattr,
+	.fiemap = hollyfs_fiemap,
+};
+
+// reads the block that holds the directory record at byte offset pos and returns a pointer to the record
+// the caller has to brelse *bhp when done with the record
+static hollyfs_directory_record *hollyfs_dir_read_record(struct inode *dir, unsigned int pos, struct buffer_head **bhp)
+{
+	unsigned int phys, len;
+
+	*bhp = NULL;
+	if(hollyfs_lookup_extent(dir, pos >> dir->i_blkbits, &phys, &len, NULL) || !phys)
+		return NULL;
+	*bhp = hollyfs_bread(dir->i_sb, phys);
+	if(!*bhp)
+		return NULL;
+	return (hollyfs_directory_record *)((*bhp)->b_data + (pos & (dir->i_sb->s_blocksize - 1)));
+}
+
+// checks if a record holds exactly the name name[0..len)
+static inline bool hollyfs_record_matches(hollyfs_directory_record *rec, const char *name, unsigned int len)
+{
+	return rec->inode_no && rec->name_len == len && memcmp(rec->name, name, len) == 0;
+}
+
+// sanity checks the record at offset off of a directory block before anyone follows its rec_len,
+// a corrupted rec_len could otherwise walk us out of the block or around in circles forever
+static inline bool hollyfs_record_ok(struct inode *dir, hollyfs_directory_record *rec, unsigned int off)
+{
+	if(rec->rec_len >= HOLLYFS_DIR_REC_LEN(0) && (rec->rec_len & 3) == 0 && off + rec->rec_len <= dir->i_sb->s_blocksize && (!rec->inode_no || HOLLYFS_DIR_REC_LEN(rec->name_len) <= rec->rec_len))
+		return true;
+	printk("hollyfs: bad record at offset %u in a block of directory %lu\n", off, dir->i_ino);
+	return false;
+}
+
+// turns the file type stored in a record into the DT_ value readdir reports
+static inline unsigned char hollyfs_dt_type(unsigned int file_type)
+{
+	if(file_type == HOLLYFS_FILE_TYPE_DIR)
+		return DT_DIR;
+	if(file_type == HOLLYFS_FILE_TYPE_FILE)
+		return DT_REG;
+	return DT_UNKNOWN;
+}
+
+// reads record block lblk of a directory, the record blocks are file blocks 0 up to i_size
+static struct buffer_head *hollyfs_dir_bread(struct inode *dir, unsigned int lblk)
+{
+	unsigned int phys, len;
+
+	if(hollyfs_lookup_extent(dir, lblk, &phys, &len, NULL) || !phys)
+		return NULL;
+	return hollyfs_bread(dir->i_sb, phys);
+}
+
+// gives a directory a new zeroed block at file block iblock, used for hash index blocks
+static struct buffer_head *hollyfs_dir_new_block(struct inode *dir, unsigned int iblock)
+{
+	struct buffer_head *bh;
+	unsigned int phys;
+	int err;
+
+	err = hollyfs_alloc_extent_block(dir, iblock, &phys);
+	if(err)
+		return ERR_PTR(err);
+	bh = sb_getblk(dir->i_sb, phys);
+	if(!bh)
+		return ERR_PTR(-ENOMEM);
+	err = hollyfs_journal_get_create_access(bh);
+	if(err)
+	{
+		brelse(bh);
+		return ERR_PTR(err);
+	}
+	// there is nothing on disk worth reading for a block we just allocated
+	lock_buffer(bh);
+	memset(bh->b_data, 0, bh->b_size);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	hollyfs_journal_dirty(bh);
+	return bh;
+}
+
+// stores a record for name in a directory block that has room for it and returns its byte offset in *pos_out
+// a record in use can give away the space it has past its own name, a free record can be reused outright
+// the search starts at the block the last name went into, the blocks in front of it are full (removing a name
+// moves the start back to the block that got room), and when no block has room the directory grows by a block
+static int hollyfs_dir_add_record(struct inode *dir, const char *name, unsigned int len, unsigned int ino, unsigned int file_type, unsigned int *pos_out)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	unsigned int need = HOLLYFS_DIR_REC_LEN(len);
+	unsigned int nblocks = i_size_read(dir) >> dir->i_blkbits;
+	unsigned int lblk, off, used;
+	hollyfs_directory_record *rec, *split;
+	struct buffer_head *bh;
+
+	for(lblk = hfs_dir->dir_add_block < nblocks ? hfs_dir->dir_add_block : 0; lblk <= nblocks; lblk++)
+	{
+		if(lblk < nblocks)
+		{
+			bh = hollyfs_dir_bread(dir, lblk);
+			if(!bh)
+				return -EIO;
+		}
+		else
+		{
+			// every block is full, the record blocks have to stay clear of the hash index blocks
+			if(lblk >= HOLLYFS_DIR_INDEX_BASE)
+				return -ENOSPC;
+			bh = hollyfs_dir_new_block(dir, lblk);
+			if(IS_ERR(bh))
+				return PTR_ERR(bh);
+			// a new block starts out as one free record that covers all of it, the size goes into the
+			// same transaction so the block is never part of the directory without being initialized
+			rec = (hollyfs_directory_record *)bh->b_data;
+			rec->rec_len = dir->i_sb->s_blocksize;
+			i_size_write(dir, (loff_t)(lblk + 1) << dir->i_blkbits);
+			mark_inode_dirty(dir);
+		}
+		for(off = 0; off < dir->i_sb->s_blocksize; off += rec->rec_len)
+		{
+			rec = (hollyfs_directory_record *)(bh->b_data + off);
+			if(!hollyfs_record_ok(dir, rec, off))
+			{
+				brelse(bh);
+				return -EIO;
+			}
+			used = rec->inode_no ? HOLLYFS_DIR_REC_LEN(rec->name_len) : 0;
+			if(rec->rec_len - used < need)
+				continue;
+			// found room, the block is about to change
+			if(hollyfs_journal_get_write_access(bh))
+			{
+				brelse(bh);
+				return -EIO;
+			}
+			if(used)
+			{
+				// cut the slack off the end of this record and put the new record there
+				split = (hollyfs_directory_record *)((char *)rec + used);
+				split->rec_len = rec->rec_len - used;
+				rec->rec_len = used;
+				rec = split;
+				off += used;
+			}
+			rec->inode_no = ino;
+			rec->name_len = len;
+			rec->file_type = file_type;
+			memcpy(rec->name, name, len);
+			// here we are logging the directory block with the running transaction, it goes to disk when that commits
+			hollyfs_journal_dirty(bh);
+			brelse(bh);
+			hfs_dir->dir_add_block = lblk;
+			*pos_out = (lblk << dir->i_blkbits) + off;
+			return 0;
+		}
+		brelse(bh);
+	}
+	return -ENOSPC;
+}
+
+// reads hash index block k of a directory
+static struct buffer_head *hollyfs_dir_index_bread(struct inode *dir, unsigned int k)
+{
+	unsigned int phys, len;
+
+	if(hollyfs_lookup_extent(dir, HOLLYFS_DIR_INDEX_BASE + k, &phys, &len, NULL) || !phys)
+	{
+		printk("hollyfs: directory %lu is missing hash index block %u\n", dir->i_ino, k);
+		return NULL;
+	}
+	return hollyfs_bread(dir->i_sb, phys);
+}
+
+// how many times an index of count blocks has to double before the block that hash picks, which is ib and full,
+// has room, the slots of ib that go the same way at every split are the ones left in it, -1 when no split up to
+// HOLLYFS_DIR_INDEX_MAX_BLOCKS gets below full, those names can't be told apart by the index
+static int hollyfs_dir_index_splits(hollyfs_dir_index_block *ib, unsigned int hash, unsigned int count)
+{
+	unsigned int n = ib->slot_count, mask, i;
+	int splits = 0;
+
+	while(n >= HOLLYFS_INDEX_SLOTS_PER_BLOCK)
+	{
+		if(count * 2 > HOLLYFS_DIR_INDEX_MAX_BLOCKS)
+			return -1;
+		count *= 2;
+		mask = count - 1;
+		for(i = 0, n = 0; i < ib->slot_count; i++)
+		{
+			if((ib->slots[i].hash & mask) == (hash & mask))
+				n++;
+		}
+		splits++;
+	}
+	return splits;
+}
+
+// the credits splitting a hash index of old_count blocks takes: it rewrites every old index block, fills as many new
+// ones and allocates them (a bitmap block per group they come from, extent block, inode)
+static inline int hollyfs_dir_split_credits(struct super_block *sb, unsigned int old_count)
+{
+	return old_count * 2 + min(HOLLYFS_SB(sb)->sb_ondisk->group_count, old_count + 1) + 3;
+}
+
+// doubles the number of hash index blocks of a directory
+// index block k keeps the slots whose hash still points to k and hands the rest to block k + old_count,
+// only the hashes are needed for that so none of the records have to be read
+// every block is read or allocated before a slot moves, a split that fails leaves the index as it was, new blocks
+// that did get allocated stay mapped past the index and the next split takes them again
+// -ENOSPC when the split does not fit into the transaction or onto the disk
+static int hollyfs_dir_index_grow(struct inode *dir)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	unsigned int old_count = hfs_dir->dir_index_blocks;
+	unsigned int new_mask = old_count * 2 - 1;
+	handle_t *handle = journal_current_handle();
+	struct buffer_head **bhs, *bh;
+	hollyfs_dir_index_block *old_ib, *new_ib;
+	unsigned int k, i;
+	int credits, err = 0;
+
+	if(old_count * 2 > HOLLYFS_DIR_INDEX_MAX_BLOCKS)
+		return -ENOSPC;
+	// all of the split is in one transaction so the index is never seen half split, a create has its credits from
+	// the start (see hollyfs_dir_add_credits), only the first index of a directory that already has lots of names
+	// asks for them here, and jbd2 refuses when the running transaction can't hold that many anymore
+	credits = hollyfs_dir_split_credits(dir->i_sb, old_count);
+	if(credits > hollyfs_max_credits(dir->i_sb))
+		return -ENOSPC;
+	if(jbd2_handle_buffer_credits(handle) < credits)
+	{
+		err = jbd2_journal_extend(handle, credits, 0);
+		if(err)
+			return err < 0 ? err : -ENOSPC;
+	}
+
+	// the old blocks first, then the new ones, the running handle keeps this allocation from recursing into the fs
+	bhs = kvcalloc(old_count * 2, sizeof(*bhs), GFP_KERNEL);
+	if(!bhs)
+		return -ENOMEM;
+	for(k = 0; k < old_count; k++)
+	{
+		bhs[k] = hollyfs_dir_index_bread(dir, k);
+		if(!bhs[k])
+		{
+			err = -EIO;
+			goto out;
+		}
+		err = hollyfs_journal_get_write_access(bhs[k]);
+		if(err)
+			goto out;
+	}
+	for(k = 0; k < old_count; k++)
+	{
+		bh = hollyfs_dir_new_block(dir, HOLLYFS_DIR_INDEX_BASE + old_count + k);
+		if(IS_ERR(bh))
+		{
+			err = PTR_ERR(bh);
+			goto out;
+		}
+		bhs[old_count + k] = bh;
+	}
+
+	for(k = 0; k < old_count; k++)
+	{
+		old_ib = (hollyfs_dir_index_block *)bhs[k]->b_data;
+		new_ib = (hollyfs_dir_index_block *)bhs[old_count + k]->b_data;
+		// the names without a slot can be in either half
+		new_ib->flags = old_ib->flags;
+		// walk the old block and compact the slots that stay, moving the others out
+		for(i = 0; i < old_ib->slot_count; )
+		{
+			if((old_ib->slots[i].hash & new_mask) == k)
+			{
+				i++;
+				continue;
+			}
+			new_ib->slots[new_ib->slot_count++] = old_ib->slots[i];
+			old_ib->slots[i] = old_ib->slots[--old_ib->slot_count];
+		}
+		hollyfs_journal_dirty(bhs[k]);
+		hollyfs_journal_dirty(bhs[old_count + k]);
+	}
+	hfs_dir->dir_index_blocks = old_count * 2;
+	mark_inode_dirty(dir);
+out:
+	for(k = 0; k < old_count * 2; k++)
+		brelse(bhs[k]);
+	kvfree(bhs);
+	return err;
+}
+
+// adds the record at byte offset pos, whose name hashes to hash, to the hash index of dir
+// a name whose bucket is full and can't be split (see hollyfs_dir_index_splits and hollyfs_dir_index_grow) gets no
+// slot, its bucket is marked HOLLYFS_INDEX_OVERFLOW instead and lookups that miss there scan the records
+static int hollyfs_dir_index_add(struct inode *dir, unsigned int hash, unsigned int pos)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	struct buffer_head *bh;
+	hollyfs_dir_index_block *ib;
+	int err;
+
+	for(;;)
+	{
+		bh = hollyfs_dir_index_bread(dir, hash & (hfs_dir->dir_index_blocks - 1));
+		if(!bh)
+			return -EIO;
+		ib = (hollyfs_dir_index_block *)bh->b_data;
+		if(ib->slot_count < HOLLYFS_INDEX_SLOTS_PER_BLOCK)
+		{
+			err = hollyfs_journal_get_write_access(bh);
+			if(err)
+			{
+				brelse(bh);
+				return err;
+			}
+			break;
+		}
+		// this bucket is full, split every bucket and try again in the one the hash maps to now
+		if(hollyfs_dir_index_splits(ib, hash, hfs_dir->dir_index_blocks) >= 0)
+		{
+			err = hollyfs_dir_index_grow(dir);
+			if(err != -ENOSPC)
+			{
+				brelse(bh);
+				if(err)
+					return err;
+				continue;
+			}
+		}
+		err = hollyfs_journal_get_write_access(bh);
+		if(!err)
+		{
+			ib->flags |= HOLLYFS_INDEX_OVERFLOW;
+			err = hollyfs_journal_dirty(bh);
+		}
+		brelse(bh);
+		return err;
+	}
+	ib->slots[ib->slot_count].hash = hash;
+	ib->slots[ib->slot_count].pos = pos;
+	ib->slot_count++;
+	hollyfs_journal_dirty(bh);
+	brelse(bh);
+	return 0;
+}
+
+// the credits adding name to directory dir takes on top of HOLLYFS_CREATE_CREDITS: the splits its hash index needs
+// before the bucket of the name has room, a transaction that is already running may not be able to grow by that much
+// anymore, so they go into the handle when it starts (ext4 does the same for its htree splits)
+// the caller holds dir's i_rwsem, so the index stays as it is until the name goes in
+static int hollyfs_dir_add_credits(struct inode *dir, const struct qstr *name)
+{
+	unsigned int count = HOLLYFS_I(dir)->dir_index_blocks, hash;
+	int credits = 0, limit = hollyfs_max_credits(dir->i_sb) - HOLLYFS_RENAME_CREDITS, splits;
+	struct buffer_head *bh;
+
+	if(!count)
+		return 0;
+	hash = hollyfs_name_hash(name->name, name->len);
+	// the add runs into the read error itself
+	bh = hollyfs_dir_index_bread(dir, hash & (count - 1));
+	if(!bh)
+		return 0;
+	// a bucket that no split helps only gets marked, in the index block the create has credits for anyway, and so
+	// does one whose splits are more than a handle can have
+	splits = hollyfs_dir_index_splits((hollyfs_dir_index_block *)bh->b_data, hash, count);
+	for(; splits > 0 && credits + hollyfs_dir_split_credits(dir->i_sb, count) <= limit; splits--, count *= 2)
+		credits += hollyfs_dir_split_credits(dir->i_sb, count);
+	brelse(bh);
+	return credits;
+}
+
+// creates the first hash index block of a directory and indexes the records it already has,
+// this is how directories made before the index existed (or fresh from mkfs) get one
+static int hollyfs_dir_index_build(struct inode *dir)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	unsigned int nblocks = i_size_read(dir) >> dir->i_blkbits;
+	hollyfs_directory_record *rec;
+	struct buffer_head *bh;
+	unsigned int lblk, off;
+	int err;
+
+	bh = hollyfs_dir_new_block(dir, HOLLYFS_DIR_INDEX_BASE);
+	if(IS_ERR(bh))
+		return PTR_ERR(bh);
+	brelse(bh);
+	hfs_dir->dir_index_blocks = 1;
+	mark_inode_dirty(dir);
+
+	for(lblk = 0; lblk < nblocks; lblk++)
+	{
+		bh = hollyfs_dir_bread(dir, lblk);
+		if(!bh)
+			return -EIO;
+		for(off = 0; off < dir->i_sb->s_blocksize; off += rec->rec_len)
+		{
+			rec = (hollyfs_directory_record *)(bh->b_data + off);
+			if(!hollyfs_record_ok(dir, rec, off))
+			{
+				brelse(bh);
+				return -EIO;
+			}
+			if(!rec->inode_no)
+				continue;
+			err = hollyfs_dir_index_add(dir, hollyfs_name_hash(rec->name, rec->name_len), (lblk << dir->i_blkbits) + off);
+			if(err)
+			{
+				brelse(bh);
+				return err;
+			}
+		}
+		brelse(bh);
+	}
+	return 0;
+}
+
+// hollyfs_dir_find the slow way, reading every record block of the directory
+static int hollyfs_dir_scan(struct inode *dir, const char *name, unsigned int len, unsigned int *ino_out, unsigned int *pos_out)
+{
+	hollyfs_directory_record *rec;
+	struct buffer_head *rec_bh;
+	unsigned int i, off;
+	int err = -ENOENT;
+
+	for(i = 0; i < (i_size_read(dir) >> dir->i_blkbits) && err == -ENOENT; i++)
+	{
+		rec_bh = hollyfs_dir_bread(dir, i);
+		if(!rec_bh)
+			return -EIO;
+		for(off = 0; off < dir->i_sb->s_blocksize; off += rec->rec_len)
+		{
+			rec = (hollyfs_directory_record *)(rec_bh->b_data + off);
+			if(!hollyfs_record_ok(dir, rec, off))
+			{
+				err = -EIO;
+				break;
+			}
+			if(hollyfs_record_matches(rec, name, len))
+			{
+				*ino_out = rec->inode_no;
+				if(pos_out)
+					*pos_out = (i << dir->i_blkbits) + off;
+				err = 0;
+				break;
+			}
+		}
+		brelse(rec_bh);
+	}
+	return err;
+}
+
+// finds name in directory dir and puts its inode number in *ino_out and the byte offset of its record in *pos_out
+// (when asked for), -ENOENT if the name is not there
+// with the hash index this reads one index block plus the record block of each slot with the same hash, only a miss
+// in a block marked HOLLYFS_INDEX_OVERFLOW reads all of the directory
+static int hollyfs_dir_find(struct inode *dir, const char *name, unsigned int len, unsigned int *ino_out, unsigned int *pos_out)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	hollyfs_directory_record *rec;
+	struct buffer_head *bh, *rec_bh;
+	hollyfs_dir_index_block *ib;
+	unsigned int hash, i;
+	bool overflow;
+	int err = -ENOENT;
+
+	// not indexed yet, which also means it never had a name added since mkfs, so just scan it
+	if(!hfs_dir->dir_index_blocks)
+		return hollyfs_dir_scan(dir, name, len, ino_out, pos_out);
+
+	hash = hollyfs_name_hash(name, len);
+	bh = hollyfs_dir_index_bread(dir, hash & (hfs_dir->dir_index_blocks - 1));
+	if(!bh)
+		return -EIO;
+	ib = (hollyfs_dir_index_block *)bh->b_data;
+	for(i = 0; i < ib->slot_count && err == -ENOENT; i++)
+	{
+		// different names can share a hash, so the record itself has the final say
+		if(ib->slots[i].hash != hash)
+			continue;
+		rec = hollyfs_dir_read_record(dir, ib->slots[i].pos, &rec_bh);
+		if(!rec)
+		{
+			err = -EIO;
+			break;
+		}
+		if(hollyfs_record_matches(rec, name, len))
+		{
+			*ino_out = rec->inode_no;
+			if(pos_out)
+				*pos_out = ib->slots[i].pos;
+			err = 0;
+		}
+		brelse(rec_bh);
+	}
+	overflow = ib->flags & HOLLYFS_INDEX_OVERFLOW;
+	brelse(bh);
+	if(err == -ENOENT && overflow)
+		err = hollyfs_dir_scan(dir, name, len, ino_out, pos_out);
+	return err;
+}
+
+// takes the slot of the record at byte offset pos, whose name hashes to hash, out of the hash index of dir
+// the last slot of the block moves into its place so the slots stay packed at the front
+static int hollyfs_dir_index_remove(struct inode *dir, unsigned int hash, unsigned int pos)
+{
+	struct buffer_head *bh;
+	hollyfs_dir_index_block *ib;
+	unsigned int i;
+	int err;
+
+	bh = hollyfs_dir_index_bread(dir, hash & (HOLLYFS_I(dir)->dir_index_blocks - 1));
+	if(!bh)
+		return -EIO;
+	ib = (hollyfs_dir_index_block *)bh->b_data;
+	for(i = 0; i < ib->slot_count; i++)
+	{
+		if(ib->slots[i].hash == hash && ib->slots[i].pos == pos)
+			break;
+	}
+	if(i == ib->slot_count)
+	{
+		// a name in a bucket that overflowed may never have had a slot
+		err = (ib->flags & HOLLYFS_INDEX_OVERFLOW) ? 0 : -EIO;
+		if(err)
+			printk("hollyfs: directory %lu has no index slot for the record at %u\n", dir->i_ino, pos);
+		brelse(bh);
+		return err;
+	}
+	err = hollyfs_journal_get_write_access(bh);
+	if(!err)
+	{
+		ib->slots[i] = ib->slots[--ib->slot_count];
+		err = hollyfs_journal_dirty(bh);
+	}
+	brelse(bh);
+	return err;
+}
+
+// frees the record at byte offset pos of a directory, ext2 style: the record in front of it in the same block
+// takes over its space, and when it is the first one of its block it just becomes a free record
+// no other record moves, so the positions in the hash index stay right
+static int hollyfs_dir_remove_record(struct inode *dir, unsigned int pos)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	unsigned int lblk = pos >> dir->i_blkbits;
+	unsigned int target = pos & (dir->i_sb->s_blocksize - 1);
+	hollyfs_directory_record *rec, *prev = NULL;
+	struct buffer_head *bh;
+	unsigned int off;
+	int err;
+
+	bh = hollyfs_dir_bread(dir, lblk);
+	if(!bh)
+		return -EIO;
+	// the records only point forward, so walk up to ours to find the one in front of it
+	for(off = 0; off < target; off += rec->rec_len)
+	{
+		rec = (hollyfs_directory_record *)(bh->b_data + off);
+		if(!hollyfs_record_ok(dir, rec, off))
+		{
+			brelse(bh);
+			return -EIO;
+		}
+		prev = rec;
+	}
+	rec = (hollyfs_directory_record *)(bh->b_data + off);
+	if(off != target || !hollyfs_record_ok(dir, rec, off))
+	{
+		brelse(bh);
+		return -EIO;
+	}
+	err = hollyfs_journal_get_write_access(bh);
+	if(err)
+	{
+		brelse(bh);
+		return err;
+	}
+	if(prev)
+		prev->rec_len += rec->rec_len;
+	else
+		rec->inode_no = 0;
+	err = hollyfs_journal_dirty(bh);
+	brelse(bh);
+	// this block has room now, the next name that is added can go here
+	if(lblk < hfs_dir->dir_add_block)
+		hfs_dir->dir_add_block = lblk;
+	return err;
+}
+
+// starts reading directory blocks [from, to) into the buffer cache without waiting for them
+// the extent map gives whole runs of blocks at once, and under the plug the reads of a run merge into one request
+static void hollyfs_dir_readahead(struct inode *dir, unsigned int from, unsigned int to)
+{
+	struct blk_plug plug;
+	unsigned int phys, len, i;
+
+	blk_start_plug(&plug);
+	while(from < to)
+	{
+		if(hollyfs_lookup_extent(dir, from, &phys, &len, NULL) || !len)
+			break;
+		if(len > to - from)
+			len = to - from;
+		// in a hole len is the distance to the next extent, there is nothing to read until then
+		if(phys)
+		{
+			for(i = 0; i < len; i++)
+				sb_breadahead(dir->i_sb, phys + i);
+		}
+		from += len;
+	}
+	blk_finish_plug(&plug);
+}
+
+// this function is designed to read through the contents (files) of a directory
+// ctx->pos 0 and 1 are . and .., which have no records, and after them ctx->pos is the byte offset in the directory
+// of the next record to report plus HOLLYFS_DIR_POS_DOTS, so a getdents call whose buffer fills up part of the way
+// through picks up at exactly that record the next time, and the end of the directory is its i_size plus the dots,
+// the record blocks are file blocks 0 up to i_size
+static int hollyfs_read_dir(struct file *filp, struct dir_context *ctx)
+{
+	unsigned int off, lblk, nblocks, ra_end;
+	loff_t pos;
+	struct inode *inode;
+	struct hollyfs_inode_info *hfs_inode;
+	struct super_block *sb;
+	struct buffer_head *bh;
+	struct hollyfs_directory_record *cur_rec;
+
+	// here we are retrieving the inode that corresponds to the passed in file object
+	inode = file_inode(filp);
+	// super block is retrieved from the pointer to the super block that the inode of the passed in file possesses, since this is the only super block for a given partition 
+	sb = inode->i_sb;
+	// the vfs inode is embedded in our hollyfs_inode_info, so HOLLYFS_I gets us to the hollyfs specific part of it
+	hfs_inode = HOLLYFS_I(inode);
+	// when the inode is created, its cache entry contains the type of the inode, which corresponds to either a directory or a file
+	// since in this method we are iterating through the contents of a directory, if the inode is referring to an object of a type other that HOLLYFS_FILE_TYPE_DIR, it is not a directory
+	// thus we need to print a corresponding message to the log and return an error code
+	if(!(hfs_inode->type == HOLLYFS_FILE_TYPE_DIR))
+	{
+		printk("Not a directory!\n");
+		return -ENOTDIR;
+	}
+
+	// . and .. come first, dir_emit_dots moves ctx->pos past them
+	if(!dir_emit_dots(filp, ctx))
+		return 0;
+	nblocks = i_size_read(inode) >> sb->s_blocksize_bits;
+	ra_end = 0;
+	for(lblk = (ctx->pos - HOLLYFS_DIR_POS_DOTS) >> sb->s_blocksize_bits; lblk < nblocks; lblk++)
+	{
+		// once we are half way through the blocks that were read ahead, ask for the next ones, so a big directory
+		// streams in as a sequential read while we are busy with the blocks that are already there
+		if(lblk + HOLLYFS_DIR_READAHEAD / 2 >= ra_end)
+		{
+			off = max(ra_end, lblk + 1);
+			ra_end = min(lblk + HOLLYFS_DIR_READAHEAD, nblocks);
+			if(off < ra_end)
+				hollyfs_dir_readahead(inode, off, ra_end);
+		}
+		bh = hollyfs_dir_bread(inode, lblk);
+		if(!bh)
+			return -EIO;
+		// here we are walking over the records of the block, each record tells us how far away the next one is through rec_len
+		// the walk always starts at the beginning of the block, a position left over from a lseek or from before the block
+		// changed may not be the start of a record, so everything in front of it is skipped and reporting starts at the next record
+		for(off = 0; off < sb->s_blocksize; off += cur_rec->rec_len)
+		{
+			cur_rec = (struct hollyfs_directory_record *)(bh->b_data + off);
+			if(!hollyfs_record_ok(inode, cur_rec, off))
+			{
+				brelse(bh);
+				return -EIO;
+			}
+			// free records only hold space, and records in front of ctx->pos were reported already
+			pos = ((loff_t)lblk << sb->s_blocksize_bits) + off + HOLLYFS_DIR_POS_DOTS;
+			if(!cur_rec->inode_no || pos < ctx->pos)
+				continue;
+			// here the dir_emit function call is used to fill the ctx with the name of the current child (with its real length), its inode number
+			// and its type, so ls and friends can tell files from directories without a stat
+			// it says no when the user's buffer is full, ctx->pos still points at this record then and the next call starts with it
+			ctx->pos = pos;
+			if(!dir_emit(ctx, cur_rec->name, cur_rec->name_len, cur_rec->inode_no, hollyfs_dt_type(cur_rec->file_type)))
+			{
+				brelse(bh);
+				return 0;
+			}
+		}
+		// release the buffer head pointer, the block stays in the buffer cache for the next reader
+		brelse(bh);
+		// the whole block was reported, the ctx position is moved to the start of the next one
+		ctx->pos = ((loff_t)(lblk + 1) << sb->s_blocksize_bits) + HOLLYFS_DIR_POS_DOTS;
+	}
+	// at this point everything was executed 
+	return 0;
+}
+
+// the .iterate_shared of directories, times hollyfs_read_dir for the latency histogram and the hollyfs_readdir tracepoint
+static int hollyfs_iterate(struct file *filp, struct dir_context *ctx)
+{
+	struct inode *dir = file_inode(filp);
+	loff_t from = ctx->pos;
+	u64 start = ktime_get_ns(), ns;
+	int err;
+
+	err = hollyfs_read_dir(filp, ctx);
+	ns = hollyfs_stat_latency(HOLLYFS_SB(dir->i_sb), HOLLYFS_LAT_READDIR, start);
+	trace_hollyfs_readdir(dir, from, ctx->pos, err, ns);
+	return err;
+}
+
+// this struct assigns the special operations for the inodes that are directories, such as the root directory inode that is created in the 
+const struct file_operations hollyfs_dir_ops = {
+	.iterate_shared = hollyfs_iterate, // whenever the call to iterate operation is attempted, the hollyfs_iterate function call is triggered, imposing the custom way of iteration over inodes
+	// it only reads the directory, so several readers can list it at once with i_rwsem held shared
+	.llseek = generic_file_llseek,
+	.read = generic_read_dir, // reading a directory like a file fails with -EISDIR
+	.fsync = hollyfs_fsync, // writes the directory's record and index blocks, which are tied to its inode
+	.unlocked_ioctl = hollyfs_ioctl, // FITRIM is called on the mount point
+	.compat_ioctl = compat_ptr_ioctl,
+	.owner = THIS_MODULE, // setting the owner pointer to the current module so that the module is not unloaded while it is in use
+
+};
+
+// function declarations, the implementation of which follows below
+static int hollyfs_create(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode, bool x);
+struct dentry *hollyfs_lookup(struct inode *parent, struct dentry *child, unsigned int flags);
+static int hollyfs_mkdir(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode);
+static int hollyfs_unlink(struct inode *dir, struct dentry *dentry);
+static int hollyfs_rmdir(struct inode *dir, struct dentry *dentry);
+static int hollyfs_rename(struct user_namespace *mnt_userns, struct inode *old_dir, struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry, unsigned int flags);
+
+// this struct defines the operations on the hollyfs onodes
+static const struct inode_operations hollyfs_inode_ops = {
+	.create = hollyfs_create, // operation that is executed when attempting to create inode
+	.lookup = hollyfs_lookup, // operation that is executed when the lookup is attempted
+	.mkdir = hollyfs_mkdir, // operation that is executed when attempting to create a directory in hollyfs_type file system
+	.unlink = hollyfs_unlink, // removes the name of a file
+	.rmdir = hollyfs_rmdir, // removes an empty directory
+	.rename = hollyfs_rename, // moves a name, within a directory or to another one
+};
+
+// points an inode at the operations that go with its file type
+static void hollyfs_set_inode_ops(struct inode *inode)
+{
+	if(S_ISDIR(inode->i_mode))
+	{
+		inode->i_op = &hollyfs_inode_ops;
+		inode->i_fop = &hollyfs_dir_ops;
+	}
+	else
+	{
+		inode->i_op = &hollyfs_file_inode_ops;
+		inode->i_fop = &hollyfs_file_ops;
+		inode->i_mapping->a_ops = &hollyfs_aops;
+	}
+}
+
+// reads the inode table block that holds inode number ino and returns a pointer to the inode's slot inside it
+// the caller has to brelse *bhp when done with the inode
+static hollyfs_inode *hollyfs_get_raw_inode(struct super_block *sb, unsigned long ino, struct buffer_head **bhp)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	unsigned int ipg = sbi->sb_ondisk->inodes_per_group;
+	unsigned int idx;
+
+	*bhp = NULL;
+	// inode 0 is never used and every group's table only has room for so many inodes
+	if(ino == 0 || ino >= (unsigned long)sbi->sb_ondisk->group_count * ipg)
+	{
+		printk("hollyfs: bad inode number %lu\n", ino);
+		return NULL;
+	}
+	// the group tells which inode table, the slot inside that group which block of it
+	idx = ino % ipg;
+	*bhp = hollyfs_bread(sb, hollyfs_get_group_desc(sbi, ino / ipg, NULL)->inode_table_block + idx / HOLLYFS_INODES_PER_BLOCK);
+	if(!*bhp)
+		return NULL;
+	return (hollyfs_inode *)((*bhp)->b_data + (idx % HOLLYFS_INODES_PER_BLOCK) * HOLLYFS_INODE_SIZE);
+}
+
+// returns the in-memory inode for inode number ino, reading it from the inode table if it is not cached yet
+// iget_locked makes sure there is only ever one struct inode per inode number, so a name that is looked
+// up again after its dentry was evicted gets the same inode that is still being written back, and hot
+// inodes are served from the inode cache without touching the disk at all
+static struct inode *hollyfs_iget(struct super_block *sb, unsigned long ino)
+{
+	struct inode *inode;
+	struct buffer_head *bh;
+	hollyfs_inode *raw_inode;
+	struct hollyfs_inode_info *hfs_inode;
+
+	inode = iget_locked(sb, ino);
+	if(!inode)
+		return ERR_PTR(-ENOMEM);
+	// already in the inode cache, nothing to read
+	if(!(inode->i_state & I_NEW))
+		return inode;
+
+	raw_inode = hollyfs_get_raw_inode(sb, ino, &bh);
+	if(!raw_inode)
+	{
+		iget_failed(inode);
+		return ERR_PTR(-EIO);
+	}
+	// a slot whose inode was deleted is all zeroes, only a stale file handle can still point at it
+	if(!raw_inode->links_count || !raw_inode->mode)
+	{
+		brelse(bh);
+		iget_failed(inode);
+		return ERR_PTR(-ESTALE);
+	}
+	hfs_inode = HOLLYFS_I(inode);
+
+	// fill in the vfs inode from what was stored by write_inode
+	inode->i_mode = raw_inode->mode;
+	i_uid_write(inode, raw_inode->uid);
+	i_gid_write(inode, raw_inode->gid);
+	set_nlink(inode, raw_inode->links_count);
+	inode->i_size = raw_inode->file_size;
+	inode->i_atime.tv_sec = raw_inode->atime;
+	inode->i_mtime.tv_sec = raw_inode->mtime;
+	inode->i_ctime.tv_sec = raw_inode->ctime;
+	inode->i_atime.tv_nsec = inode->i_mtime.tv_nsec = inode->i_ctime.tv_nsec = 0;
+	// and the hollyfs specific part, which is mostly the extent map
+	hfs_inode->type = raw_inode->type;
+	hfs_inode->dir_child_count = raw_inode->dir_child_count;
+	hfs_inode->dir_index_blocks = raw_inode->dir_index_blocks;
+	hfs_inode->extent_count = raw_inode->extent_count;
+	hfs_inode->extent_block = raw_inode->extent_block;
+	hfs_inode->flags = raw_inode->flags;
+	// the extents or the inline data, whichever the flags say this is
+	memcpy(hfs_inode->inline_data, raw_inode->inline_data, sizeof(hfs_inode->inline_data));
+	brelse(bh);
+
+	// i_blocks is not stored, it follows from the extent map (plus the indirect extent block)
+	hollyfs_count_blocks(inode);
+	hollyfs_set_inode_ops(inode);
+
+	unlock_new_inode(inode);
+	return inode;
+}
+
+// gives inode table block block its first contents, all zeroes, there is nothing on disk worth reading
+static int hollyfs_zero_inode_block(struct super_block *sb, unsigned int block)
+{
+	struct buffer_head *bh;
+	int err;
+
+	bh = sb_getblk(sb, block);
+	if(!bh)
+		return -ENOMEM;
+	err = hollyfs_journal_get_create_access(bh);
+	if(!err)
+	{
+		lock_buffer(bh);
+		memset(bh->b_data, 0, bh->b_size);
+		set_buffer_uptodate(bh);
+		unlock_buffer(bh);
+		err = hollyfs_journal_dirty(bh);
+	}
+	brelse(bh);
+	return err;
+}
+
+// takes the first slot off the free inode list of group g and puts its number in *ino_out, -ENOSPC when there is none
+static int hollyfs_reuse_ino(struct super_block *sb, unsigned int g, unsigned int *ino_out)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	unsigned int ipg = sbi->sb_ondisk->inodes_per_group;
+	struct buffer_head *gdt_bh, *bh;
+	hollyfs_group_desc *gd;
+	hollyfs_inode *raw_inode;
+	unsigned int ino;
+	int err = -ENOSPC;
+
+	mutex_lock(&sbi->reclaim_lock);
+	gd = hollyfs_get_group_desc(sbi, g, &gdt_bh);
+	ino = gd->free_inode_head;
+	if(!gd->free_inodes || !ino)
+		goto out;
+	// only a slot the group handed out before can be on its list, a list that says otherwise is left alone
+	// and the group goes on handing out new slots
+	if(ino / ipg != g || ino % ipg >= gd->inodes_used)
+	{
+		printk("hollyfs: free inode list of group %u is corrupted\n", g);
+		goto out;
+	}
+	raw_inode = hollyfs_get_raw_inode(sb, ino, &bh);
+	if(!raw_inode)
+	{
+		err = -EIO;
+		goto out;
+	}
+	// both blocks are ones the create logs anyway, the group descriptor and the new inode's table block
+	err = hollyfs_journal_get_write_access(gdt_bh);
+	if(!err)
+		err = hollyfs_journal_get_write_access(bh);
+	if(!err)
+	{
+		gd->free_inode_head = raw_inode->next_ino;
+		gd->free_inodes--;
+		raw_inode->next_ino = 0;
+		hollyfs_journal_dirty(bh);
+		hollyfs_journal_dirty(gdt_bh);
+		*ino_out = ino;
+	}
+	brelse(bh);
+out:
+	mutex_unlock(&sbi->reclaim_lock);
+	return err;
+}
+
+// gives the numbers [next, end) that a cpu reserved in one inode table block but never handed out back to their group,
+// numbers at the end of what the group reserved just are not reserved anymore, the others go on its free inode list
+// (their slots are still zero), the caller holds a handle, this logs the group descriptor and that table block
+static int hollyfs_unreserve_inos(struct super_block *sb, unsigned int next, unsigned int end)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	unsigned int ipg = sbi->sb_ondisk->inodes_per_group, base = next / ipg * ipg, ino;
+	struct buffer_head *gdt_bh, *bh;
+	hollyfs_group_desc *gd;
+	hollyfs_inode *raw_inode;
+	int err;
+
+	gd = hollyfs_get_group_desc(sbi, next / ipg, &gdt_bh);
+	err = hollyfs_journal_get_write_access(gdt_bh);
+	if(err)
+		return err;
+	spin_lock(&sbi->ino_lock);
+	if(gd->inodes_used == end - base)
+	{
+		gd->inodes_used = next - base;
+		end = next;
+	}
+	spin_unlock(&sbi->ino_lock);
+	mutex_lock(&sbi->reclaim_lock);
+	for(ino = next; ino < end && !err; ino++)
+	{
+		raw_inode = hollyfs_get_raw_inode(sb, ino, &bh);
+		if(!raw_inode)
+		{
+			err = -EIO;
+			break;
+		}
+		err = hollyfs_journal_get_write_access(bh);
+		if(!err)
+		{
+			raw_inode->next_ino = gd->free_inode_head;
+			gd->free_inode_head = ino;
+			gd->free_inodes++;
+			hollyfs_journal_dirty(bh);
+		}
+		brelse(bh);
+	}
+	mutex_unlock(&sbi->reclaim_lock);
+	hollyfs_journal_dirty(gdt_bh);
+	return err;
+}
+
+// hands out a new inode number in *ino_out for a file that goes into directory dir
+// every cpu keeps a batch of reserved numbers and takes from it without any lock, only when its batch runs out
+// does it reserve the rest of an inode table block, in dir's group if that one still has free slots and
+// otherwise in the next group that does, so the files of a directory end up near it and near each other
+// inodes_used in the group descriptor is how many slots were reserved so far and is logged with the create that
+// reserved them, so after a crash no number can come out twice, the numbers a batch still has at unmount (or that
+// a cpu could not take, see below) go back to the group (hollyfs_unreserve_inos)
+// slots of deleted inodes go on their group's free inode list and are taken from there before a new batch is reserved
+static int hollyfs_new_ino(struct super_block *sb, struct inode *dir, unsigned int *ino_out)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	hollyfs_superblock *sb_ondisk = sbi->sb_ondisk;
+	unsigned int ipg = sb_ondisk->inodes_per_group;
+	struct hollyfs_ino_batch *batch;
+	struct buffer_head *gdt_bh;
+	hollyfs_group_desc *gd;
+	unsigned int g, n, used, end;
+	bool skipped;
+	int err;
+
+	batch = get_cpu_ptr(sbi->ino_batch);
+	if(batch->next < batch->end)
+	{
+		*ino_out = batch->next++;
+		put_cpu_ptr(sbi->ino_batch);
+		return 0;
+	}
+	put_cpu_ptr(sbi->ino_batch);
+
+	// this cpu ran dry
+	g = dir->i_ino / ipg;
+	for(n = 0; n < sb_ondisk->group_count; n++, g = (g + 1) % sb_ondisk->group_count)
+	{
+		gd = hollyfs_get_group_desc(sbi, g, &gdt_bh);
+		// reusing freed slots keeps the inode tables of a file system that sees many deletes from growing
+		if(READ_ONCE(gd->free_inodes))
+		{
+			err = hollyfs_reuse_ino(sb, g, ino_out);
+			if(err != -ENOSPC)
+				return err;
+		}
+		if(READ_ONCE(gd->inodes_used) >= ipg)
+			continue;
+		// the group descriptor is about to change so the journal has to know first, that may sleep so it can't be under the lock
+		err = hollyfs_journal_get_write_access(gdt_bh);
+		if(err)
+			return err;
+		spin_lock(&sbi->ino_lock);
+		used = gd->inodes_used;
+		if(used >= ipg)
+		{
+			// another cpu took the last slots while we were waiting for the journal
+			spin_unlock(&sbi->ino_lock);
+			continue;
+		}
+		end = min_t(unsigned int, (used / HOLLYFS_INO_BATCH + 1) * HOLLYFS_INO_BATCH, ipg);
+		gd->inodes_used = end;
+		spin_unlock(&sbi->ino_lock);
+		hollyfs_journal_dirty(gdt_bh);
+
+		// mkfs leaves the inode tables as they were on the disk, a block nobody took slots from before is zeroed now,
+		// in the same transaction that reserves it, it is the block the new inode goes into so it costs no extra credit
+		if(used % HOLLYFS_INODES_PER_BLOCK == 0)
+		{
+			err = hollyfs_zero_inode_block(sb, gd->inode_table_block + used / HOLLYFS_INODES_PER_BLOCK);
+			if(err)
+				return err;
+		}
+
+		// the first number is ours, the rest goes to the cpu we run on now, unless that one got a batch of
+		// its own in the meantime (we can move between cpus while the journal sleeps), then the rest goes back
+		*ino_out = g * ipg + used;
+		batch = get_cpu_ptr(sbi->ino_batch);
+		skipped = batch->next < batch->end;
+		if(!skipped)
+		{
+			batch->next = g * ipg + used + 1;
+			batch->end = g * ipg + end;
+		}
+		put_cpu_ptr(sbi->ino_batch);
+		if(skipped && used + 1 < end)
+			return hollyfs_unreserve_inos(sb, g * ipg + used + 1, g * ipg + end);
+		return 0;
+	}
+	// every inode table is full
+	return -ENOSPC;
+}
+
+// puts an inode whose last name just went away on the front of the orphan list, in the running transaction,
+// so its blocks and its slot get freed even when the system goes down before the last user closes it
+static int hollyfs_orphan_add(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct hollyfs_orphan *orphan;
+	hollyfs_inode *raw_inode;
+	struct buffer_head *bh;
+	int err;
+
+	if(HOLLYFS_I(inode)->orphan)
+		return 0;
+	raw_inode = hollyfs_get_raw_inode(sb, inode->i_ino, &bh);
+	if(!raw_inode)
+		return -EIO;
+	// it is tiny, and an inode that is not on the list would keep its blocks for good
+	orphan = kmalloc(sizeof(*orphan), GFP_NOFS | __GFP_NOFAIL);
+	orphan->ino = inode->i_ino;
+	INIT_LIST_HEAD(&orphan->reclaim);
+
+	mutex_lock(&sbi->reclaim_lock);
+	err = hollyfs_journal_get_write_access(sbi->sb_bh);
+	if(!err)
+		err = hollyfs_journal_get_write_access(bh);
+	if(err)
+	{
+		mutex_unlock(&sbi->reclaim_lock);
+		kfree(orphan);
+		brelse(bh);
+		return err;
+	}
+	// update_inode never touches next_ino, so the inode can still be written while it is on the list
+	raw_inode->next_ino = sbi->sb_ondisk->orphan_head;
+	sbi->sb_ondisk->orphan_head = inode->i_ino;
+	hollyfs_journal_dirty(bh);
+	hollyfs_journal_dirty(sbi->sb_bh);
+	list_add(&orphan->list, &sbi->orphans);
+	mutex_unlock(&sbi->reclaim_lock);
+	brelse(bh);
+	HOLLYFS_I(inode)->orphan = orphan;
+	return 0;
+}
+
+// takes an orphan off the orphan list on disk, the inode in front of it (or the superblock when it is the first one)
+// gets to point at the one after it, the caller holds reclaim_lock and drops it from orphans once everything worked
+static int hollyfs_orphan_del(struct super_block *sb, struct hollyfs_orphan *orphan)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct hollyfs_orphan *prev;
+	hollyfs_inode *raw_prev;
+	struct buffer_head *bh;
+	unsigned int next = 0;
+	int err;
+
+	if(!list_is_last(&orphan->list, &sbi->orphans))
+		next = list_next_entry(orphan, list)->ino;
+	if(list_is_first(&orphan->list, &sbi->orphans))
+	{
+		err = hollyfs_journal_get_write_access(sbi->sb_bh);
+		if(err)
+			return err;
+		sbi->sb_ondisk->orphan_head = next;
+		return hollyfs_journal_dirty(sbi->sb_bh);
+	}
+	prev = list_prev_entry(orphan, list);
+	raw_prev = hollyfs_get_raw_inode(sb, prev->ino, &bh);
+	if(!raw_prev)
+		return -EIO;
+	err = hollyfs_journal_get_write_access(bh);
+	if(!err)
+	{
+		raw_prev->next_ino = next;
+		err = hollyfs_journal_dirty(bh);
+	}
+	brelse(bh);
+	return err;
+}
+
+// zeroes the slot of a deleted inode, which lives in bh, and puts it on the front of its group's free inode list
+static int hollyfs_free_ino(struct super_block *sb, unsigned int ino, hollyfs_inode *raw_inode, struct buffer_head *bh)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct buffer_head *gdt_bh;
+	hollyfs_group_desc *gd;
+	int err;
+
+	gd = hollyfs_get_group_desc(sbi, ino / sbi->sb_ondisk->inodes_per_group, &gdt_bh);
+	err = hollyfs_journal_get_write_access(gdt_bh);
+	if(!err)
+		err = hollyfs_journal_get_write_access(bh);
+	if(err)
+		return err;
+	memset(raw_inode, 0, HOLLYFS_INODE_SIZE);
+	raw_inode->next_ino = gd->free_inode_head;
+	gd->free_inode_head = ino;
+	gd->free_inodes++;
+	hollyfs_journal_dirty(bh);
+	return hollyfs_journal_dirty(gdt_bh);
+}
+
+// extent number idx of an inode as it is stored in the inode table, ind_bh holds its extent block
+static inline hollyfs_extent *hollyfs_raw_extent(hollyfs_inode *raw_inode, struct buffer_head *ind_bh, unsigned int idx)
+{
+	if(idx < HOLLYFS_INODE_EXTENTS)
+		return &raw_inode->extents[idx];
+	return (hollyfs_extent *)ind_bh->b_data + idx - HOLLYFS_INODE_EXTENTS;
+}
+
+// frees everything an evicted orphan still has: the blocks of its extents, its extent block and at last its slot
+// the extent map is read from the inode table, dirty_inode kept it up to date there until the inode was evicted
+// the caller's handle is made big enough for this inode first, as far as one handle can be, the extents go from the
+// last one on and when the handle runs out of credits the inode in the table is cut down to the ones that are left
+// before the handle is restarted, a crash in between finds those there and the orphan entry still on the list
+static int hollyfs_reclaim_inode(struct super_block *sb, struct hollyfs_orphan *orphan)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct buffer_head *bh, *ind_bh = NULL, *ext_bh;
+	handle_t *handle = journal_current_handle();
+	hollyfs_inode *raw_inode;
+	hollyfs_extent *e;
+	unsigned int count, i, b, len, n;
+	int credits, revokes, err;
+	bool is_dir, shared;
+
+	raw_inode = hollyfs_get_raw_inode(sb, orphan->ino, &bh);
+	if(!raw_inode)
+		return -EIO;
+	count = 0;
+	if(!(raw_inode->flags & HOLLYFS_INODE_INLINE_DATA))
+	{
+		count = min_t(unsigned int, raw_inode->extent_count, HOLLYFS_MAX_EXTENTS);
+		if(raw_inode->extent_block)
+		{
+			ind_bh = hollyfs_bread(sb, raw_inode->extent_block);
+			if(!ind_bh)
+			{
+				brelse(bh);
+				return -EIO;
+			}
+		}
+		else
+		{
+			count = min_t(unsigned int, count, HOLLYFS_INODE_EXTENTS);
+		}
+	}
+
+	// the blocks of a directory are metadata that went through the journal, every one of them is revoked so a replay
+	// can't write old records over whatever the block holds next, for a file only the extent block needs that
+	is_dir = raw_inode->type == HOLLYFS_FILE_TYPE_DIR;
+	// blocks shared with other files only lose a reference, in the refcount table blocks their counts are in
+	shared = raw_inode->flags & HOLLYFS_INODE_SHARED;
+	// what giving back every extent takes (see hollyfs_free_credits) on top of the blocks every inode touches
+	credits = HOLLYFS_RECLAIM_CREDITS;
+	revokes = 1;
+	for(i = 0; i < count; i++)
+	{
+		e = hollyfs_raw_extent(raw_inode, ind_bh, i);
+		credits += hollyfs_free_credits(sb, e->start_block, hollyfs_ext_len(e), shared);
+		if(is_dir)
+			revokes += hollyfs_ext_len(e);
+	}
+	credits = min(credits, hollyfs_max_credits(sb));
+	revokes = min(revokes, HOLLYFS_RECLAIM_REVOKES);
+	err = jbd2_journal_extend(handle, credits, revokes);
+	if(err > 0)
+		err = jbd2__journal_restart(handle, credits, revokes, GFP_NOFS);
+	if(err)
+		goto out;
+
+	while(count)
+	{
+		e = hollyfs_raw_extent(raw_inode, ind_bh, count - 1);
+		len = hollyfs_ext_len(e);
+		n = hollyfs_free_fits(sb, e->start_block, len, shared, jbd2_handle_buffer_credits(handle) - HOLLYFS_RECLAIM_CREDITS);
+		// the extent block has a revoke of its own
+		if(is_dir)
+			n = min_t(unsigned int, n, max(handle->h_revoke_credits - 1, 0));
+		hollyfs_free_blocks(sb, e->start_block + len - n, n);
+		for(b = len - n; is_dir && b < len; b++)
+			hollyfs_journal_revoke(e->start_block + b, NULL);
+		if(n == len)
+		{
+			count--;
+			continue;
+		}
+		ext_bh = count - 1 < HOLLYFS_INODE_EXTENTS ? bh : ind_bh;
+		err = hollyfs_journal_get_write_access(bh);
+		if(!err && ext_bh != bh)
+			err = hollyfs_journal_get_write_access(ext_bh);
+		if(err)
+			goto out;
+		e->length = (len - n) | (e->length & HOLLYFS_EXTENT_UNWRITTEN);
+		raw_inode->extent_count = count;
+		hollyfs_journal_dirty(bh);
+		if(ext_bh != bh)
+			hollyfs_journal_dirty(ext_bh);
+		err = jbd2__journal_restart(handle, credits, revokes, GFP_NOFS);
+		if(err)
+			goto out;
+	}
+	if(ind_bh)
+	{
+		hollyfs_free_blocks(sb, raw_inode->extent_block, 1);
+		hollyfs_journal_revoke(raw_inode->extent_block, ind_bh);
+		ind_bh = NULL;
+	}
+
+	mutex_lock(&sbi->reclaim_lock);
+	err = hollyfs_orphan_del(sb, orphan);
+	if(!err)
+		err = hollyfs_free_ino(sb, orphan->ino, raw_inode, bh);
+	if(!err)
+		list_del(&orphan->list);
+	mutex_unlock(&sbi->reclaim_lock);
+out:
+	brelse(ind_bh);
+	brelse(bh);
+	return err;
+}
+
+// the reclaim worker, evicting a deleted inode only queues it, so an rm -rf of a big tree returns as soon as the names
+// are gone and the blocks come back here in bulk: every inode that is queued by the time the worker gets to it shares
+// one handle, which keeps growing until its transaction is full or wants to commit, so the bitmap blocks, inode table
+// blocks and group descriptors that many deletes have in common are logged once per transaction
+static void hollyfs_reclaim_work(struct work_struct *work)
+{
+	struct hollyfs_sb_info *sbi = container_of(work, struct hollyfs_sb_info, reclaim_work);
+	struct hollyfs_orphan *orphan;
+	handle_t *handle;
+	int err;
+
+	// every inode extends the handle by what it needs
+	handle = hollyfs_journal_start(sbi->sb, HOLLYFS_INODE_CREDITS, 0);
+	if(IS_ERR(handle))
+	{
+		printk("hollyfs: could not start freeing deleted inodes, error %ld\n", PTR_ERR(handle));
+		return;
+	}
+	for(;;)
+	{
+		mutex_lock(&sbi->reclaim_lock);
+		orphan = list_first_entry_or_null(&sbi->reclaim_queue, struct hollyfs_orphan, reclaim);
+		if(orphan)
+			list_del_init(&orphan->reclaim);
+		mutex_unlock(&sbi->reclaim_lock);
+		if(!orphan)
+			break;
+		err = hollyfs_reclaim_inode(sbi->sb, orphan);
+		// a handle whose restart failed is gone, the inodes that are still queued wait for the next run of the worker
+		if(err && is_handle_aborted(handle))
+		{
+			printk("hollyfs: could not free deleted inode %u, error %d, stopping\n", orphan->ino, err);
+			break;
+		}
+		if(err)
+		{
+			// it stays on the orphan list, the next mount tries again
+			printk("hollyfs: could not free deleted inode %u, error %d\n", orphan->ino, err);
+			continue;
+		}
+		kfree(orphan);
+	}
+	jbd2_journal_stop(handle);
+}
+
+// reads the orphan list at mount time, what is on it was deleted while still open (or right before a crash)
+// and nobody can have it open now, so all of it goes to the reclaim worker once the mount is done
+// a read-only mount reads the list as well, so the list in memory matches the one on disk, but nothing is freed
+// until the file system is mounted (or remounted) read-write
+static int hollyfs_orphan_recover(struct super_block *sb)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	hollyfs_superblock *sb_ondisk = sbi->sb_ondisk;
+	unsigned long long n = 0, max = (unsigned long long)sb_ondisk->group_count * sb_ondisk->inodes_per_group;
+	struct hollyfs_orphan *orphan;
+	hollyfs_inode *raw_inode;
+	struct buffer_head *bh;
+	unsigned int ino;
+
+	ino = sb_ondisk->orphan_head;
+	while(ino)
+	{
+		// a corrupted list could go around in circles
+		if(++n > max)
+		{
+			printk("hollyfs: the orphan list goes around in circles\n");
+			return -EIO;
+		}
+		raw_inode = hollyfs_get_raw_inode(sb, ino, &bh);
+		if(!raw_inode)
+			return -EIO;
+		orphan = kmalloc(sizeof(*orphan), GFP_KERNEL);
+		if(!orphan)
+		{
+			brelse(bh);
+			return -ENOMEM;
+		}
+		orphan->ino = ino;
+		list_add_tail(&orphan->list, &sbi->orphans);
+		list_add_tail(&orphan->reclaim, &sbi->reclaim_queue);
+		ino = raw_inode->next_ino;
+		brelse(bh);
+	}
+	if(n)
+		printk("hollyfs: freeing %llu deleted inodes\n", n);
+	return 0;
+}
+
+// puts a name for inode into directory dir: a record in a block with room for it and a slot in the hash index
+// the caller holds dir's i_rwsem and a journal handle
+static int hollyfs_dir_link(struct inode *dir, const struct qstr *name, struct inode *inode)
+{
+	// the parent directory was loaded through hollyfs_iget, so its hollyfs part is already in memory and nothing has to be read
+	struct hollyfs_inode_info *parent_dir_inode = HOLLYFS_I(dir);
+	unsigned int pos; // byte offset of the new record inside the directory
+	int err;
+
+	// make sure the directory has a hash index before the new name goes in, so lookup can find it
+	if(!parent_dir_inode->dir_index_blocks)
+	{
+		err = hollyfs_dir_index_build(dir);
+		if(err)
+			return err;
+	}
+	// here we are storing the child's name, its inode number and its type in a record in the directory's blocks
+	// the record takes only as much space as the name needs, pos tells us where it ended up
+	err = hollyfs_dir_add_record(dir, name->name, name->len, inode->i_ino, HOLLYFS_I(inode)->type, &pos);
+	if(err)
+		return err;
+	parent_dir_inode->dir_child_count++; // we change the parent directory's inode, namely we increment the number of its children
+	// add the new record to the directory's hash index so lookup finds it with a single index block read
+	err = hollyfs_dir_index_add(dir, hollyfs_name_hash(name->name, name->len), pos);
+	if(err)
+	{
+		// a name that is not in the index can never be looked up or removed again, so the record goes as well
+		if(hollyfs_dir_remove_record(dir, pos))
+			printk("hollyfs: could not take back the record of %s in directory %lu\n", name->name, dir->i_ino);
+		parent_dir_inode->dir_child_count--;
+		return err;
+	}
+	// the directory changed, dirty_inode logs the new child count in its inode table slot
+	dir->i_mtime = dir->i_ctime = current_time(dir);
+	mark_inode_dirty(dir);
+	return 0;
+}
+
+// takes a name out of directory dir: its slot out of the hash index and its record out of its block
+// the caller holds dir's i_rwsem and a journal handle
+static int hollyfs_dir_unlink(struct inode *dir, const struct qstr *name)
+{
+	struct hollyfs_inode_info *hfs_dir = HOLLYFS_I(dir);
+	unsigned int ino, pos;
+	int err;
+
+	err = hollyfs_dir_find(dir, name->name, name->len, &ino, &pos);
+	if(err)
+		return err;
+	if(hfs_dir->dir_index_blocks)
+	{
+		err = hollyfs_dir_index_remove(dir, hollyfs_name_hash(name->name, name->len), pos);
+		if(err)
+			return err;
+	}
+	err = hollyfs_dir_remove_record(dir, pos);
+	if(err)
+		return err;
+	if(hfs_dir->dir_child_count)
+		hfs_dir->dir_child_count--;
+	dir->i_mtime = dir->i_ctime = current_time(dir);
+	mark_inode_dirty(dir);
+	return 0;
+}
+
+// points the name name in directory dir, which is there already, at inode instead, the record keeps its place and
+// its slot in the hash index, so this needs no room and the name never goes missing in between
+// the caller holds dir's i_rwsem and a journal handle
+static int hollyfs_dir_relink(struct inode *dir, const struct qstr *name, struct inode *inode)
+{
+	hollyfs_directory_record *rec;
+	struct buffer_head *bh;
+	unsigned int ino, pos;
+	int err;
+
+	err = hollyfs_dir_find(dir, name->name, name->len, &ino, &pos);
+	if(err)
+		return err;
+	rec = hollyfs_dir_read_record(dir, pos, &bh);
+	if(!rec)
+	{
+		brelse(bh);
+		return -EIO;
+	}
+	err = hollyfs_journal_get_write_access(bh);
+	if(!err)
+	{
+		rec->inode_no = inode->i_ino;
+		rec->file_type = HOLLYFS_I(inode)->type;
+		err = hollyfs_journal_dirty(bh);
+	}
+	brelse(bh);
+	if(err)
+		return err;
+	dir->i_mtime = dir->i_ctime = current_time(dir);
+	mark_inode_dirty(dir);
+	return 0;
+}
+
+// takes a link away from an inode whose name was just removed, a directory loses both of its links at once
+// when the last one is gone the inode goes on the orphan list, evicting it frees it later
+static int hollyfs_drop_link(struct inode *inode)
+{
+	inode->i_ctime = current_time(inode);
+	if(S_ISDIR(inode->i_mode))
+		clear_nlink(inode);
+	else
+		drop_nlink(inode);
+	mark_inode_dirty(inode);
+	if(inode->i_nlink)
+		return 0;
+	return hollyfs_orphan_add(inode);
+}
+
+// this function implements the code for the creation of a new inode at a given directory, for files and folders alike
+static int hollyfs_make_node(struct inode *dir, struct dentry *dentry, umode_t mode)
+{
+	struct super_block *sb; // this is the pointer to the super block for holly file system partition
+	struct hollyfs_inode_info *hfs_inode; // the hollyfs part of the new inode, it comes with the vfs inode from alloc_inode
+	// setting up the required variables and pointers that we need to create a new inode
+	struct inode *inode;
+	unsigned int ino; // the number of the new inode, which is also its slot in the inode table
+	handle_t *handle; // the journal handle, everything this create changes on disk commits as one
+	hollyfs_inode *raw_inode; // the new inode's slot, only needed to give the number back when the create fails
+	struct buffer_head *bh;
+	int err, err2;
+
+	// retieving the super block pointer from the super block that was assigned to the current directory inode
+	sb = dir->i_sb;
+
+	// the vfs holds dir's i_rwsem while we are in here, that is the per-directory lock that keeps two creates from
+	// racing for the same record slot or index bucket, the inode number and the blocks come from lock-free per-cpu
+	// and atomic bitmap allocators, so creates in different directories don't wait on each other at all
+	// from here on every metadata block we change is logged in one journal transaction,
+	// a crash either loses the whole create or replays the whole create
+	handle = hollyfs_journal_start(sb, HOLLYFS_CREATE_CREDITS + hollyfs_dir_add_credits(dir, &dentry->d_name), 0);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	// with -o sync or -o dirsync (or chattr +D on the directory) the new name has to be on disk before we return,
+	// a sync handle makes jbd2_journal_stop wait for the commit
+	if(IS_DIRSYNC(dir))
+		handle->h_sync = 1;
+
+	// new_inode goes through our alloc_inode, so this also gets us a zeroed hollyfs_inode_info with an empty extent map
+	inode = new_inode(sb); // new inode yay
+	if(!inode)
+	{
+		err = -ENOMEM;
+		goto out_stop;
+	}
+	inode->i_sb = sb; // since the new inode is in the same directory, it is obviously in the same partition wit hthe same file system, so it has the same super block
+	// we set the current directory's inode to be the owner of the newly created file's inode, so the hierarchy of files and folders is preserved
+	inode_init_owner(&init_user_ns, inode, dir, mode);
+	// regular files get the page cache based file operations, their blocks are only allocated once they outgrow their inline data
+	hollyfs_set_inode_ops(inode);
+	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode); // since the inode was just created, set up its access, modification and change time to the current time
+	// get a fresh inode number from this cpu's batch, this fails once every inode table is full
+	err = hollyfs_new_ino(sb, dir, &ino);
+	if(err)
+		goto out_iput;
+	// prit out the log about the inode number that we are currently creating, with the debug mount option only
+	hollyfs_debug(sb, "This will be inode number %u!\n", ino);
+	inode->i_ino = ino;
+	hfs_inode = HOLLYFS_I(inode);
+	if(S_ISDIR(mode))
+	{
+		hfs_inode->type = HOLLYFS_FILE_TYPE_DIR;
+		// a folder has two links, its name in the parent and its own "." (which is not stored, just counted)
+		inc_nlink(inode);
+	}
+	else
+	{
+		hfs_inode->type = HOLLYFS_FILE_TYPE_FILE; // setting the file type to correspond to file rather than directory
+		// a new file starts out inline, as long as it stays small its contents live in its inode and it never needs a data block
+		hfs_inode->flags = HOLLYFS_INODE_INLINE_DATA;
+	}
+	// here we print out the name of the file and its corresponding inode number, this is the inode that we just created
+	hollyfs_debug(sb, "Creating new %s!  name: %s  inode: %lu\n", S_ISDIR(mode) ? "folder" : "file", dentry->d_name.name, inode->i_ino);
+
+	// the name goes into the parent directory's records and hash index
+	err = hollyfs_dir_link(dir, &dentry->d_name, inode);
+	if(err)
+		goto out_free_ino;
+	// the ".." of the new folder is one more link to its parent
+	if(S_ISDIR(mode))
+	{
+		inc_nlink(dir);
+		mark_inode_dirty(dir);
+	}
+	// hash the inode so iget finds it, and mark it dirty so dirty_inode logs it into its inode table slot
+	insert_inode_hash(inode);
+	mark_inode_dirty(inode);
+	// lookup already left a negative dentry for this name, now it gets to point at the new inode
+	d_instantiate(dentry, inode);
+	// closing the handle lets the transaction commit, which happens in the background unless the handle is sync
+	// returning zero to signify the successful completion of this function
+	return jbd2_journal_stop(handle);
+
+out_free_ino:
+	// the slot is counted in inodes_used already and was never written, without going on its group's free list
+	// nobody would ever hand it out again, its table block and the group descriptor are in the credits anyway
+	raw_inode = hollyfs_get_raw_inode(sb, ino, &bh);
+	if(raw_inode)
+	{
+		mutex_lock(&HOLLYFS_SB(sb)->reclaim_lock);
+		if(hollyfs_free_ino(sb, ino, raw_inode, bh))
+			printk("hollyfs: could not give back inode number %u\n", ino);
+		mutex_unlock(&HOLLYFS_SB(sb)->reclaim_lock);
+		brelse(bh);
+	}
+out_iput:
+	iput(inode);
+out_stop:
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
+}
+
+// create and mkdir go through here, it times hollyfs_make_node for the latency histogram and the hollyfs_create tracepoint
+static int hollyfs_new_node(struct inode *dir, struct dentry *dentry, umode_t mode)
+{
+	u64 start = ktime_get_ns(), ns;
+	int err;
+
+	err = hollyfs_make_node(dir, dentry, mode);
+	ns = hollyfs_stat_latency(HOLLYFS_SB(dir->i_sb), HOLLYFS_LAT_CREATE, start);
+	trace_hollyfs_create(dir, dentry, mode, err ? 0 : d_inode(dentry)->i_ino, err, ns);
+	return err;
+}
+
+// the .create operation of hollyfs_inode_ops, makes a new regular file
+static int hollyfs_create(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode, bool x)
+{
+	return hollyfs_new_node(dir, dentry, mode);
+}
+
+// this function is executed upon the lookup operation to find the inode that a name in the parent directory refers to
+// the name is found through the directory's hash index and its inode is read from disk (or taken from the inode cache)
+// a name that is not there gets a negative dentry, so looking it up again is answered by the dcache without any disk reads
+struct dentry *hollyfs_lookup(struct inode *parent, struct dentry *child, unsigned int flags)
+{
+	struct inode *inode = NULL;
+	unsigned int ino = 0;
+	u64 start = ktime_get_ns(), ns;
+	int err;
+
+	hollyfs_debug(parent->i_sb, "HollyFS lookup called!\n");
+	// name_len of a record is a single byte
+	if(child->d_name.len > HOLLYFS_FILENAME_MAX)
+		return ERR_PTR(-ENAMETOOLONG);
 
-// this function is designed to read through the contents (files) of a directory 
-static int hollyfs_iterate(struct file *filp, struct dir_context *ctx)
+	err = hollyfs_dir_find(parent, child->d_name.name, child->d_name.len, &ino, NULL);
+	if(err == 0)
+	{
+		inode = hollyfs_iget(parent->i_sb, ino);
+		if(IS_ERR(inode))
+			err = PTR_ERR(inode);
+	}
+	// a miss is timed too, negative lookups are most of what a create does before it creates
+	ns = hollyfs_stat_latency(HOLLYFS_SB(parent->i_sb), HOLLYFS_LAT_LOOKUP, start);
+	trace_hollyfs_lookup(parent, child, err ? 0 : ino, err, ns);
+	if(err == -ENOENT)
+		inode = NULL;
+	else if(err)
+		return ERR_PTR(err);
+	// with inode == NULL this adds a negative dentry
+	return d_splice_alias(inode, child);
+}
+
+// this function is called when the attempt to create a directory for an inode is made, its is referenced by as a custom .mkdir operation for hollyfs_inode_ops
+// a new folder is empty, it gets its first record block and its hash index when the first name goes into it
+static int hollyfs_mkdir(struct user_namespace *mnt_userns, struct inode *dir, struct dentry *dentry, umode_t mode)
 {
-	int i;
-	struct inode *inode;
-	hollyfs_inode *hfs_inode;
-	struct super_block *sb;
-	struct buffer_head *bh;
-	struct hollyfs_directory_record *cur_rec;
+	// just printing a message to the log, signifying that the operation was called, with the debug mount option only
+	hollyfs_debug(dir->i_sb, "Creating directory!\n");
+	return hollyfs_new_node(dir, dentry, mode | S_IFDIR);
+}
+
+// removes the name of a file, the vfs has made sure it is there and is not a folder
+// the blocks are not freed here, only when the file is not open anymore and its inode is evicted, and then in the background
+static int hollyfs_unlink(struct inode *dir, struct dentry *dentry)
+{
+	handle_t *handle;
+	int err, err2;
+
+	handle = hollyfs_journal_start(dir->i_sb, HOLLYFS_UNLINK_CREDITS, 0);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	if(IS_DIRSYNC(dir))
+		handle->h_sync = 1;
+	err = hollyfs_dir_unlink(dir, &dentry->d_name);
+	if(!err)
+		err = hollyfs_drop_link(d_inode(dentry));
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
+}
+
+// removes an empty folder, the vfs holds the folder's i_rwsem too so no name can go into it meanwhile
+static int hollyfs_rmdir(struct inode *dir, struct dentry *dentry)
+{
+	struct inode *inode = d_inode(dentry);
+	handle_t *handle;
+	int err, err2;
 
-	if(ctx->pos)
+	// checking for emptiness is left to the file system, the child count goes up and down with every name in the folder
+	if(HOLLYFS_I(inode)->dir_child_count)
+		return -ENOTEMPTY;
+	handle = hollyfs_journal_start(dir->i_sb, HOLLYFS_UNLINK_CREDITS, 0);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	if(IS_DIRSYNC(dir))
+		handle->h_sync = 1;
+	err = hollyfs_dir_unlink(dir, &dentry->d_name);
+	if(!err)
 	{
-		return 0;
+		err = hollyfs_drop_link(inode);
+		// the ".." of the folder that is gone
+		drop_nlink(dir);
+		mark_inode_dirty(dir);
 	}
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
+}
 
-	// here we are retrieving the inode that corresponds to the passed in file object
-	inode = filp->f_inode;
-	// super block is retrieved from the pointer to the super block that the inode of the passed in file possesses, since this is the only super block for a given partition 
-	sb = inode->i_sb;
-	// when the inode is created, its i_private member is set to its reference in the inode cache, thus in order to acquire the pointer to the cache entry for the given inode, we can just retrieve the correctly casted i_private property of the inode
-	hfs_inode = (hollyfs_inode *)inode->i_private;
-	// when the inode is created, its cache entry contains the type of the inode, which corresponds to either a directory or a file
-	// since in this method we are iterating through the contents of a directory, if the inode is referring to an object of a type other that HOLLYFS_FILE_TYPE_DIR, it is not a directory
-	// thus we need to print a corresponding message to the log and return an error code
-	if(!(hfs_inode->type == HOLLYFS_FILE_TYPE_DIR))
+// moves a name, to another name in the same folder or into another folder, replacing what new_dentry names
+// the vfs holds the locks of both folders and of both inodes, and has checked that a folder only replaces a folder
+// the new name goes in before the old one goes out, all in one transaction, so a crash never loses the file
+// there are no ".." records, so moving a folder only moves its link from the old parent to the new one
+static int hollyfs_rename(struct user_namespace *mnt_userns, struct inode *old_dir, struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry, unsigned int flags)
+{
+	struct inode *inode = d_inode(old_dentry);
+	struct inode *target = d_inode(new_dentry);
+	handle_t *handle;
+	int err, err2;
+
+	// RENAME_EXCHANGE and RENAME_WHITEOUT are not supported, the vfs has already handled RENAME_NOREPLACE
+	if(flags & ~RENAME_NOREPLACE)
+		return -EINVAL;
+	if(target && S_ISDIR(target->i_mode) && HOLLYFS_I(target)->dir_child_count)
+		return -ENOTEMPTY;
+
+	handle = hollyfs_journal_start(old_dir->i_sb, HOLLYFS_RENAME_CREDITS + (target ? 0 : hollyfs_dir_add_credits(new_dir, &new_dentry->d_name)), 0);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	if(IS_DIRSYNC(old_dir) || IS_DIRSYNC(new_dir))
+		handle->h_sync = 1;
+
+	// a name that is there already just points at inode from now on, that needs no room, so the target can't lose
+	// its name to a new one that then finds no space
+	if(target)
+		err = hollyfs_dir_relink(new_dir, &new_dentry->d_name, inode);
+	else
+		err = hollyfs_dir_link(new_dir, &new_dentry->d_name, inode);
+	if(err)
+		goto out_stop;
+	err = hollyfs_dir_unlink(old_dir, &old_dentry->d_name);
+	if(err)
+		goto out_stop;
+	// whatever the new name stood for has lost that name, which can have been its last one
+	if(target)
 	{
-		printk("Not a directory!\n");
-		return -ENOTDIR;
+		err = hollyfs_drop_link(target);
+		if(err)
+			goto out_stop;
+		if(S_ISDIR(target->i_mode))
+			drop_nlink(new_dir);
 	}
-	// when the inode is created, the chache entry for that inode, which is referred to by hfs_inode in this case, has the position of the data block for that particular inode on the disk stored in the data_block_num property
-	bh = sb_bread(sb, hfs_inode->data_block_num); 
-	// here we are reading the data stored in the data block that corresponds to the given inode
-	// the data in the retrieved data block contains the contents of the given directory inode, as is set up and edited every time a new inode in a given directory is created
-	cur_rec = (struct hollyfs_directory_record *)bh->b_data;
-	// here we are iterating over all of the children of a given directory, the number of which is stored in the dir_child_count property of hfs_inode
-	for(i = 0; i < hfs_inode->dir_child_count; i++)
-	{
-		// here the dir_emit function call is used to fill the ctx at a current position with the data of a given size, namely the filename of the current child and its inode number
-		dir_emit(ctx, cur_rec->filename, HOLLYFS_FILENAME_MAX, cur_rec->inode_no, DT_UNKNOWN);
-		// the ctx position pointer is incremented to move the pointer by the size of the child file description size hollyfs_directory_record, moving to the spot that is next to be filled with the data from the next child
-		ctx->pos += sizeof(hollyfs_directory_record);
-		// increment the index of the data on the disk that points to the directory contents, which essentially moves the pointer to the next child's data in the current directory's context data block
-		cur_rec++; // pointer arithmetic
-	}
-	// release the buffer head pointer so that there is no more reference to it and it will not get corruped, since we do not need the reference to the current directory's content's data block any more
-	brelse(bh);
-	// at this point everything was executed 
-	return 0;
+	if(S_ISDIR(inode->i_mode) && old_dir != new_dir)
+	{
+		drop_nlink(old_dir);
+		inc_nlink(new_dir);
+		mark_inode_dirty(old_dir);
+	}
+	// dir_link and dir_unlink logged the folders, the nlink changes above have to go in as well
+	mark_inode_dirty(new_dir);
+	inode->i_ctime = current_time(inode);
+	mark_inode_dirty(inode);
 
+out_stop:
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
 }
 
-// this struct assigns the special operations for the inodes that are directories, such as the root directory inode that is created in the 
-const struct file_operations hollyfs_dir_ops = {
-	.iterate = hollyfs_iterate, // whenever the call to iterate operation is attempted, the hollyfs_iterate function call is triggered, imposing the custom way of iteration over inodes
-	.owner = THIS_MODULE, // setting the owner pointer to the current module so that the module is not unloaded while it is in use
-
-};
+// the function that is being called when .alloc_inode operation of our custom super block is executed
+// the vfs inode comes embedded in a hollyfs_inode_info from our inode cache
+static struct inode *hollyfs_alloc_inode(struct super_block *sb)
+{
+	struct hollyfs_inode_info *hfs_inode;
 
-// function declarations, the implementation of which follows below
-static int hollyfs_create(struct inode *dir, struct dentry *dentry, umode_t mode, bool x);
-struct dentry *hollyfs_lookup(struct inode *parent, struct dentry *child, unsigned int flags);
-static int hollyfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode);
+	hfs_inode = alloc_inode_sb(sb, hollyfs_inode_cache, GFP_KERNEL);
+	if(!hfs_inode)
+		return NULL;
+	// the vfs part was set up once by the cache constructor, the hollyfs part has to start out empty every time
+	memset(hfs_inode, 0, offsetof(struct hollyfs_inode_info, vfs_inode));
+	init_rwsem(&hfs_inode->extent_sem);
+	return &hfs_inode->vfs_inode;
+}
 
-// this struct defines the operations on the hollyfs onodes
-static const struct inode_operations hollyfs_inode_ops = {
-	.create = hollyfs_create, // operation that is executed when attempting to create inode
-	.lookup = hollyfs_lookup, // operation that is executed when the lookup is attempted
-	.mkdir = hollyfs_mkdir, // operation that is executed when attempting to create a directory in hollyfs_type file system
-};
+// the function that is being called when .free_inode operation of our custom super block is executed,
+// the vfs calls it after an rcu grace period so nobody can still be looking at the inode
+static void hollyfs_free_inode(struct inode *inode)
+{
+	kmem_cache_free(hollyfs_inode_cache, HOLLYFS_I(inode));
+}
 
-// this function implements the code for the creation of a new inode at a given directory
-static int hollyfs_create(struct inode *dir, struct dentry *dentry, umode_t mode, bool x)
+// releases the superblock, group descriptor and bitmap buffers held by sbi and frees it, used by put_super and by a failed mount
+static void hollyfs_put_sb_info(struct hollyfs_sb_info *sbi)
 {
-	struct super_block *sb; // this is the pointer to the super block for holly file system partition
-	hollyfs_superblock *sb_ondisk; // this is the pointer to the super block data stored on disk
-  	hollyfs_inode *hfs_inode; // pointer to the new inode's reference in the cache 
-	hollyfs_inode *parent_dir_inode; // pointer to the inode of the parent directory, as we need the information about the directory in which we are creating a new inode
-	hollyfs_inode *parent_dir_inode_ondisk; // pointer to the data for the parent directory inode stored on disk
-	hollyfs_directory_record *dir_contents_datablock; // pointer to the data on the disk that is referred to by the directory inode
-	// setting up the required variables and pointers that we need to create a new inode
-	struct inode *inode;
-	struct buffer_head *bh;
-	uint64_t count; // variable to store the number of inodes currently present in our file system
-	int i; // counter that will be used to iterate through the data block map to find a free data block to refer our new inode to
+	struct hollyfs_orphan *orphan, *tmp;
+	unsigned int i;
 
-	// retieving the super block pointer from the super block that was assigned to the current directory inode
-	sb = dir->i_sb;
-	inode = new_inode(sb); // new inode yay
-	inode->i_sb = sb; // since the new inode is in the same directory, it is obviously in the same partition wit hthe same file system, so it has the same super block
-	inode->i_op = &hollyfs_inode_ops; // point the operations to the hollyfs_inode_ops, so when operations are executed on the newly created inode, the definitiona from hollyfs_inode_ops struct are used
-	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode); // since the inode was just created, set up its access, modification and change time to the current time
-	sb_ondisk = (hollyfs_superblock *)sb->s_fs_info; // getting the pointer to the super block data on disk that is pointed to by the s_fs_info member of the super block struct
-	count = (uint64_t)(sb_ondisk->inode_count); // get the current number of inodes from the super block data that is stored on the disk
-	// prit out the log about the count of the inode that we are currently creating
-	printk("There are %llu inodes, this will be inode number %llu!\n", count, count+1);
-	count++; // increment the counter of the number of inodes, since we have just created a new one
-	inode->i_ino = count; // the id number of the newly created inode is its number in the list of inodes that is kept track of by the super block
-	sb_ondisk->inode_count = count; // update the super block data on the disk to account for the new inode, increasing the number of inodes counting variable of the super block data
-	// here we are allocating a spot in the hollyfs_inode_cache to store the newly created node's reference in the cache
-	hfs_inode = kmem_cache_alloc(hollyfs_inode_cache, GFP_KERNEL);
-	inode->i_private = hfs_inode; // we are storing the reference to the corresponding spot in the cache in the newly created inode's i_private variable
-	hfs_inode->inode_num = count; // we set the count number, which is the id of our new inode, to the property of the cached inode, so that there is a reference to what inode in the memory this particulat cached inode refers to
-	hfs_inode->type = HOLLYFS_FILE_TYPE_FILE; // setting the file type to correspond to file rather than directory
-	// here we print out the name of the file and its corresponding inode number, this is the inode that we just created
-	printk("Creating new file!  name: %s  inode: %d\n", dentry->d_name.name, hfs_inode->inode_num);
-	hfs_inode->file_size = 1; // setting up the file size in the cached inode reference to 1
+	// first, so nobody reads the statistics while they go away, this waits for the readers that are in there already
+	debugfs_remove(sbi->debugfs_dir);
+	// destroying the journal commits what is left and checkpoints everything to its home blocks
+	if(sbi->journal)
+		jbd2_journal_destroy(sbi->journal);
+	percpu_counter_destroy(&sbi->free_blocks);
+	percpu_counter_destroy(&sbi->dirty_blocks);
+	free_percpu(sbi->ino_batch);
+	free_percpu(sbi->stats);
+	// orphans that could not be freed stay on the list on disk for the next mount
+	list_for_each_entry_safe(orphan, tmp, &sbi->orphans, list)
+		kfree(orphan);
+	// brelse is fine with NULL, so this also works when the mount failed half way through reading the bitmaps
+	if(sbi->groups)
+	{
+		for(i = 0; i < sbi->sb_ondisk->group_count; i++)
+			brelse(sbi->groups[i].bitmap_bh);
+		kvfree(sbi->groups);
+	}
+	if(sbi->gdt_bh)
+	{
+		for(i = 0; i < sbi->sb_ondisk->gdt_blocks; i++)
+			brelse(sbi->gdt_bh[i]);
+		kfree(sbi->gdt_bh);
+	}
+	brelse(sbi->sb_bh);
+	kfree(sbi);
+}
 
-	// here we are using the previously initialized variable i to cycle through the block map stored in the super block's data
-	// since the values in the block map correspond to the availability of the data blocks, we stop the loop once we find an unoccupied data block
-	// we mark the adta block reference in the block map as occupied, since that is where we are going to store the file data
-	for(i = 0; i < HOLLYFS_DATA_BLOCK_COUNT; i++){
-		if(sb_ondisk->block_map[i] == 0)
-		{
-			sb_ondisk->block_map[i] = 1;
+// copies the free block counts of the groups into the group descriptors and their sum into the superblock and logs them
+// they change with every allocation, keeping them in those buffers would put them into every transaction
+// and make every cpu fight over them, so they live in memory and the disk gets a copy at sync and unmount only
+// after a crash mount counts the free blocks in the bitmaps again, so a stale copy does no harm
+static int hollyfs_commit_super(struct super_block *sb)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	hollyfs_superblock *sb_ondisk = sbi->sb_ondisk;
+	struct buffer_head *gdt_bh;
+	hollyfs_group_desc *gd;
+	handle_t *handle;
+	unsigned int g;
+	int err, err2;
+
+	handle = hollyfs_journal_start(sb, sb_ondisk->gdt_blocks + 1, 0);
+	if(IS_ERR(handle))
+		return PTR_ERR(handle);
+	err = hollyfs_journal_get_write_access(sbi->sb_bh);
+	if(!err)
+	{
+		sb_ondisk->free_block_count = percpu_counter_sum_positive(&sbi->free_blocks);
+		err = hollyfs_journal_dirty(sbi->sb_bh);
+	}
+	for(g = 0; g < sb_ondisk->group_count && !err; g++)
+	{
+		gd = hollyfs_get_group_desc(sbi, g, &gdt_bh);
+		// every descriptor block is asked for once, when its first descriptor comes up, and logged after its last one
+		if(g % HOLLYFS_GROUP_DESCS_PER_BLOCK == 0)
+			err = hollyfs_journal_get_write_access(gdt_bh);
+		if(err)
 			break;
-		}
+		gd->free_block_count = max(atomic_read(&sbi->groups[g].free_blocks), 0);
+		if(g % HOLLYFS_GROUP_DESCS_PER_BLOCK == HOLLYFS_GROUP_DESCS_PER_BLOCK - 1 || g == sb_ondisk->group_count - 1)
+			err = hollyfs_journal_dirty(gdt_bh);
 	}
-	// here we need to add the HOLLYFS_DATA_BLOCK_BASE to the variable i, since the piece fo memory that is devoted to blocks does not start at the very first memory location
-	// but rather it starts at the location HOLLYFS_DATA_BLOCK_BASE, from which we need to go i more locations in order to reach the unoccupied data block that we previously found
-	hfs_inode->data_block_num = i + HOLLYFS_DATA_BLOCK_BASE;
-	// in the fill_sb function we stored the reference to the inode data on the disk into the i_private member of the hollyfs_inode struct, so directories have the reference to their inode data in i_private
-	parent_dir_inode = (hollyfs_inode *)dir->i_private;
-	parent_dir_inode->dir_child_count++; // we change the parent directory's inode data on disk, namely we increment the number of child files, since we have just created an inode for the new file in this directory
-	bh = sb_bread(sb, parent_dir_inode->data_block_num); // here we are retrieving the pointer to the data block that belongs to the current directory's contents to which we are adding a new file
-	dir_contents_datablock = (hollyfs_directory_record *)bh->b_data; // here weare retrieving the current directory's content's data
-	// careful not overright existing records
-	dir_contents_datablock+=(parent_dir_inode->dir_child_count - 1); // here we moving the location to which we need to write the new file's data by the number that is parent_dir_inode->dir_child_count - 1 away from the current directory content's location, 
-	//since we are adding the parent_dir_inode->dir_child_count - 1 th child's information relative to the first child's information that is already in the directory's content
-	// also, we need to copy the name of the file to the 
-	strcpy(dir_contents_datablock->filename, dentry->d_name.name); // we need to store new child's name, which we copy from the passed in denty as a string
-	dir_contents_datablock->inode_no = hfs_inode->inode_num; // also, we need to store new child's number, as it is referenced in the cache
-
-	// here we are marking current buffer head dirty, in order to update the data on the disk
-	// this is required because at this point the contents of the currenty directory on the disk are not the same as the one's we have just updated, thus since there is a data discrepancy between what we have edited and what is on disk, the data block that stores the current directory's contents is dirty
-	mark_buffer_dirty(bh);
-	// sync_dirty_buffer function essentially synchronizes the current data in bh with the data on the disk, so essentially we are writing the information that we added to the contents of the current directory to the corresponding data block on disk, pointed by bh
-	sync_dirty_buffer(bh);
-	// release the buffer head pointer so that there is no more reference to it and it will not get corruped, since we do not need the reference to the current directory's content's data block on disk
-	brelse(bh);
-	// here we are retrieving the reference to the inode of the current directory on disk, which is at the spot parent_dir_inode->inode_num from the point where the memory devoted to inodes starts, so from HOLLYFS_INODE_BLOCK_BASE
-	bh = sb_bread(sb, parent_dir_inode->inode_num + HOLLYFS_INODE_BLOCK_BASE);
-	parent_dir_inode_ondisk = (hollyfs_inode *)bh->b_data; // here we are retrieving the data that correspond's to current directory's inode from the disk
-	parent_dir_inode_ondisk->dir_child_count = parent_dir_inode->dir_child_count; // now we are updating the number of children that current directory's inode keeps track of, since we have just added a new file to the directory and to the memory, thus we have to update the directory's inode's information 
-
-	mark_buffer_dirty(bh); // similar to the directory's content's data block, the inode data on the disk was just updated, thus it no longer corresponds to what is right not on the disk at that particular memory location, so the memory spot is dirty
-	sync_dirty_buffer(bh); // here we are synchronizing the data, so we are writing the newly updated inode data to the corresponding point on the disk
-	brelse(bh); // once again, we are releasing the reference to the current directory's inode on the dist from the variable bh, so that we do not mess it up accidentaly later on and so that we have finished working with it
-	// we set the current directory's inode to be the owner of the newly created file's inode, so the hierarchy of files and folders is preserved
-	inode_init_owner(inode, dir, mode);
-	d_add(dentry, inode); // now we just need to insert the newly created inode into the dentry so that the .lookup operation can look up the new node in the parent directory
-	// returning zero to signify the successful completion of this function
+	err2 = jbd2_journal_stop(handle);
+	return err ? err : err2;
+}
+
+// gives the numbers every cpu still has in its batch back to their groups, at unmount and before a remount read-only,
+// so they are not lost for good, nobody creates anything anymore by then
+static void hollyfs_release_inos(struct super_block *sb)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	struct hollyfs_ino_batch *batch;
+	handle_t *handle;
+	int cpu, err;
+
+	for_each_possible_cpu(cpu)
+	{
+		batch = per_cpu_ptr(sbi->ino_batch, cpu);
+		if(batch->next >= batch->end)
+			continue;
+		// the group descriptor block and the batch's inode table block
+		handle = hollyfs_journal_start(sb, 2, 0);
+		if(IS_ERR(handle))
+			return;
+		err = hollyfs_unreserve_inos(sb, batch->next, batch->end);
+		jbd2_journal_stop(handle);
+		if(err)
+			printk("hollyfs: could not give back inode numbers %u-%u, error %d\n", batch->next, batch->end - 1, err);
+		batch->next = batch->end;
+	}
+}
+
+// implementation of the .put_super operation for the super block of our custom file system
+static void hollyfs_put_super(struct super_block *sb)
+{
+	// the s_fs_info pointer of the super block contains our private super block info
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	// the log is printed out when this method is run, with the debug mount option only
+	hollyfs_debug(sb, "Holly FS put super called!\n");
+	// the inodes were all evicted by now, the deleted ones among them get freed before the counters are written
+	flush_work(&sbi->reclaim_work);
+	// a background discard that has not run yet is skipped, the next FITRIM picks up what it would have done
+	cancel_delayed_work_sync(&sbi->discard_work);
+	// the counters that only live in memory go into the superblock one last time
+	if(!sb_rdonly(sb))
+	{
+		hollyfs_release_inos(sb);
+		hollyfs_commit_super(sb);
+	}
+	// shut the journal down and drop the buffers that were pinned for the whole mount
+	hollyfs_put_sb_info(sbi);
+	sb->s_fs_info = NULL;
+}
+
+// the inode slots that were never handed out plus the freed ones on the groups' free lists
+// deleted inodes count as used until the reclaim worker got to them
+static u64 hollyfs_count_free_inodes(struct hollyfs_sb_info *sbi)
+{
+	hollyfs_group_desc *gd;
+	unsigned int g;
+	u64 n = 0;
+
+	for(g = 0; g < sbi->sb_ondisk->group_count; g++)
+	{
+		gd = hollyfs_get_group_desc(sbi, g, NULL);
+		n += sbi->sb_ondisk->inodes_per_group - READ_ONCE(gd->inodes_used) + READ_ONCE(gd->free_inodes);
+	}
+	return n;
+}
+
+// df and statfs(2), the free block count is the in-memory one and the free inodes come from the group descriptors
+static int hollyfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct super_block *sb = dentry->d_sb;
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	hollyfs_superblock *sb_ondisk = sbi->sb_ondisk;
+
+	buf->f_type = HOLLYFS_MAGIC_NUM;
+	buf->f_bsize = sb->s_blocksize;
+	buf->f_blocks = sb_ondisk->fs_size;
+	// blocks that buffered writes reserved are as good as gone, even before writeback allocates them
+	buf->f_bfree = buf->f_bavail = max_t(s64, percpu_counter_sum_positive(&sbi->free_blocks) - percpu_counter_sum_positive(&sbi->dirty_blocks), 0);
+	buf->f_files = (u64)sb_ondisk->group_count * sb_ondisk->inodes_per_group;
+	buf->f_ffree = hollyfs_count_free_inodes(sbi);
+	buf->f_namelen = HOLLYFS_FILENAME_MAX;
+	buf->f_fsid = u64_to_fsid(huge_encode_dev(sb->s_bdev->bd_dev));
 	return 0;
 }
 
-// this function is executed upon the lookup operation to retrieve the dentry of the parent directory in order to look up a file
-struct dentry *hollyfs_lookup(struct inode *parent, struct dentry *child, unsigned int flags)
+// adds up one counter of the statistics over every cpu, off is where it is in struct hollyfs_stats
+static u64 hollyfs_stat_sum(struct hollyfs_sb_info *sbi, size_t off)
 {
-	// here we just simulate functionality, so we simply print out a look up message to the log and return null
-	printk("HollyFS lookup called!\n");
-	return NULL;
-};
+	u64 sum = 0;
+	int cpu;
 
-// this function is called when the attempt to create a directory for an inode is made, its is referenced by as a custom .mkdir operation for hollyfs_inode_ops
-static int hollyfs_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((char *)per_cpu_ptr(sbi->stats, cpu) + off);
+	return sum;
+}
+#define HOLLYFS_STAT(sbi, name) hollyfs_stat_sum(sbi, offsetof(struct hollyfs_stats, name))
+
+// debugfs stats: the counters, and the free space and inodes as the allocator sees them right now
+static int hollyfs_stats_show(struct seq_file *m, void *v)
 {
-	// just printing a message to the log, signifying that the operation was called
-	printk("Creating directory!\n");
+	struct super_block *sb = m->private;
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+
+	seq_printf(m, "metadata_reads: %llu\n", HOLLYFS_STAT(sbi, bread));
+	seq_printf(m, "metadata_read_misses: %llu\n", HOLLYFS_STAT(sbi, bread_miss));
+	seq_printf(m, "sync_commits: %llu\n", HOLLYFS_STAT(sbi, sync_commits));
+	seq_printf(m, "alloc_calls: %llu\n", HOLLYFS_STAT(sbi, alloc_calls));
+	seq_printf(m, "alloc_blocks: %llu\n", HOLLYFS_STAT(sbi, alloc_blocks));
+	seq_printf(m, "alloc_groups_searched: %llu\n", HOLLYFS_STAT(sbi, alloc_groups));
+	seq_printf(m, "alloc_runs_searched: %llu\n", HOLLYFS_STAT(sbi, alloc_runs));
+	seq_printf(m, "freed_blocks: %llu\n", HOLLYFS_STAT(sbi, freed_blocks));
+	seq_printf(m, "shared_blocks: %llu\n", HOLLYFS_STAT(sbi, shared_blocks));
+	seq_printf(m, "cow_blocks: %llu\n", HOLLYFS_STAT(sbi, cow_blocks));
+	seq_printf(m, "free_blocks: %lld\n", percpu_counter_sum(&sbi->free_blocks));
+	seq_printf(m, "reserved_blocks: %lld\n", percpu_counter_sum(&sbi->dirty_blocks));
+	seq_printf(m, "free_inodes: %llu\n", hollyfs_count_free_inodes(sbi));
 	return 0;
-};
+}
+DEFINE_SHOW_ATTRIBUTE(hollyfs_stats);
+
+// debugfs latency: one row per histogram bucket, in microseconds, and a column per operation
+static int hollyfs_latency_show(struct seq_file *m, void *v)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB((struct super_block *)m->private);
+	unsigned int b, op;
+
+	seq_printf(m, "%12s %10s %10s %10s %10s %10s\n", "usecs", "create", "lookup", "readdir", "alloc", "writeback");
+	for(b = 0; b < HOLLYFS_LAT_BUCKETS; b++)
+	{
+		if(b == HOLLYFS_LAT_BUCKETS - 1)
+			seq_printf(m, "%11u+", 1u << b);
+		else
+			seq_printf(m, "%6u-%-5u", b ? 1u << b : 0, (2u << b) - 1);
+		for(op = 0; op < HOLLYFS_LAT_OPS; op++)
+			seq_printf(m, " %10llu", HOLLYFS_STAT(sbi, lat[op][b]));
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hollyfs_latency);
 
-// the function that is being called when .destroy_inode operation of our custom super block is executed
-static void hollyfs_destroy_inode(struct inode *inode)
+// sets up /sys/kernel/debug/hollyfs/<device> with the stats and latency files, put_sb_info takes it down again
+static void hollyfs_debugfs_init(struct super_block *sb)
 {
-	// simply prints out the destry message to the log
-	printk("Holly FS destroy inode called!\n");
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+
+	if(IS_ERR_OR_NULL(hollyfs_debugfs_root))
+		return;
+	sbi->debugfs_dir = debugfs_create_dir(sb->s_id, hollyfs_debugfs_root);
+	debugfs_create_file("stats", 0444, sbi->debugfs_dir, sb, &hollyfs_stats_fops);
+	debugfs_create_file("latency", 0444, sbi->debugfs_dir, sb, &hollyfs_latency_fops);
 }
 
-// implementation of the .put_super operation for the super block of our custom file system
-static void hollyfs_put_super(struct super_block *sb)
+// called for sync(2), syncfs(2) and on unmount, after the dirty inodes were written
+// everything is in the journal already, so this brings the superblock counters up to date and commits
+static int hollyfs_sync_fs(struct super_block *sb, int wait)
+{
+	journal_t *journal = HOLLYFS_SB(sb)->journal;
+	tid_t target;
+	int err;
+
+	err = hollyfs_commit_super(sb);
+	if(err)
+		return err;
+	if(jbd2_journal_start_commit(journal, &target) && wait)
+		return jbd2_log_wait_commit(journal, target);
+	return 0;
+}
+
+// the option parser is down with the mount code
+static int hollyfs_parse_options(struct super_block *sb, char *options);
+
+// mount -o remount, the options are read again the way a mount reads them and a bad one leaves the old ones in place,
+// a read-only mount that becomes writable frees the orphans it found at mount time now,
+// and one that becomes read-only finishes freeing what is queued before it stops writing
+static int hollyfs_remount(struct super_block *sb, int *flags, char *data)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	bool discard = sbi->discard, debug = sbi->debug;
+	int err;
+
+	err = hollyfs_parse_options(sb, data);
+	if(err)
+	{
+		sbi->discard = discard;
+		sbi->debug = debug;
+		return err;
+	}
+	sync_filesystem(sb);
+	if((*flags & SB_RDONLY) && !sb_rdonly(sb))
+	{
+		flush_work(&sbi->reclaim_work);
+		hollyfs_release_inos(sb);
+		return hollyfs_sync_fs(sb, 1);
+	}
+	if(!(*flags & SB_RDONLY) && sb_rdonly(sb) && !list_empty(&sbi->reclaim_queue))
+		queue_work(system_unbound_wq, &sbi->reclaim_work);
+	return 0;
+}
+
+// called when the last reference to an inode is gone, its cached pages go before the inode itself is freed
+// a deleted inode is only queued for the reclaim worker, which frees its blocks and its slot later on, so
+// evict never has to wait for the journal and deleting a big file costs the unlink nothing but the name
+static void hollyfs_evict_inode(struct inode *inode)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(inode->i_sb);
+	struct hollyfs_orphan *orphan = HOLLYFS_I(inode)->orphan;
+
+	truncate_inode_pages_final(&inode->i_data);
+	clear_inode(inode);
+	if(orphan)
+	{
+		mutex_lock(&sbi->reclaim_lock);
+		list_add_tail(&orphan->reclaim, &sbi->reclaim_queue);
+		mutex_unlock(&sbi->reclaim_lock);
+		queue_work(system_unbound_wq, &sbi->reclaim_work);
+	}
+}
+
+// copies an inode (size and extent map included) into its slot in the inode table and logs that block
+// with the running transaction, the other inodes in the same table block are left alone
+static int hollyfs_update_inode(struct inode *inode)
+{
+	struct hollyfs_inode_info *hfs_inode = HOLLYFS_I(inode);
+	hollyfs_inode *raw_inode;
+	struct buffer_head *bh;
+	int err;
+
+	raw_inode = hollyfs_get_raw_inode(inode->i_sb, inode->i_ino, &bh);
+	if(!raw_inode)
+		return -EIO;
+	err = hollyfs_journal_get_write_access(bh);
+	if(err)
+	{
+		brelse(bh);
+		return err;
+	}
+	// bring the on-disk fields up to date with the in-memory inode, hollyfs_iget reads them back
+	// next_ino belongs to the orphan list and is left as it is
+	memset(raw_inode, 0, offsetof(struct hollyfs_inode, next_ino));
+	raw_inode->inode_num = inode->i_ino;
+	raw_inode->type = hfs_inode->type;
+	raw_inode->file_size = i_size_read(inode);
+	raw_inode->mode = inode->i_mode;
+	raw_inode->uid = i_uid_read(inode);
+	raw_inode->gid = i_gid_read(inode);
+	raw_inode->links_count = inode->i_nlink;
+	raw_inode->atime = inode->i_atime.tv_sec;
+	raw_inode->mtime = inode->i_mtime.tv_sec;
+	raw_inode->ctime = inode->i_ctime.tv_sec;
+	raw_inode->dir_child_count = hfs_inode->dir_child_count;
+	raw_inode->dir_index_blocks = hfs_inode->dir_index_blocks;
+	// a writer may be in the middle of shifting extents around or of copying in inline data
+	down_read(&hfs_inode->extent_sem);
+	raw_inode->extent_count = hfs_inode->extent_count;
+	raw_inode->extent_block = hfs_inode->extent_block;
+	raw_inode->flags = hfs_inode->flags;
+	memcpy(raw_inode->inline_data, hfs_inode->inline_data, sizeof(raw_inode->inline_data));
+	up_read(&hfs_inode->extent_sem);
+	err = hollyfs_journal_dirty(bh);
+	brelse(bh);
+	return err;
+}
+
+// mark_inode_dirty ends up here, the inode is logged right away inside a handle so it commits with
+// whatever else the same operation changed (a create or a write already holds one and this joins it)
+static void hollyfs_dirty_inode(struct inode *inode, int flags)
+{
+	handle_t *handle;
+	int err;
+
+	handle = hollyfs_journal_start(inode->i_sb, HOLLYFS_INODE_CREDITS, 0);
+	if(IS_ERR(handle))
+	{
+		printk("hollyfs: could not log inode %lu, error %ld\n", inode->i_ino, PTR_ERR(handle));
+		return;
+	}
+	err = hollyfs_update_inode(inode);
+	if(err)
+		printk("hollyfs: could not log inode %lu, error %d\n", inode->i_ino, err);
+	jbd2_journal_stop(handle);
+}
+
+// the inode went into the journal when it was marked dirty, so there is nothing to write here,
+// only a data integrity sync of a single inode (fsync, O_SYNC) waits for the commit
+// sync(2) is left to sync_fs, which commits once for all inodes, and reclaim never waits on the journal
+static int hollyfs_write_inode(struct inode *inode, struct writeback_control *wbc)
+{
+	if(wbc->sync_mode != WB_SYNC_ALL || wbc->for_sync || (current->flags & PF_MEMALLOC))
+		return 0;
+	hollyfs_stat_add(HOLLYFS_SB(inode->i_sb), sync_commits, 1);
+	return jbd2_journal_force_commit(HOLLYFS_SB(inode->i_sb)->journal);
+}
+
+// /proc/mounts lists the mount options that are not the default
+static int hollyfs_show_options(struct seq_file *seq, struct dentry *root)
 {
-	// here the pointer to the super block on disk is acquired for no practical reason
-	hollyfs_superblock *sb_ondisk;
-	// the s_fs_info pointer of the super block contains our custom super block on the disk
-	sb_ondisk = (hollyfs_superblock *)sb->s_fs_info;
-	// the log is printed out when this method is run
-	printk("Holly FS put super called!\n");
+	if(HOLLYFS_SB(root->d_sb)->discard)
+		seq_puts(seq, ",discard");
+	if(HOLLYFS_SB(root->d_sb)->debug)
+		seq_puts(seq, ",debug");
+	return 0;
 }
 
 // struct that defines custom operations for interactions with the super block
 static const struct super_operations hollyfs_super_ops = {
-	.destroy_inode = hollyfs_destroy_inode, // operation that is being executed when the inode is destroyed, implemented in hollyfs_destroy_inode function
+	.dirty_inode = hollyfs_dirty_inode, // called by mark_inode_dirty, logs the inode in the journal
+	.write_inode = hollyfs_write_inode, // called by writeback for inodes that were marked dirty
+	.evict_inode = hollyfs_evict_inode, // called when an inode leaves the inode cache
+	.sync_fs = hollyfs_sync_fs, // commits the journal for sync and unmount
+	.remount_fs = hollyfs_remount, // starts or finishes freeing deleted inodes when the mount changes between ro and rw
+	.statfs = hollyfs_statfs, // reports the size and the free blocks and inodes for df
+	.alloc_inode = hollyfs_alloc_inode, // operation that is being executed when a new inode is needed, implemented in hollyfs_alloc_inode function
+	.free_inode = hollyfs_free_inode, // operation that is being executed when the inode is destroyed, implemented in hollyfs_free_inode function
 	.put_super = hollyfs_put_super, // operation that is being called before the freeing of the super block 
+	.show_options = hollyfs_show_options, // the mount options in /proc/mounts
 };
 
 
+// sets up the jbd2 journal that lives in the journal region of the partition and loads it,
+// jbd2_journal_load replays whatever the log still holds when the last mount did not unmount cleanly
+static int hollyfs_load_journal(struct super_block *sb)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	journal_t *journal;
+	int err;
+
+	journal = jbd2_journal_init_dev(sb->s_bdev, sb->s_bdev, sbi->sb_ondisk->journal_block_base, sbi->sb_ondisk->journal_block_count, sb->s_blocksize);
+	if(!journal)
+	{
+		printk("hollyfs: could not set up the journal\n");
+		return -ENOMEM;
+	}
+	journal->j_private = sb;
+	// every commit has to flush the disk cache, or the commit block could reach the platter before the log blocks it seals
+	write_lock(&journal->j_state_lock);
+	journal->j_flags |= JBD2_BARRIER;
+	write_unlock(&journal->j_state_lock);
+
+	err = jbd2_journal_load(journal);
+	if(err)
+	{
+		printk("hollyfs: could not load the journal, error %d\n", err);
+		jbd2_journal_destroy(journal);
+		return err;
+	}
+	sbi->journal = journal;
+	return 0;
+}
+
+// reads the mount options, the ones there are: discard and nodiscard, debug and nodebug
+static int hollyfs_parse_options(struct super_block *sb, char *options)
+{
+	struct hollyfs_sb_info *sbi = HOLLYFS_SB(sb);
+	char *opt;
+
+	while((opt = strsep(&options, ",")) != NULL)
+	{
+		if(!*opt)
+			continue;
+		if(strcmp(opt, "discard") == 0)
+		{
+			sbi->discard = true;
+		}
+		else if(strcmp(opt, "nodiscard") == 0)
+		{
+			sbi->discard = false;
+		}
+		else if(strcmp(opt, "debug") == 0)
+		{
+			sbi->debug = true;
+		}
+		else if(strcmp(opt, "nodebug") == 0)
+		{
+			sbi->debug = false;
+		}
+		else
+		{
+			printk("hollyfs: unknown mount option %s\n", opt);
+			return -EINVAL;
+		}
+	}
+	if(sbi->discard && !bdev_max_discard_sectors(sb->s_bdev))
+	{
+		printk("hollyfs: the device can't discard, mounting without the discard option\n");
+		sbi->discard = false;
+	}
+	return 0;
+}
+
 // this function checks the frmat of the file system on the partition using magic number and fills the file system's super block with the
 // appropriate operation references and parameters, creating and adding a new inode for the root file directory
 static int hollyfs_fill_sb(struct super_block *sb, void *data, int silent)
 {
 	struct buffer_head *bh;
 	struct hollyfs_superblock *sb_ondisk;
+	struct hollyfs_sb_info *sbi;
 	struct inode *root_inode = NULL;
-	hollyfs_inode *root_inode_ondisk;
+	hollyfs_group_desc *gd;
+	unsigned int i, used;
+	u64 free;
+	int err = -EIO;
+
+	// all the block numbers in hollyfs are in units of HOLLYFS_BLOCK_SIZE, so sb_bread has to use that size too
+	if(!sb_set_blocksize(sb, HOLLYFS_BLOCK_SIZE))
+	{
+		printk("hollyfs: device does not support %u byte blocks\n", HOLLYFS_BLOCK_SIZE);
+		return -EINVAL;
+	}
 
 	// initialize a buffer head with a given super block, starting at block number 0 of the super block's device, since super block is the very first block
 	bh = sb_bread(sb, 0);
+	if(!bh)
+	{
+		printk("hollyfs: could not read the superblock\n");
+		return -EIO;
+	}
 	// here we are reading the data that is stored on the dist at the location pointed to by the buffer head
 	// since bufer head points to the very first block on the partition, it points to the super block
 	// thus sb_ondisk will point to the superblock on disk
@@ -231,56 +5306,192 @@ static int hollyfs_fill_sb(struct super_block *sb, void *data, int silent)
 	{
 		printk("Incorrect Magic Number!\n");
 		brelse(bh);
-		return 1;
+		return -EINVAL;
+	}
+
+	// every group has exactly one bitmap block, and an inode table with at least a slot for the root folder
+	if(sb_ondisk->group_count == 0 || sb_ondisk->blocks_per_group != HOLLYFS_BLOCKS_PER_GROUP || sb_ondisk->inode_table_blocks == 0 ||
+	   sb_ondisk->inodes_per_group != sb_ondisk->inode_table_blocks * HOLLYFS_INODES_PER_BLOCK ||
+	   (unsigned long long)sb_ondisk->gdt_blocks * HOLLYFS_GROUP_DESCS_PER_BLOCK < sb_ondisk->group_count)
+	{
+		printk("hollyfs: superblock has a bad group layout, run mkfs again\n");
+		brelse(bh);
+		return -EINVAL;
+	}
+
+	// mkfs puts a jbd2 journal in front of the groups, file systems made before that can't be mounted anymore
+	if(sb_ondisk->journal_block_count == 0)
+	{
+		printk("hollyfs: superblock has no journal, run mkfs again\n");
+		brelse(bh);
+		return -EINVAL;
+	}
+	// replaying the journal writes to the device, even for a read-only mount
+	if(bdev_read_only(sb->s_bdev))
+	{
+		printk("hollyfs: the journal needs a writable device\n");
+		brelse(bh);
+		return -EROFS;
 	}
 
 	// set the appropriate properties for the super block
-	// here we are setting the limit to the size of the super block, making it of the standard block size defined for our custom file system
-	sb->s_maxbytes = HOLLYFS_BLOCK_SIZE;
+	// here we are setting the largest file size, file blocks are 32 bit numbers in the extent map
+	sb->s_maxbytes = ((loff_t)U32_MAX + 1) * HOLLYFS_BLOCK_SIZE - 1;
 	// setting the super operations of the super block to the custom struct of operations defined in hollyfs_super_ops
 	sb->s_op = &hollyfs_super_ops;
-	// set the current super block specific file system info to the super block located on disk
-	sb->s_fs_info = sb_ondisk;
-
-	// creating a new inode in the peartition to which current super block is attached
-	// this new inode is the root file directory inode
-	root_inode = new_inode(sb);
-	// set the number of the inode (its id, index in the array of inodes) to the HOLLYFS_INODE_BLOCK_BASE, which points to the place 
-	// where the list of inodes starts o nthe partition, since root inode is our first inode, that is in the very beginning of the inode list
-	root_inode->i_ino = HOLLYFS_INODE_BLOCK_BASE;
-	// here we are setting up the permission bits for the newly created root inode, checking if it is a directory, in which case S_IFDIR would have a non-zero value
-	// furthermore, we are passing NULL as root inode in not contained in any other directory, so all directories on the partition are its children
-	inode_init_owner(root_inode, NULL, S_IFDIR|0777);
-	// set the root node's super block pointer to the current super block
-	root_inode->i_sb = sb;
-	// make operations of the root inode refer to the operations listed in hollyfs_inode_ops struct
-	root_inode->i_op = &hollyfs_inode_ops; 
-	// set the root inode file operations to the ones that are defined in the holly_dir_ops struct
-	root_inode->i_fop = &hollyfs_dir_ops; 
-	// setting the last access time, modification time and change time to the current time, as this is the time when the root indoe was created
-	root_inode->i_atime = root_inode->i_mtime = root_inode->i_ctime = CURRENT_TIME;
-	// point buffer header to the region at HOLLYFS_INODE_BLOCK_BASE in the partition on which current super block is stored
-	// in other words point it to the location of the root inode
-	bh = sb_bread(sb, HOLLYFS_INODE_BLOCK_BASE);
-	// get the data that is stored on disk where the root inode is supposed to be stores
-	root_inode_ondisk = (hollyfs_inode *)bh->b_data;
-	// set the private info of the root inode to the data that is stored on the disk, thus linking the newly created root inode to its appropriate location on the disk
-	root_inode->i_private = root_inode_ondisk;
+	// set up our private super block info, it keeps the superblock buffer pinned so sb_ondisk stays valid while mounted
+	sbi = kzalloc(sizeof(struct hollyfs_sb_info), GFP_KERNEL);
+	if(!sbi)
+	{
+		brelse(bh);
+		return -ENOMEM;
+	}
+	sbi->sb_bh = bh;
+	sbi->sb_ondisk = sb_ondisk;
+	sbi->sb = sb;
+	mutex_init(&sbi->reclaim_lock);
+	INIT_LIST_HEAD(&sbi->orphans);
+	INIT_LIST_HEAD(&sbi->reclaim_queue);
+	INIT_WORK(&sbi->reclaim_work, hollyfs_reclaim_work);
+	mutex_init(&sbi->trim_lock);
+	INIT_DELAYED_WORK(&sbi->discard_work, hollyfs_discard_work);
+	spin_lock_init(&sbi->refcount_lock);
+	mutex_init(&sbi->refcount_mutex);
+	// the statistics are there before the first metadata block is read, hollyfs_bread counts every one
+	sbi->stats = alloc_percpu(struct hollyfs_stats);
+	if(!sbi->stats)
+	{
+		err = -ENOMEM;
+		goto out_put_sbi;
+	}
+	// set the current super block specific file system info to our private info, parsing the options already goes through it
+	sb->s_fs_info = sbi;
+	err = hollyfs_parse_options(sb, data);
+	if(err)
+		goto out_put_sbi;
+
+	// load the journal before anything else is read, after a crash this replays the committed transactions
+	// into their home blocks (the superblock buffer we hold included), so everything below sees a consistent file system
+	err = hollyfs_load_journal(sb);
+	if(err)
+		goto out_put_sbi;
+
+	// read the group descriptor table and keep it pinned, every allocation and every inode lookup goes through it
+	sbi->gdt_bh = kcalloc(sb_ondisk->gdt_blocks, sizeof(struct buffer_head *), GFP_KERNEL);
+	if(!sbi->gdt_bh)
+	{
+		err = -ENOMEM;
+		goto out_put_sbi;
+	}
+	for(i = 0; i < sb_ondisk->gdt_blocks; i++)
+	{
+		sbi->gdt_bh[i] = sb_bread(sb, sb_ondisk->gdt_block_base + i);
+		if(!sbi->gdt_bh[i])
+		{
+			printk("hollyfs: could not read group descriptor block %u\n", sb_ondisk->gdt_block_base + i);
+			err = -EIO;
+			goto out_put_sbi;
+		}
+	}
+
+	// read every group's bitmap in and keep it pinned too, it is only a block per 128MiB of partition
+	// so the allocator can search it in memory without any sb_bread on the create path
+	sbi->groups = kvcalloc(sb_ondisk->group_count, sizeof(struct hollyfs_group_info), GFP_KERNEL);
+	if(!sbi->groups)
+	{
+		err = -ENOMEM;
+		goto out_put_sbi;
+	}
+	free = 0;
+	for(i = 0; i < sb_ondisk->group_count; i++)
+	{
+		gd = hollyfs_get_group_desc(sbi, i, NULL);
+		// the descriptor has to describe the group where the superblock says it is, with the inode table right
+		// after the bitmap and some data blocks after that, or the allocator would hand out metadata
+		if(gd->bitmap_block != sb_ondisk->first_group_block + i * sb_ondisk->blocks_per_group || gd->inode_table_block != gd->bitmap_block + 1 ||
+		   gd->data_block_base != gd->inode_table_block + sb_ondisk->inode_table_blocks || gd->block_count > sb_ondisk->blocks_per_group ||
+		   gd->block_count <= gd->data_block_base - gd->bitmap_block || gd->inodes_used > sb_ondisk->inodes_per_group ||
+		   gd->free_inodes > gd->inodes_used ||
+		   (gd->refcount_block && (gd->refcount_block < sb_ondisk->first_group_block || gd->refcount_block > sb_ondisk->fs_size - HOLLYFS_REFCOUNT_BLOCKS)))
+		{
+			printk("hollyfs: group descriptor %u is corrupted\n", i);
+			err = -EIO;
+			goto out_put_sbi;
+		}
+		sbi->groups[i].bitmap_bh = sb_bread(sb, gd->bitmap_block);
+		if(!sbi->groups[i].bitmap_bh)
+		{
+			printk("hollyfs: could not read the bitmap of group %u\n", i);
+			err = -EIO;
+			goto out_put_sbi;
+		}
+		// the free block count in the descriptor is only a copy from the last sync, count the set bits instead
+		// (mkfs leaves the bits past the end of a short last group clear, so every set bit is a block in use)
+		used = memweight(sbi->groups[i].bitmap_bh->b_data, sb->s_blocksize);
+		atomic_set(&sbi->groups[i].free_blocks, gd->block_count - min(used, gd->block_count));
+		free += atomic_read(&sbi->groups[i].free_blocks);
+	}
+	err = percpu_counter_init(&sbi->free_blocks, free, GFP_KERNEL);
+	if(err)
+		goto out_put_sbi;
+	err = percpu_counter_init(&sbi->dirty_blocks, 0, GFP_KERNEL);
+	if(err)
+		goto out_put_sbi;
+	// every cpu starts out without reserved inode numbers and takes its first batch on its first create
+	spin_lock_init(&sbi->ino_lock);
+	sbi->ino_batch = alloc_percpu(struct hollyfs_ino_batch);
+	if(!sbi->ino_batch)
+	{
+		err = -ENOMEM;
+		goto out_put_sbi;
+	}
+
+	// pick up the inodes that were deleted but not freed yet when the last mount ended
+	err = hollyfs_orphan_recover(sb);
+	if(err)
+		goto out_put_sbi;
+
+	// the root file directory inode is read from its slot in the inode table like every other inode,
+	// its permission bits, times and extent map are whatever mkfs and later write_inode calls stored there
+	root_inode = hollyfs_iget(sb, HOLLYFS_ROOT_INO);
+	if(IS_ERR(root_inode))
+	{
+		printk("hollyfs could not read the root folder inode\n");
+		err = PTR_ERR(root_inode);
+		goto out_put_sbi;
+	}
+	if(!S_ISDIR(root_inode->i_mode))
+	{
+		printk("hollyfs root folder inode is not a directory\n");
+		iput(root_inode);
+		err = -EIO;
+		goto out_put_sbi;
+	}
 	// here we are linking the root inode pointer of the super block to the newly created root inode
 	sb->s_root = d_make_root(root_inode);
 	// if there is a NULL or something inappropriate in the super block's root inode pointer, it means that the root inode was not created properly
 	if(!sb->s_root)
 	{
 		printk("hollyfs failed creating root directory\n");
-		return -ENOMEM;
+		err = -ENOMEM;
+		goto out_put_sbi;
 	}
 
-	// if everything works, we can finish up filling the super block, which included the creation of the root inode, 
-	// release the buffer head pointer so that there is no more reference to it and it will not get corruped, since we do not need it anymore, and return
-	printk("Finished reading / building root folder inode!\n");
-	brelse(bh);
+	// the worker frees the orphans in the background, the file system is usable right away
+	if(!sb_rdonly(sb) && !list_empty(&sbi->reclaim_queue))
+		queue_work(system_unbound_wq, &sbi->reclaim_work);
+	// the statistics go to debugfs under the device name, a mount works fine without them when that fails
+	hollyfs_debugfs_init(sb);
+
+	// if everything works, we can finish up filling the super block, which included the reading of the root inode
+	hollyfs_debug(sb, "Finished reading / building root folder inode!\n");
 	return 0;
-	
+
+out_put_sbi:
+	// put_super is not called when fill_sb fails, so the pinned buffers are released here
+	hollyfs_put_sb_info(sbi);
+	sb->s_fs_info = NULL;
+	return err;
 }
 
 // mounts the device with a given file system on it, returning the dentry of the root, that has a reference to the root inode
@@ -317,6 +5528,15 @@ static struct file_system_type hollyfs_type = {
 };
 
 
+// constructor for the objects in hollyfs_inode_cache, the vfs inode only needs this once per object
+// and not every time the object is handed out again
+static void hollyfs_inode_init_once(void *obj)
+{
+	struct hollyfs_inode_info *hfs_inode = obj;
+
+	inode_init_once(&hfs_inode->vfs_inode);
+}
+
 // initializes the module by creating the cache for indes of the file system and registering the file system
 static int __init init_hollyfs(void)
 {
@@ -324,19 +5544,33 @@ static int __init init_hollyfs(void)
 	int ret;
 	printk("Loaded hollyfs module.\n");
 
-	// creating a cache to store the hollyfs_inode objects
+	// an on-disk inode has to fit into its slot in the inode table
+	BUILD_BUG_ON(sizeof(struct hollyfs_inode) > HOLLYFS_INODE_SIZE);
+
+	// creating a cache to store the hollyfs_inode_info objects, each one has a vfs inode embedded in it
 	hollyfs_inode_cache = kmem_cache_create("hollyfs_inode_cache", 
-							sizeof(struct hollyfs_inode), 
+							sizeof(struct hollyfs_inode_info), 
 							0, 
-							(SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD), 
-							NULL);
+							(SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD | SLAB_ACCOUNT), 
+							hollyfs_inode_init_once);
+	if(!hollyfs_inode_cache)
+		return -ENOMEM;
+	// the statistics of every mount go in here, without debugfs the mounts just have none
+	hollyfs_debugfs_root = debugfs_create_dir("hollyfs", NULL);
 	
 	// recording the result returned by register_filesystem function call in order to check 
 	// whether the filesystem registration procedure was successfull, in which case printing the success message
 	// we pass in the holly_fs struct reference to register a filesystem on the type defined in hollyfs_type struct
 	ret = register_filesystem(&hollyfs_type);
 	if(ret == 0)
+	{
 		printk("Registered hollyfs filesystem\n");
+	}
+	else
+	{
+		debugfs_remove(hollyfs_debugfs_root);
+		kmem_cache_destroy(hollyfs_inode_cache);
+	}
 
 	
 	// the initialization of the holy_fs file system was successful if it was registered successfully, 
@@ -354,6 +5588,10 @@ static void __exit exit_hollyfs(void)
 	// if the file system is unregistered successfully, the return code stored in ret variable should be equal to 0
 	if(ret == 0)
 		printk("Unregistered hollyfs filesystem\n");
+	// inodes are freed after an rcu grace period, wait for those before the cache they come from goes away
+	rcu_barrier();
+	debugfs_remove(hollyfs_debugfs_root);
+	kmem_cache_destroy(hollyfs_inode_cache);
 	// just printing out the message signifying the removal of the hollyfs module, since all its functionality was in the registration of the custom file system that was just unregistered
 	printk("Removed hollyfs module.\n");
 }
@@ -363,7 +5601,7 @@ module_init(init_hollyfs);
 module_exit(exit_hollyfs);
 
 // here we are setting up some description properties for our custom file system module
-MODULE_LICENSE("NONE");
+MODULE_LICENSE("GPL"); // alloc_percpu (the inode number batches and the stats) and the iomap helpers are only exported to GPL modules
 MODULE_AUTHOR("Your name!");
 MODULE_DESCRIPTION("Implements a simple filesystem.");
 
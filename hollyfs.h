@@ -1,43 +1,230 @@
 /* hollyfs.h */
 
 // Contains mostly the structs used in hollyfs.c which is a rudimentary kern-space file system
+// mkfs and the userspace library (hollyfs_lib.c) include it as well, the constants are static so every file gets its own copy
 
 
 
-const unsigned int HOLLYFS_MAGIC_NUM = 77;
-const unsigned int HOLLYFS_BLOCK_SIZE = 4096;
-#define HOLLYFS_DATA_BLOCK_COUNT 1023
-const unsigned int HOLLYFS_DATA_BLOCK_BASE = 1;
-const unsigned int HOLLYFS_INODE_BLOCK_BASE = 1024;
-const unsigned int HOLLYFS_FILE_TYPE_DIR = 1;
-const unsigned int HOLLYFS_FILE_TYPE_FILE = 2;
+static const unsigned int HOLLYFS_MAGIC_NUM = 82; // 77 before the allocation group layout, 78 before inline data, 79 before unwritten extents, 80 before inode reuse, 81 before reflinks
+static const unsigned int HOLLYFS_BLOCK_SIZE = 4096;
+#define HOLLYFS_BITS_PER_BLOCK (4096 * 8) // one bitmap block tracks this many blocks
+#define HOLLYFS_BLOCKS_PER_GROUP HOLLYFS_BITS_PER_BLOCK // so every group has exactly one bitmap block
+#define HOLLYFS_BLOCKS_PER_INODE 4 // mkfs gives every group one inode per this many blocks
+#define HOLLYFS_INODE_SIZE 256 // every inode gets a slot of this size in the inode table
+#define HOLLYFS_INODES_PER_BLOCK (4096 / HOLLYFS_INODE_SIZE)
+#define HOLLYFS_JOURNAL_MIN_BLOCKS 2048 // jbd2 wants at least 1024 blocks on top of its superblock
+#define HOLLYFS_JOURNAL_MAX_BLOCKS 32768
+static const unsigned int HOLLYFS_ROOT_INO = 1; // inode 0 is never used, a record with inode_no 0 is a free record
+static const unsigned int HOLLYFS_FILE_TYPE_DIR = 1;
+static const unsigned int HOLLYFS_FILE_TYPE_FILE = 2;
 #define HOLLYFS_FILENAME_MAX 255
 
 
-// This is stored in the first 4096B block 
+/*
+ * Here is a rough outline of a hollyfs partition
+ * ------------------------------------------------------------------------------
+ * |sb|group descriptors|journal| group 0 | group 1 | ... | group group_count-1 |
+ * ------------------------------------------------------------------------------
+ * and of every group, the last one may be shorter than blocks_per_group
+ * --------------------------------------------------
+ * |bitmap|inode table|data blocks ...              |
+ * --------------------------------------------------
+ * Group g starts at block first_group_block + g * blocks_per_group.
+ * Bit b of a group's bitmap stands for block bitmap_block + b, the bitmap block and the inode
+ * table blocks are marked in use by mkfs so the bitmap covers the whole group. Bits are stored
+ * little-endian within each byte (bit i is byte i / 8, mask 1 << (i % 8)) so that the kernel can
+ * search them a whole word at a time with find_next_zero_bit_le.
+ * Inode number n lives in group n / inodes_per_group at slot n % inodes_per_group of its inode table.
+ * The inode tables are not initialized by mkfs (except for the block holding the root folder), the
+ * kernel zeroes a table block when it hands out the first slot in it, so only the slots below a
+ * group's inodes_used are ever read.
+ * A deleted inode is not freed right away: when its last name goes it is put on the orphan list that starts at
+ * the superblock's orphan_head and goes on through next_ino of each inode, and once it is not open anymore the
+ * kernel frees its blocks in the background, takes it off the list and puts its zeroed slot on its group's free
+ * inode list, which starts at free_inode_head and goes on through next_ino of the free slots. A mount finishes
+ * off whatever is still on the orphan list, so a crash in between loses no blocks.
+ * A data block can be in the extent map of more than one file after a reflink (FICLONE, copy_file_range), a group
+ * that has such blocks gets a refcount table, HOLLYFS_REFCOUNT_BLOCKS blocks in a row that the kernel allocates
+ * from the data blocks the first time one of the group's blocks gets shared. Entry b counts how many files beyond
+ * the first one have block bitmap_block + b, freeing a block with a count takes one off and leaves the bit set, and
+ * a write to a block with a count goes to a new block instead (copy on write).
+ */
+
+// This is stored in the first 4096B block
 struct hollyfs_superblock {
 	unsigned int magic_num;
 	unsigned int fs_size; // blocks
-	unsigned int inode_count;
-	unsigned short block_map[HOLLYFS_DATA_BLOCK_COUNT];  // inefficient but there is no boolean in C for the kernel
+	unsigned int blocks_per_group;
+	unsigned int group_count;
+	unsigned int first_group_block; // block where group 0 starts
+	unsigned int inodes_per_group; // a multiple of HOLLYFS_INODES_PER_BLOCK
+	unsigned int inode_table_blocks; // inode table length of every group
+	unsigned int gdt_block_base; // first block of the group descriptor table
+	unsigned int gdt_blocks; // group descriptor table length
+	unsigned int free_block_count; // copy of the in-memory count, refreshed at sync and unmount
+	unsigned int journal_block_base; // first block of the metadata journal, it starts with a jbd2 journal superblock
+	unsigned int journal_block_count; // journal length in blocks
+	unsigned int orphan_head; // first inode on the orphan list (deleted but not freed yet), 0 if it is empty
 };
 typedef struct hollyfs_superblock hollyfs_superblock;
 
+// One per allocation group, packed HOLLYFS_GROUP_DESCS_PER_BLOCK to a block in the group descriptor table
+struct hollyfs_group_desc {
+	unsigned int bitmap_block; // the group's block bitmap, also the group's first block
+	unsigned int inode_table_block; // first block of the group's inode table
+	unsigned int data_block_base; // first block after the inode table, from here on the group's blocks hold data
+	unsigned int block_count; // blocks in the group, bitmap and inode table included
+	unsigned int free_block_count; // copy of the in-memory count, refreshed at sync and unmount
+	unsigned int inodes_used; // inode slots handed out so far, a slot below this is only handed out again from the free inode list
+	unsigned int free_inode_head; // first slot on the group's list of freed inodes (as an inode number), 0 if there is none
+	unsigned int free_inodes; // slots on that list
+	unsigned int refcount_block; // first block of the group's refcount table, 0 while none of its blocks is shared
+};
+typedef struct hollyfs_group_desc hollyfs_group_desc;
+#define HOLLYFS_GROUP_DESCS_PER_BLOCK (4096 / sizeof(struct hollyfs_group_desc))
+
+// A refcount table has an unsigned short for every block of its group
+#define HOLLYFS_REFCOUNTS_PER_BLOCK (4096 / sizeof(unsigned short))
+#define HOLLYFS_REFCOUNT_BLOCKS (HOLLYFS_BLOCKS_PER_GROUP / HOLLYFS_REFCOUNTS_PER_BLOCK)
+#define HOLLYFS_REFCOUNT_MAX 0xffff // a block can't be shared by more files than this plus one
+
+// The first block of the journal region, this is the on-disk layout of the kernel's jbd2 journal superblock
+// (journal_superblock_t in linux/jbd2.h) up to the last field mkfs fills in, every field is big endian
+// the rest of the block stays zero, which is what jbd2 expects from a journal with no optional features
+// the kernel goes through jbd2 itself, only mkfs and the userspace library look at this
+struct hollyfs_journal_superblock {
+	unsigned int h_magic; // JBD2 magic number
+	unsigned int h_blocktype; // 4 = version 2 superblock
+	unsigned int h_sequence;
+	unsigned int s_blocksize; // journal block size, has to match the file system block size
+	unsigned int s_maxlen; // total blocks in the journal, superblock included
+	unsigned int s_first; // first block of log data
+	unsigned int s_sequence; // first commit id expected in the log
+	unsigned int s_start; // block of the start of the log, 0 means the journal is clean and there is nothing to replay
+	unsigned int s_errno;
+	unsigned int s_feature_compat;
+	unsigned int s_feature_incompat;
+	unsigned int s_feature_ro_compat;
+	unsigned char s_uuid[16];
+	unsigned int s_nr_users; // file systems sharing the journal, 1 for a journal inside the file system
+};
+#define HOLLYFS_JBD2_MAGIC 0xc03b3998U
+#define HOLLYFS_JBD2_SUPERBLOCK_V2 4
+
+// A run of physically contiguous blocks that backs a run of file blocks
+// length blocks starting at file block logical_block live at start_block, start_block + 1, ...
+struct hollyfs_extent {
+	unsigned int logical_block; // first block of the file covered by this extent
+	unsigned int start_block; // absolute block number on the partition
+	unsigned int length; // number of blocks, the top bit is HOLLYFS_EXTENT_UNWRITTEN
+};
+typedef struct hollyfs_extent hollyfs_extent;
+
+// An unwritten extent has its blocks allocated (by fallocate, or by writeback allocating ahead of a growing
+// file) but nothing was ever written to them, so they read back as zeroes, the first write into one of its
+// blocks splits that block off as a written extent
+#define HOLLYFS_EXTENT_UNWRITTEN 0x80000000u
+
+// The first HOLLYFS_INODE_EXTENTS extents of a file are stored right in the inode, when a file
+// needs more than that the rest go to one indirect extent block, which is just an array of extents
+#define HOLLYFS_INODE_EXTENTS 8
+#define HOLLYFS_EXTENTS_PER_BLOCK (4096 / sizeof(struct hollyfs_extent))
+#define HOLLYFS_MAX_EXTENTS (HOLLYFS_INODE_EXTENTS + HOLLYFS_EXTENTS_PER_BLOCK)
+
+// A small regular file keeps its contents in the inode instead of in data blocks, in the space the
+// extents take otherwise, and moves to extents once it grows past HOLLYFS_INLINE_DATA_MAX bytes.
+// The bytes past file_size are always zero
+#define HOLLYFS_INODE_INLINE_DATA 1 // flags bit
+#define HOLLYFS_INLINE_DATA_MAX 160
+// fallocate with FALLOC_FL_KEEP_SIZE put blocks past file_size on purpose, closing the file must not give them back
+#define HOLLYFS_INODE_PREALLOC 2 // flags bit
+// the file was the source or the target of a reflink, some of its blocks may be shared, writes have to check before
+// they go to a block in place, the flag is never taken off again
+#define HOLLYFS_INODE_SHARED 4 // flags bit
+
+// Inodes are packed HOLLYFS_INODES_PER_BLOCK to a block in the inode tables, inode number n lives in
+// group n / inodes_per_group at slot n % inodes_per_group of that group's inode table
 struct hollyfs_inode {
 	unsigned int inode_num;
-	unsigned int data_block_num; //limitation right now, only one block / file
-	unsigned int file_size;
+	unsigned int extent_count; // extents in use, sorted by logical_block across extents[] and then extent_block
+	unsigned long long file_size; // bytes
 	unsigned int dir_child_count;
 	unsigned int type; // DIR or FILE
+	unsigned int mode; // permission and file type bits, same values as st_mode
+	unsigned int uid;
+	unsigned int gid;
+	unsigned int links_count;
+	unsigned long long atime; // seconds since the epoch
+	unsigned long long mtime;
+	unsigned long long ctime;
+	unsigned int dir_index_blocks; // directories only: number of hash index blocks, 0 if not indexed yet
+	unsigned int extent_block; // block holding extents HOLLYFS_INODE_EXTENTS and up, 0 if there is none
+	unsigned int flags; // HOLLYFS_INODE_INLINE_DATA, HOLLYFS_INODE_PREALLOC, HOLLYFS_INODE_SHARED
+	union {
+		struct hollyfs_extent extents[HOLLYFS_INODE_EXTENTS];
+		char inline_data[HOLLYFS_INLINE_DATA_MAX]; // the file's contents when HOLLYFS_INODE_INLINE_DATA is set
+	};
+	unsigned int next_ino; // the next inode on the orphan list, or for a free slot the next one on its group's free list, 0 ends either list
 };
 typedef struct hollyfs_inode hollyfs_inode;
 
+// Directory records are variable length and packed one after the other, ext2 style.
+// Every directory block is completely covered by its records: rec_len is the distance to the
+// next record, so a record can own some unused space after its name, and a free record
+// (inode_no 0) can cover a whole block. The name is name_len bytes and is not NUL terminated
 struct hollyfs_directory_record {
-	char filename[HOLLYFS_FILENAME_MAX];
-	unsigned int inode_no;
+	unsigned int inode_no; // 0 means the record is free
+	unsigned short rec_len; // bytes from the start of this record to the start of the next one
+	unsigned char name_len;
+	unsigned char file_type; // HOLLYFS_FILE_TYPE_DIR or HOLLYFS_FILE_TYPE_FILE, so readdir needs no inode
+	char name[];
 };
 typedef struct hollyfs_directory_record hollyfs_directory_record;
 
+// space a record with a name of length len needs, rounded up to 4 bytes to keep inode_no aligned
+#define HOLLYFS_DIR_REC_LEN(len) ((sizeof(struct hollyfs_directory_record) + (len) + 3) & ~3u)
+
+// Directories have an on-disk hash index so a lookup reads one index block and one record block
+// no matter how many names the directory holds. The index blocks are part of the directory's
+// own extent map, index block k is file block HOLLYFS_DIR_INDEX_BASE + k, far away from the records.
+// A name goes to index block (hash & (dir_index_blocks - 1)), when that block fills up the number
+// of index blocks doubles and every slot whose hash now points to the new half moves over.
+// Names that no split up to HOLLYFS_DIR_INDEX_MAX_BLOCKS can tell apart (the same hash, or the
+// same low bits of it) get no slot once their block is full, and so do names whose split would
+// not fit into one transaction or onto the disk. The block is marked HOLLYFS_INDEX_OVERFLOW
+// instead and a lookup that misses there scans the records. Both halves of a marked block keep
+// the mark when it splits
+#define HOLLYFS_DIR_INDEX_BASE 0x80000000u
+#define HOLLYFS_DIR_INDEX_MAX_BLOCKS 65536
+struct hollyfs_dir_index_slot {
+	unsigned int hash; // hollyfs_name_hash of the name
+	unsigned int pos; // byte offset of the record inside the directory
+};
+typedef struct hollyfs_dir_index_slot hollyfs_dir_index_slot;
+
+#define HOLLYFS_INDEX_SLOTS_PER_BLOCK ((4096 - 8) / sizeof(struct hollyfs_dir_index_slot))
+struct hollyfs_dir_index_block {
+	unsigned int slot_count; // slots in use, they are packed at the front
+	unsigned int flags; // HOLLYFS_INDEX_OVERFLOW
+	struct hollyfs_dir_index_slot slots[HOLLYFS_INDEX_SLOTS_PER_BLOCK];
+};
+typedef struct hollyfs_dir_index_block hollyfs_dir_index_block;
+#define HOLLYFS_INDEX_OVERFLOW 1 // names whose hash picks this block may have no slot
+
+// 32 bit FNV-1a, it only depends on the bytes of the name so the kernel and mkfs agree on it
+static inline unsigned int hollyfs_name_hash(const char *name, unsigned int len)
+{
+	unsigned int hash = 2166136261u;
+	unsigned int i;
+
+	for(i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 /*
 struct dentry {
 	char name[4];
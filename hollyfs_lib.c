@@ -0,0 +1,393 @@
+/* hollyfs_lib.c */
+
+/* The userspace hollyfs library, see hollyfs_lib.h.
+
+It follows the on-disk format the same way hollyfs.c does, but every pointer it returns is checked
+against the size of the mapping first, a corrupted block number gives a NULL and never a crash, so
+fsck can point it at anything.
+*/
+
+#include "hollyfs_lib.h"
+#include <string.h> // provides memcmp and strchr
+#include <errno.h> // provides errno
+#include <fcntl.h> // provides open
+#include <unistd.h> // provides close
+#include <sys/mman.h> // provides mmap
+#include <sys/stat.h> // provides fstat
+#include <sys/ioctl.h> // provides ioctl
+#include <linux/fs.h> // provides BLKGETSIZE64
+#include <arpa/inet.h> // provides ntohl, the journal superblock is big endian
+
+
+// the same checks the kernel makes before it mounts, so what passes here the kernel would mount
+static const char *check_superblock(const hollyfs_superblock *sb, unsigned long long blocks)
+{
+	if(sb->magic_num != HOLLYFS_MAGIC_NUM)
+		return "wrong magic number, not hollyfs or made by an older mkfs";
+	if(sb->group_count == 0 || sb->blocks_per_group != HOLLYFS_BLOCKS_PER_GROUP || sb->inode_table_blocks == 0 ||
+	   sb->inodes_per_group != sb->inode_table_blocks * HOLLYFS_INODES_PER_BLOCK ||
+	   (unsigned long long)sb->gdt_blocks * HOLLYFS_GROUP_DESCS_PER_BLOCK < sb->group_count)
+		return "bad group layout";
+	if(sb->journal_block_count == 0)
+		return "no journal";
+	if(sb->fs_size > blocks || sb->gdt_block_base + sb->gdt_blocks > sb->fs_size || sb->journal_block_base >= sb->fs_size)
+		return "the file system is bigger than the device";
+	return NULL;
+}
+
+int hollyfs_open_image(struct hollyfs_image *img, const char *path, const char **why)
+{
+	const struct hollyfs_journal_superblock *jsb;
+	unsigned long long bytes;
+	struct stat st;
+	void *map;
+	int err;
+
+	*why = NULL;
+	memset(img, 0, sizeof(*img));
+	img->fd = open(path, O_RDONLY);
+	if(img->fd == -1)
+		return errno;
+	if(fstat(img->fd, &st) == -1)
+		goto fail;
+	// a block device has to be asked for its size, for an image file it is the file size
+	if(S_ISBLK(st.st_mode))
+	{
+		if(ioctl(img->fd, BLKGETSIZE64, &bytes) == -1)
+			goto fail;
+	}
+	else
+	{
+		bytes = st.st_size;
+	}
+	bytes -= bytes % HOLLYFS_BLOCK_SIZE;
+	if(bytes < HOLLYFS_BLOCK_SIZE)
+	{
+		*why = "too small to hold a superblock";
+		errno = EINVAL;
+		goto fail;
+	}
+	// MAP_SHARED so that the page cache of a block device is used as it is, nothing is copied
+	map = mmap(NULL, bytes, PROT_READ, MAP_SHARED, img->fd, 0);
+	if(map == MAP_FAILED)
+		goto fail;
+	img->map = map;
+	img->size = bytes;
+	img->sb = map;
+
+	*why = check_superblock(img->sb, bytes / HOLLYFS_BLOCK_SIZE);
+	if(*why)
+	{
+		hollyfs_close_image(img);
+		return EINVAL;
+	}
+	// a journal with a log start has commits in it the kernel did not write to their home blocks yet
+	jsb = hollyfs_block(img, img->sb->journal_block_base);
+	img->journal_dirty = jsb && ntohl(jsb->h_magic) == HOLLYFS_JBD2_MAGIC && jsb->s_start != 0;
+	// the tools read the tables front to back, mostly
+	madvise(map, bytes, MADV_SEQUENTIAL);
+	return 0;
+
+fail:
+	err = errno;
+	close(img->fd);
+	img->fd = -1;
+	return err;
+}
+
+void hollyfs_close_image(struct hollyfs_image *img)
+{
+	if(img->map)
+		munmap((void *)img->map, img->size);
+	if(img->fd != -1)
+		close(img->fd);
+	img->map = NULL;
+	img->fd = -1;
+}
+
+const void *hollyfs_block(const struct hollyfs_image *img, unsigned int block)
+{
+	if((unsigned long long)block * HOLLYFS_BLOCK_SIZE >= img->size)
+		return NULL;
+	return img->map + (unsigned long long)block * HOLLYFS_BLOCK_SIZE;
+}
+
+const hollyfs_group_desc *hollyfs_group(const struct hollyfs_image *img, unsigned int g)
+{
+	const hollyfs_group_desc *gdt;
+
+	if(g >= img->sb->group_count)
+		return NULL;
+	gdt = hollyfs_block(img, img->sb->gdt_block_base + g / HOLLYFS_GROUP_DESCS_PER_BLOCK);
+	return gdt ? &gdt[g % HOLLYFS_GROUP_DESCS_PER_BLOCK] : NULL;
+}
+
+const unsigned char *hollyfs_bitmap(const struct hollyfs_image *img, unsigned int g)
+{
+	const hollyfs_group_desc *gd = hollyfs_group(img, g);
+
+	return gd ? hollyfs_block(img, gd->bitmap_block) : NULL;
+}
+
+int hollyfs_block_in_use(const struct hollyfs_image *img, unsigned int block)
+{
+	const unsigned char *bitmap;
+	unsigned int g, bit;
+
+	if(block < img->sb->first_group_block)
+		return -1;
+	g = (block - img->sb->first_group_block) / HOLLYFS_BLOCKS_PER_GROUP;
+	bit = (block - img->sb->first_group_block) % HOLLYFS_BLOCKS_PER_GROUP;
+	bitmap = hollyfs_bitmap(img, g);
+	if(!bitmap || bit >= hollyfs_group(img, g)->block_count)
+		return -1;
+	return (bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+unsigned int hollyfs_refcount(const struct hollyfs_image *img, unsigned int block)
+{
+	const hollyfs_group_desc *gd;
+	const unsigned short *counts;
+	unsigned int bit;
+
+	if(block < img->sb->first_group_block)
+		return 0;
+	gd = hollyfs_group(img, (block - img->sb->first_group_block) / HOLLYFS_BLOCKS_PER_GROUP);
+	bit = (block - img->sb->first_group_block) % HOLLYFS_BLOCKS_PER_GROUP;
+	if(!gd || !gd->refcount_block)
+		return 0;
+	counts = hollyfs_block(img, gd->refcount_block + bit / HOLLYFS_REFCOUNTS_PER_BLOCK);
+	return counts ? counts[bit % HOLLYFS_REFCOUNTS_PER_BLOCK] : 0;
+}
+
+const hollyfs_inode *hollyfs_inode_slot(const struct hollyfs_image *img, unsigned int ino)
+{
+	unsigned int ipg = img->sb->inodes_per_group, slot = ino % ipg;
+	const hollyfs_group_desc *gd = hollyfs_group(img, ino / ipg);
+	const unsigned char *table;
+
+	if(!ino || !gd || slot >= gd->inodes_used || slot >= ipg)
+		return NULL;
+	table = hollyfs_block(img, gd->inode_table_block + slot / HOLLYFS_INODES_PER_BLOCK);
+	return table ? (const hollyfs_inode *)(table + (slot % HOLLYFS_INODES_PER_BLOCK) * HOLLYFS_INODE_SIZE) : NULL;
+}
+
+const hollyfs_extent *hollyfs_extent_block(const struct hollyfs_image *img, const hollyfs_inode *inode)
+{
+	if(!inode->extent_block)
+		return NULL;
+	return hollyfs_block(img, inode->extent_block);
+}
+
+const hollyfs_extent *hollyfs_get_extent(const struct hollyfs_image *img, const hollyfs_inode *inode, unsigned int idx)
+{
+	const hollyfs_extent *ind;
+
+	if(idx >= inode->extent_count || idx >= HOLLYFS_MAX_EXTENTS || (inode->flags & HOLLYFS_INODE_INLINE_DATA))
+		return NULL;
+	if(idx < HOLLYFS_INODE_EXTENTS)
+		return &inode->extents[idx];
+	ind = hollyfs_extent_block(img, inode);
+	return ind ? &ind[idx - HOLLYFS_INODE_EXTENTS] : NULL;
+}
+
+int hollyfs_map_block(const struct hollyfs_image *img, const hollyfs_inode *inode, unsigned int lblk, unsigned int *phys, unsigned int *len, int *unwritten)
+{
+	unsigned int lo = 0, hi = inode->extent_count, mid;
+	const hollyfs_extent *e;
+
+	*phys = *len = 0;
+	*unwritten = 0;
+	if(inode->flags & HOLLYFS_INODE_INLINE_DATA)
+		return 0;
+	if(hi > HOLLYFS_MAX_EXTENTS)
+		return -1;
+	// the extents are sorted by logical_block, find the last one that starts at or before lblk
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		e = hollyfs_get_extent(img, inode, mid);
+		if(!e)
+			return -1;
+		if(e->logical_block <= lblk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo > 0)
+	{
+		e = hollyfs_get_extent(img, inode, lo - 1);
+		if(lblk - e->logical_block < hollyfs_ext_len(e))
+		{
+			*phys = e->start_block + (lblk - e->logical_block);
+			*len = e->logical_block + hollyfs_ext_len(e) - lblk;
+			*unwritten = (e->length & HOLLYFS_EXTENT_UNWRITTEN) != 0;
+			return 0;
+		}
+	}
+	// a hole, as long as the distance to the next extent
+	if(lo < inode->extent_count)
+	{
+		e = hollyfs_get_extent(img, inode, lo);
+		if(!e)
+			return -1;
+		*len = e->logical_block - lblk;
+	}
+	return 0;
+}
+
+int hollyfs_record_ok(const hollyfs_directory_record *rec, unsigned int off)
+{
+	return rec->rec_len >= HOLLYFS_DIR_REC_LEN(0) && (rec->rec_len & 3) == 0 && off + rec->rec_len <= HOLLYFS_BLOCK_SIZE &&
+	       (!rec->inode_no || HOLLYFS_DIR_REC_LEN(rec->name_len) <= rec->rec_len);
+}
+
+const unsigned char *hollyfs_file_block(const struct hollyfs_image *img, const hollyfs_inode *inode, unsigned int lblk)
+{
+	unsigned int phys, len;
+	int unwritten;
+
+	if(hollyfs_map_block(img, inode, lblk, &phys, &len, &unwritten) || !phys || unwritten)
+		return NULL;
+	return hollyfs_block(img, phys);
+}
+
+int hollyfs_dir_iterate(const struct hollyfs_image *img, const hollyfs_inode *dir, hollyfs_dir_fn fn, void *arg, unsigned int *bad_pos)
+{
+	unsigned int nblocks = dir->file_size / HOLLYFS_BLOCK_SIZE, lblk, off;
+	const hollyfs_directory_record *rec;
+	const unsigned char *block;
+	int ret;
+
+	for(lblk = 0; lblk < nblocks; lblk++)
+	{
+		block = hollyfs_file_block(img, dir, lblk);
+		if(!block)
+		{
+			*bad_pos = lblk * HOLLYFS_BLOCK_SIZE;
+			return -1;
+		}
+		for(off = 0; off < HOLLYFS_BLOCK_SIZE; off += rec->rec_len)
+		{
+			rec = (const hollyfs_directory_record *)(block + off);
+			if(!hollyfs_record_ok(rec, off))
+			{
+				*bad_pos = lblk * HOLLYFS_BLOCK_SIZE + off;
+				return -1;
+			}
+			if(!rec->inode_no)
+				continue;
+			ret = fn(arg, rec, lblk * HOLLYFS_BLOCK_SIZE + off);
+			if(ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+const hollyfs_dir_index_block *hollyfs_dir_index(const struct hollyfs_image *img, const hollyfs_inode *dir, unsigned int k)
+{
+	const hollyfs_dir_index_block *ib;
+
+	if(k >= dir->dir_index_blocks)
+		return NULL;
+	ib = (const hollyfs_dir_index_block *)hollyfs_file_block(img, dir, HOLLYFS_DIR_INDEX_BASE + k);
+	// a slot count past the end of the block would send every reader out of it
+	if(ib && ib->slot_count > HOLLYFS_INDEX_SLOTS_PER_BLOCK)
+		return NULL;
+	return ib;
+}
+
+const hollyfs_directory_record *hollyfs_dir_record(const struct hollyfs_image *img, const hollyfs_inode *dir, unsigned int pos)
+{
+	const hollyfs_directory_record *rec;
+	const unsigned char *block;
+
+	if(pos >= dir->file_size || (pos & 3))
+		return NULL;
+	block = hollyfs_file_block(img, dir, pos / HOLLYFS_BLOCK_SIZE);
+	if(!block)
+		return NULL;
+	rec = (const hollyfs_directory_record *)(block + pos % HOLLYFS_BLOCK_SIZE);
+	return hollyfs_record_ok(rec, pos % HOLLYFS_BLOCK_SIZE) ? rec : NULL;
+}
+
+struct scan_lookup {
+	const char *name;
+	unsigned int len;
+	unsigned int ino;
+};
+
+static int scan_lookup_fn(void *arg, const hollyfs_directory_record *rec, unsigned int pos)
+{
+	struct scan_lookup *s = arg;
+
+	(void)pos;
+	if(rec->name_len != s->len || memcmp(rec->name, s->name, s->len) != 0)
+		return 0;
+	s->ino = rec->inode_no;
+	return 1;
+}
+
+int hollyfs_dir_lookup(const struct hollyfs_image *img, const hollyfs_inode *dir, const char *name, unsigned int len, unsigned int *ino)
+{
+	const hollyfs_dir_index_block *ib;
+	const hollyfs_directory_record *rec;
+	struct scan_lookup s = { name, len, 0 };
+	unsigned int hash, i, bad_pos;
+
+	// a folder that never had a name added has no index yet, it has a single empty block to scan
+	if(!dir->dir_index_blocks)
+	{
+		if(hollyfs_dir_iterate(img, dir, scan_lookup_fn, &s, &bad_pos) != 1)
+			return -1;
+		*ino = s.ino;
+		return 0;
+	}
+	hash = hollyfs_name_hash(name, len);
+	ib = hollyfs_dir_index(img, dir, hash & (dir->dir_index_blocks - 1));
+	if(!ib)
+		return -1;
+	for(i = 0; i < ib->slot_count; i++)
+	{
+		if(ib->slots[i].hash != hash)
+			continue;
+		rec = hollyfs_dir_record(img, dir, ib->slots[i].pos);
+		if(rec && rec->inode_no && rec->name_len == len && memcmp(rec->name, name, len) == 0)
+		{
+			*ino = rec->inode_no;
+			return 0;
+		}
+	}
+	// names whose block overflowed may have no slot, like the kernel this falls back to a scan then
+	if((ib->flags & HOLLYFS_INDEX_OVERFLOW) && hollyfs_dir_iterate(img, dir, scan_lookup_fn, &s, &bad_pos) == 1)
+	{
+		*ino = s.ino;
+		return 0;
+	}
+	return -1;
+}
+
+unsigned int hollyfs_path_lookup(const struct hollyfs_image *img, const char *path)
+{
+	unsigned int ino = HOLLYFS_ROOT_INO, len;
+	const hollyfs_inode *inode;
+	const char *end;
+
+	while(*path)
+	{
+		while(*path == '/')
+			path++;
+		if(!*path)
+			break;
+		end = strchr(path, '/');
+		len = end ? (unsigned int)(end - path) : strlen(path);
+		inode = hollyfs_inode_slot(img, ino);
+		if(!inode || !hollyfs_inode_live(inode) || inode->type != HOLLYFS_FILE_TYPE_DIR || len > HOLLYFS_FILENAME_MAX)
+			return 0;
+		if(hollyfs_dir_lookup(img, inode, path, len, &ino))
+			return 0;
+		path += len;
+	}
+	return ino;
+}
@@ -0,0 +1,81 @@
+/* hollyfs_lib.h */
+
+// Userspace access to a hollyfs image or device without mounting it, used by fsck and dump
+// The whole partition is mmap'ed read-only and every reader hands out pointers right into the mapping, so
+// nothing gets copied and the page cache does the caching, several threads can read the same image at once.
+// Nothing here writes to the image.
+
+#ifndef HOLLYFS_LIB_H
+#define HOLLYFS_LIB_H
+
+#include "hollyfs.h"
+
+// an opened image, everything in here points into the mapping
+struct hollyfs_image {
+	int fd;
+	const unsigned char *map;
+	unsigned long long size; // bytes that are mapped, a whole number of blocks
+	const hollyfs_superblock *sb;
+	int journal_dirty; // the journal holds transactions the kernel has not replayed, the image is out of date until the next mount
+};
+
+// what hollyfs_dir_iterate calls for every live record of a directory, pos is the record's byte offset in the
+// directory, returning anything but 0 stops the walk and hollyfs_dir_iterate returns it
+typedef int (*hollyfs_dir_fn)(void *arg, const hollyfs_directory_record *rec, unsigned int pos);
+
+// opens and maps path (an image file or a block device) and checks the superblock, returns 0 or an errno value
+// *why says what was wrong with the superblock when that was the problem
+int hollyfs_open_image(struct hollyfs_image *img, const char *path, const char **why);
+void hollyfs_close_image(struct hollyfs_image *img);
+
+// block number block of the partition, NULL when it is past the end
+const void *hollyfs_block(const struct hollyfs_image *img, unsigned int block);
+// the group descriptor of group g, NULL when there is no such group
+const hollyfs_group_desc *hollyfs_group(const struct hollyfs_image *img, unsigned int g);
+// the block bitmap of group g, bit b stands for block bitmap_block + b, little-endian within each byte
+const unsigned char *hollyfs_bitmap(const struct hollyfs_image *img, unsigned int g);
+// whether the bitmap of its group has block marked in use, -1 when block is in no group
+int hollyfs_block_in_use(const struct hollyfs_image *img, unsigned int block);
+// how many files share block besides the first one, from the refcount table of its group, 0 when it has none
+unsigned int hollyfs_refcount(const struct hollyfs_image *img, unsigned int block);
+
+// the inode table slot of inode number ino, NULL for a slot its group never handed out (those were never written)
+const hollyfs_inode *hollyfs_inode_slot(const struct hollyfs_image *img, unsigned int ino);
+// an inode slot that holds a file or folder, an orphan (no links, not freed yet) included
+static inline int hollyfs_inode_live(const hollyfs_inode *inode)
+{
+	return inode->mode != 0;
+}
+
+static inline unsigned int hollyfs_ext_len(const hollyfs_extent *e)
+{
+	return e->length & ~HOLLYFS_EXTENT_UNWRITTEN;
+}
+
+// the indirect extent block of an inode, NULL when it has none or it is out of range
+const hollyfs_extent *hollyfs_extent_block(const struct hollyfs_image *img, const hollyfs_inode *inode);
+// extent number idx of an inode, NULL when the inode has no such extent (or its indirect block is out of range)
+const hollyfs_extent *hollyfs_get_extent(const struct hollyfs_image *img, const hollyfs_inode *inode, unsigned int idx);
+// maps file block lblk to the partition like the kernel does, *phys is 0 in a hole, *len is how many blocks from
+// lblk on are contiguous (or for a hole how many until the next extent, 0 if there is none) and *unwritten says the
+// blocks read back as zeroes, returns -1 when the extent map itself can't be read
+int hollyfs_map_block(const struct hollyfs_image *img, const hollyfs_inode *inode, unsigned int lblk, unsigned int *phys, unsigned int *len, int *unwritten);
+// file block lblk of an inode, NULL in a hole, in an unwritten extent or past the end of the partition
+const unsigned char *hollyfs_file_block(const struct hollyfs_image *img, const hollyfs_inode *inode, unsigned int lblk);
+
+// whether the record at offset off of a directory block can be followed, the same checks the kernel makes
+int hollyfs_record_ok(const hollyfs_directory_record *rec, unsigned int off);
+// calls fn for every live record of a directory, in the order readdir reports them
+// returns 0, what fn returned, or -1 with *bad_pos set to where the directory is broken
+int hollyfs_dir_iterate(const struct hollyfs_image *img, const hollyfs_inode *dir, hollyfs_dir_fn fn, void *arg, unsigned int *bad_pos);
+// the record at byte offset pos of a directory, NULL when pos is not where a good record could be
+const hollyfs_directory_record *hollyfs_dir_record(const struct hollyfs_image *img, const hollyfs_inode *dir, unsigned int pos);
+// hash index block k of a directory, NULL when it is missing
+const hollyfs_dir_index_block *hollyfs_dir_index(const struct hollyfs_image *img, const hollyfs_inode *dir, unsigned int k);
+// finds name in a directory through its hash index (or by scanning one that has none yet) and stores its inode number
+// in *ino, returns 0, or -1 when the name is not there
+int hollyfs_dir_lookup(const struct hollyfs_image *img, const hollyfs_inode *dir, const char *name, unsigned int len, unsigned int *ino);
+// follows an absolute path like /a/b/c from the root folder, returns the inode number or 0 when it leads nowhere
+unsigned int hollyfs_path_lookup(const struct hollyfs_image *img, const char *path);
+
+#endif
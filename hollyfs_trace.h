@@ -0,0 +1,189 @@
+/* hollyfs_trace.h */
+
+// Tracepoints of hollyfs.c, they show up in /sys/kernel/tracing/events/hollyfs and cost nothing while they are off.
+// Every event has the device, so several mounted partitions can be told apart, and the ones that time an
+// operation carry its latency in nanoseconds
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hollyfs
+
+#if !defined(_HOLLYFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HOLLYFS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// a create or a mkdir, ino is 0 when it failed before the new inode got its number
+TRACE_EVENT(hollyfs_create,
+	TP_PROTO(struct inode *dir, struct dentry *dentry, umode_t mode, unsigned long ino, int ret, u64 ns),
+	TP_ARGS(dir, dentry, mode, ino, ret, ns),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(unsigned long, ino)
+		__field(umode_t, mode)
+		__field(int, ret)
+		__field(u64, ns)
+		__string(name, dentry->d_name.name)
+	),
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->ino = ino;
+		__entry->mode = mode;
+		__entry->ret = ret;
+		__entry->ns = ns;
+		__assign_str(name, dentry->d_name.name);
+	),
+	TP_printk("dev %d,%d dir %lu name %s mode 0%o ino %lu ret %d ns %llu", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->dir, __get_str(name), __entry->mode, __entry->ino, __entry->ret, __entry->ns)
+);
+
+// a lookup, ino is 0 for a name that is not there
+TRACE_EVENT(hollyfs_lookup,
+	TP_PROTO(struct inode *dir, struct dentry *dentry, unsigned long ino, int ret, u64 ns),
+	TP_ARGS(dir, dentry, ino, ret, ns),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(unsigned long, ino)
+		__field(int, ret)
+		__field(u64, ns)
+		__string(name, dentry->d_name.name)
+	),
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->ino = ino;
+		__entry->ret = ret;
+		__entry->ns = ns;
+		__assign_str(name, dentry->d_name.name);
+	),
+	TP_printk("dev %d,%d dir %lu name %s ino %lu ret %d ns %llu", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->dir, __get_str(name), __entry->ino, __entry->ret, __entry->ns)
+);
+
+// one getdents call, from and to are the directory positions it started and stopped at
+TRACE_EVENT(hollyfs_readdir,
+	TP_PROTO(struct inode *dir, loff_t from, loff_t to, int ret, u64 ns),
+	TP_ARGS(dir, from, to, ret, ns),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, dir)
+		__field(loff_t, from)
+		__field(loff_t, to)
+		__field(int, ret)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		__entry->dir = dir->i_ino;
+		__entry->from = from;
+		__entry->to = to;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+	TP_printk("dev %d,%d dir %lu from %lld to %lld ret %d ns %llu", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->dir, __entry->from, __entry->to, __entry->ret, __entry->ns)
+);
+
+// an allocation of a run of blocks, groups and runs are how many groups and free runs the search looked at
+TRACE_EVENT(hollyfs_alloc_blocks,
+	TP_PROTO(struct super_block *sb, unsigned int goal, unsigned int want, unsigned int block, unsigned int got, unsigned int groups, unsigned int runs, int ret, u64 ns),
+	TP_ARGS(sb, goal, want, block, got, groups, runs, ret, ns),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned int, goal)
+		__field(unsigned int, want)
+		__field(unsigned int, block)
+		__field(unsigned int, got)
+		__field(unsigned int, groups)
+		__field(unsigned int, runs)
+		__field(int, ret)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->goal = goal;
+		__entry->want = want;
+		__entry->block = block;
+		__entry->got = got;
+		__entry->groups = groups;
+		__entry->runs = runs;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+	TP_printk("dev %d,%d goal %u want %u block %u got %u groups %u runs %u ret %d ns %llu", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->goal, __entry->want, __entry->block, __entry->got, __entry->groups, __entry->runs, __entry->ret, __entry->ns)
+);
+
+// blocks going back to the bitmap
+TRACE_EVENT(hollyfs_free_blocks,
+	TP_PROTO(struct super_block *sb, unsigned int block, unsigned int count),
+	TP_ARGS(sb, block, count),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned int, block)
+		__field(unsigned int, count)
+	),
+	TP_fast_assign(
+		__entry->dev = sb->s_dev;
+		__entry->block = block;
+		__entry->count = count;
+	),
+	TP_printk("dev %d,%d block %u count %u", MAJOR(__entry->dev), MINOR(__entry->dev), __entry->block, __entry->count)
+);
+
+// writeback gave a run of delayed blocks of a file their blocks on disk
+TRACE_EVENT(hollyfs_da_map_run,
+	TP_PROTO(struct inode *inode, unsigned int lblk, unsigned int pblk, unsigned int len),
+	TP_ARGS(inode, lblk, pblk, len),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(unsigned int, lblk)
+		__field(unsigned int, pblk)
+		__field(unsigned int, len)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->lblk = lblk;
+		__entry->pblk = pblk;
+		__entry->len = len;
+	),
+	TP_printk("dev %d,%d ino %lu lblk %u pblk %u len %u", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ino, __entry->lblk, __entry->pblk, __entry->len)
+);
+
+// one writepages call, written is how many pages it took off nr_to_write
+TRACE_EVENT(hollyfs_writepages,
+	TP_PROTO(struct inode *inode, long nr_to_write, long written, int ret, u64 ns),
+	TP_ARGS(inode, nr_to_write, written, ret, ns),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(long, nr_to_write)
+		__field(long, written)
+		__field(int, ret)
+		__field(u64, ns)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->nr_to_write = nr_to_write;
+		__entry->written = written;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+	TP_printk("dev %d,%d ino %lu nr_to_write %ld written %ld ret %d ns %llu", MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ino, __entry->nr_to_write, __entry->written, __entry->ret, __entry->ns)
+);
+
+#endif /* _HOLLYFS_TRACE_H */
+
+// the tracepoint machinery includes this file again from a path of its own, this tells it where to look
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hollyfs_trace
+#include <trace/define_trace.h>
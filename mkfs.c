@@ -1,108 +1,395 @@
-/* hollyfs.c */
+/* mkfs.c */
 
-/* This program impelements a rudimentary filesystem on the /dev/sdaX partition given
-It uses open / read / write / close on this filesystem, so it should be a RAW device file
-so that this program talks directly to a device driver and can read/write bytes directly.
+/* This program impelements a rudimentary filesystem on the block device or image file given
+It writes the metadata straight to the device with pwritev, so it talks directly to the device driver
+(or, for an image that a loop device will serve later, to the file) and needs no mounted file system.
 
-The given partiton should not be mounted!
+The given partiton should not be mounted! A block device is opened exclusively, so a mounted one is refused.
 
-The program implements the filesystem to do the following:
-open / read / write / close files on the partition using the interface provided in this program
-Store files in a single, root directory structure (non-recursive)
+Only the blocks the kernel reads before it writes them are written here: the superblock, the group
+descriptors, the journal superblock, every group's bitmap and the root folder. The inode tables are
+left alone, the kernel zeroes each inode table block the first time it hands out inodes from it, so
+formatting takes a handful of writes per 128MiB no matter how big the device is.
+
+usage: mkfs [-b blocks] [-i blocks per inode] [-j journal blocks] [-d] <device or image file>
+  -b  size of the file system in 4096 byte blocks, an image file is created or grown to this size,
+      on a block device it can only be smaller than the device (default: the whole device or file)
+  -i  one inode for every this many blocks (default HOLLYFS_BLOCKS_PER_INODE)
+  -j  journal size in blocks (default 1/128th of the file system, within the min and max in hollyfs.h)
+  -d  discard the device first (BLKDISCARD, or punching a hole through an image file), so an SSD or
+      thin volume gets its space back and an image stays sparse
 */
 
+#define _GNU_SOURCE // provides fallocate
 #include "hollyfs.h"
 #include <stdio.h> // Provides printf
-#include <stdlib.h> // provides malloc
-#include <fcntl.h> // provides open system call
-#include <unistd.h> // provides write and lseek and close 
+#include <stdlib.h> // provides malloc and strtoull
+#include <string.h> // provides memset and strerror
+#include <errno.h> // provides errno
+#include <fcntl.h> // provides open system call and fallocate
+#include <unistd.h> // provides getopt, fsync and close
+#include <sys/stat.h> // provides S_IFDIR and fstat
+#include <sys/ioctl.h> // provides ioctl
+#include <sys/uio.h> // provides pwritev
+#include <linux/fs.h> // provides BLKGETSIZE64 and BLKDISCARD
+#include <linux/falloc.h> // provides FALLOC_FL_PUNCH_HOLE
+#include <stdint.h> // provides uint64_t for BLKDISCARD
+#include <time.h> // provides time and clock_gettime
+#include <arpa/inet.h> // provides htonl, the journal superblock is big endian
+#include <sys/random.h> // provides getrandom
 
 
 // static / global becuase it's used in all methods and it's a pain to pass around
 static int fd;
 
-// Reads the entire contents of one block and write it into region pointed to by void *data
-// This is a utility method that I wrote before I realized that I don't need it!
-int read_from_block(int block_num, void *data, int data_size)
+// Writes the buffers in iov back to back starting at block index number block_num, with a single pwritev
+// every buffer has to be a whole number of blocks, returns 0 or -1 when not everything made it to the disk
+static int write_blocks(unsigned int block_num, struct iovec *iov, int iovcnt)
 {
-	off_t s_out = lseek(fd, block_num * HOLLYFS_BLOCK_SIZE, SEEK_SET);
-	if(s_out == -1)
+	ssize_t total = 0;
+	int i;
+
+	for(i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	// the byte offset is done in off_t since partitions are bigger than 4GiB
+	if(pwritev(fd, iov, iovcnt, (off_t)block_num * HOLLYFS_BLOCK_SIZE) != total)
+	{
+		printf("Writing block %u failed: %s\n", block_num, strerror(errno));
 		return -1;
-	return read(fd, data, data_size);
+	}
+	return 0;
 }
 
-// similar to read_from_block, this method writes the data pointed to by void *data
-// into the disk at block index number block_num
-// This is used to write the superblock, and the root folder inode in main
-int write_to_block(int block_num, void *data, int data_size)
+// Writes a single buffer of len bytes at block index number block_num
+static int write_block(unsigned int block_num, void *data, size_t len)
 {
-	// lseek seeks to a specific byte but we are given a block num so we convert
-	// the correct byte = the block size * the block number
-	// seek_set means that the byte number we give is treated as an absolute number
-	// instead of a offset from the current position
-	off_t s_out = lseek(fd, block_num * HOLLYFS_BLOCK_SIZE, SEEK_SET);
-	if(s_out == -1)
-		return -1;
-	// Actually write the data and return any error code in one line
-	return write(fd, data, data_size);
+	struct iovec iov = { .iov_base = data, .iov_len = len };
+
+	return write_blocks(block_num, &iov, 1);
+}
+
+// Returns the size in bytes of what fd points to, a block device has to be asked with an ioctl
+// while for a regular file (an image for a loop device) the file size is the answer
+static unsigned long long device_size(struct stat *st)
+{
+	unsigned long long bytes;
+
+	if(S_ISBLK(st->st_mode))
+	{
+		if(ioctl(fd, BLKGETSIZE64, &bytes) == -1)
+			return 0;
+		return bytes;
+	}
+	return st->st_size;
+}
+
+// Throws away the first bytes bytes of the device, a block device is told with BLKDISCARD and an image file
+// gets a hole punched through it, nothing here depends on what the discarded blocks read back as afterwards
+static int discard_device(struct stat *st, unsigned long long bytes)
+{
+	uint64_t range[2] = { 0, bytes };
+
+	if(S_ISBLK(st->st_mode))
+		return ioctl(fd, BLKDISCARD, range);
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, bytes);
+}
+
+// Divides and rounds up
+static unsigned int div_round_up(unsigned long long a, unsigned int b)
+{
+	return (a + b - 1) / b;
 }
 
+// Reads a positive number for option opt, returns 0 if it is not one
+static unsigned long long parse_number(int opt, const char *arg)
+{
+	char *end;
+	unsigned long long n = strtoull(arg, &end, 0);
+
+	if(*arg == '-' || *end != '\0' || n == 0)
+	{
+		printf("-%c needs a positive number, not %s\n", opt, arg);
+		return 0;
+	}
+	return n;
+}
 
+static void usage(const char *prog)
+{
+	printf("usage: %s [-b blocks] [-i blocks per inode] [-j journal blocks] [-d] <device or image file>\n", prog);
+}
 
-// The main program writes the superblock to block 0 and the root folder i-node to i-node 0 
+// The main program lays the whole partition out as allocation groups and writes the superblock,
+// the group descriptors, every group's bitmap, the root folder and the journal superblock
 // by default the entire FS is empty except for the root folder.
-int main(char *argv[])
+int main(int argc, char *argv[])
 {
+	unsigned long long size_blocks = 0, blocks_per_inode = HOLLYFS_BLOCKS_PER_INODE, journal_opt = 0;
+	int discard = 0, opt;
+	struct timespec start, end;
+	struct stat st;
+
+	while((opt = getopt(argc, argv, "b:i:j:d")) != -1)
+	{
+		switch(opt)
+		{
+		case 'b':
+			if(!(size_blocks = parse_number(opt, optarg)))
+				return 1;
+			break;
+		case 'i':
+			if(!(blocks_per_inode = parse_number(opt, optarg)))
+				return 1;
+			break;
+		case 'j':
+			if(!(journal_opt = parse_number(opt, optarg)))
+				return 1;
+			break;
+		case 'd':
+			discard = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(optind != argc - 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// open disk, a block device exclusively so that a mounted one is refused, an image file is created if it is not there yet
+	if(stat(argv[optind], &st) == 0 && S_ISBLK(st.st_mode))
+		fd = open(argv[optind], O_RDWR | O_EXCL);
+	else
+		fd = open(argv[optind], O_RDWR | O_CREAT, 0644);
+	if(fd == -1 || fstat(fd, &st) == -1)
+	{
+		printf("Could not open %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
 
-	// open disk
-	fd = open("/dev/sda3", O_RDWR);
-	printf("fd: %d\n", fd);
+	// Work out the geometry from the size of the partition, or from -b if that was given
+	unsigned long long device_blocks = device_size(&st) / HOLLYFS_BLOCK_SIZE;
+	if(size_blocks)
+	{
+		if(S_ISREG(st.st_mode) && size_blocks > device_blocks)
+		{
+			// grow the image, the new part is a hole and costs no disk space until the kernel writes to it
+			if(ftruncate(fd, (off_t)size_blocks * HOLLYFS_BLOCK_SIZE) == -1)
+			{
+				printf("Could not grow %s: %s\n", argv[optind], strerror(errno));
+				return 1;
+			}
+			device_blocks = size_blocks;
+		}
+		if(size_blocks > device_blocks)
+		{
+			printf("%s only has %llu blocks\n", argv[optind], device_blocks);
+			return 1;
+		}
+		device_blocks = size_blocks;
+	}
+	// block numbers are 32 bit so anything past 16TiB is left unused
+	unsigned int fs_size = device_blocks > 0xffffffffULL ? 0xffffffffU : (unsigned int)device_blocks;
+	// the journal grows with the file system, 1/128th of it within the min and max
+	unsigned int journal_blocks = fs_size / 128;
+	if(journal_blocks < HOLLYFS_JOURNAL_MIN_BLOCKS)
+		journal_blocks = HOLLYFS_JOURNAL_MIN_BLOCKS;
+	if(journal_blocks > HOLLYFS_JOURNAL_MAX_BLOCKS)
+		journal_blocks = HOLLYFS_JOURNAL_MAX_BLOCKS;
+	if(journal_opt)
+	{
+		if(journal_opt < HOLLYFS_JOURNAL_MIN_BLOCKS || journal_opt >= fs_size)
+		{
+			printf("The journal needs at least %u blocks and has to fit on the partition\n", HOLLYFS_JOURNAL_MIN_BLOCKS);
+			return 1;
+		}
+		journal_blocks = journal_opt;
+	}
+	// the superblock, a group descriptor block, the journal and a group with a bitmap, an inode table block and 64 data blocks
+	if(fs_size < 1 + 1 + journal_blocks + 1 + 1 + 64)
+	{
+		printf("The partition is too small, hollyfs needs at least %u blocks of %u bytes\n", 1 + 1 + journal_blocks + 1 + 1 + 64, HOLLYFS_BLOCK_SIZE);
+		return 1;
+	}
+	// the group descriptor table needs a slot per group, and the groups start after it, so start with a guess
+	// that ignores the table and then redo the count with the table in place, the second count can only be smaller
+	unsigned int group_count = div_round_up(fs_size - 1 - journal_blocks, HOLLYFS_BLOCKS_PER_GROUP);
+	unsigned int gdt_blocks = div_round_up(group_count, HOLLYFS_GROUP_DESCS_PER_BLOCK);
+	unsigned int first_group_block = 1 + gdt_blocks + journal_blocks;
+	group_count = div_round_up(fs_size - first_group_block, HOLLYFS_BLOCKS_PER_GROUP);
+	// every group gets one inode per blocks_per_inode blocks, going by the size of group 0 so that
+	// a partition smaller than one group doesn't spend a full group's inode table
+	unsigned int group0_blocks = fs_size - first_group_block < HOLLYFS_BLOCKS_PER_GROUP ? fs_size - first_group_block : HOLLYFS_BLOCKS_PER_GROUP;
+	unsigned int inode_table_blocks = group0_blocks / (blocks_per_inode * HOLLYFS_INODES_PER_BLOCK);
+	if(inode_table_blocks == 0)
+		inode_table_blocks = 1;
+	// the inode table can't take up the whole group, there has to be room for the root folder's records
+	if(1 + inode_table_blocks + 64 > group0_blocks)
+		inode_table_blocks = group0_blocks - 1 - 64;
+	// a last group too short for its bitmap, its inode table and a bit of data is not worth having
+	unsigned int last_blocks = fs_size - first_group_block - (group_count - 1) * HOLLYFS_BLOCKS_PER_GROUP;
+	if(last_blocks < 1 + inode_table_blocks + 64)
+	{
+		group_count--;
+		fs_size = first_group_block + group_count * HOLLYFS_BLOCKS_PER_GROUP;
+	}
+	if(group_count == 0)
+	{
+		printf("The partition is too small for a single allocation group\n");
+		return 1;
+	}
+	printf("%u blocks, %u allocation groups, %u inodes per group, %u journal blocks\n", fs_size, group_count, inode_table_blocks * HOLLYFS_INODES_PER_BLOCK, journal_blocks);
 
+	if(discard)
+	{
+		printf("Discarding %s\n", argv[optind]);
+		// not every device (or file system under an image) can do this, a failed discard just means nothing was thrown away
+		if(discard_device(&st, (unsigned long long)fs_size * HOLLYFS_BLOCK_SIZE) == -1)
+			printf("Discard failed, going on without it: %s\n", strerror(errno));
+	}
 
-	// Write superblock to disk, superblock is at block 0
-	hollyfs_superblock *sb = malloc(sizeof(hollyfs_superblock));
+	// The group descriptors, every group starts with its bitmap block followed by the inode table
+	hollyfs_group_desc *gdt = calloc(gdt_blocks, HOLLYFS_BLOCK_SIZE);
+	unsigned int g;
+	unsigned long long free_blocks = 0;
+	for(g = 0; g < group_count; g++)
+	{
+		gdt[g].bitmap_block = first_group_block + g * HOLLYFS_BLOCKS_PER_GROUP;
+		gdt[g].inode_table_block = gdt[g].bitmap_block + 1;
+		gdt[g].data_block_base = gdt[g].inode_table_block + inode_table_blocks;
+		gdt[g].block_count = (g + 1 < group_count) ? HOLLYFS_BLOCKS_PER_GROUP : fs_size - gdt[g].bitmap_block;
+		gdt[g].free_block_count = gdt[g].block_count - 1 - inode_table_blocks;
+		gdt[g].inodes_used = 0;
+	}
+	// the root folder takes inode 1 (inode 0 is never used) and the first data block of group 0
+	gdt[0].inodes_used = HOLLYFS_ROOT_INO + 1;
+	gdt[0].free_block_count--;
+	for(g = 0; g < group_count; g++)
+		free_blocks += gdt[g].free_block_count;
+
+
+	// Superblock at block 0
+	// I will use an entire block for the superblock struct, but most of the block space is wasted
+	// because hollyfs_superblock is only a few ints
+	hollyfs_superblock *sb = calloc(1, HOLLYFS_BLOCK_SIZE);
 	printf("Generating new superblock\n");
 	// Fill in the data for the superblock
 	sb->magic_num = HOLLYFS_MAGIC_NUM;
-	sb->fs_size = 1056; // 1 superblock, 32 inodes blocks at the end (starting at block number 1024), 1023 data blocks
-	sb->inode_count = 1; // will use 1 i-node immediately for root folder (below)
-	// block map already insantiated
-	sb->block_map[0] = 1;
+	sb->fs_size = fs_size;
+	sb->blocks_per_group = HOLLYFS_BLOCKS_PER_GROUP;
+	sb->group_count = group_count;
+	sb->first_group_block = first_group_block;
+	sb->inodes_per_group = inode_table_blocks * HOLLYFS_INODES_PER_BLOCK;
+	sb->inode_table_blocks = inode_table_blocks;
+	sb->gdt_block_base = 1;
+	sb->gdt_blocks = gdt_blocks;
+	sb->free_block_count = free_blocks;
+	sb->journal_block_base = 1 + gdt_blocks;
+	sb->journal_block_count = journal_blocks;
 
-	// I will use an entire block for the superblock struct, but most of the block space is wasted
-	// because hollyfs_superblock is only a few ints and a bitmap
-	write_to_block(0, sb, sizeof(hollyfs_superblock));
+	// The journal only needs its superblock, with s_start 0 the kernel sees a clean journal
+	// and never looks at the log blocks, so they don't have to be zeroed. They can still hold the
+	// transactions of an earlier file system on the device though, so the log starts at a random
+	// sequence number: a recovery that reads past the end of our log then finds blocks whose
+	// sequence numbers don't follow on and stops there, instead of replaying somebody else's blocks
+	unsigned int sequence;
+	if(getrandom(&sequence, sizeof(sequence), 0) != sizeof(sequence))
+		sequence = time(NULL) ^ getpid();
+	struct hollyfs_journal_superblock *jsb = calloc(1, HOLLYFS_BLOCK_SIZE);
+	jsb->h_magic = htonl(HOLLYFS_JBD2_MAGIC);
+	jsb->h_blocktype = htonl(HOLLYFS_JBD2_SUPERBLOCK_V2);
+	jsb->s_blocksize = htonl(HOLLYFS_BLOCK_SIZE);
+	jsb->s_maxlen = htonl(journal_blocks);
+	jsb->s_first = htonl(1);
+	jsb->s_sequence = htonl(sequence);
+	jsb->s_start = 0;
+	jsb->s_nr_users = htonl(1);
 
-	// Done with the superblock, this isn't strictly necessary since the program is so short
+	// the superblock, the group descriptors and the journal superblock are back to back, so they go out in one write
+	printf("Writing superblock, group descriptors and journal superblock\n");
+	struct iovec head[3] = {
+		{ .iov_base = sb, .iov_len = HOLLYFS_BLOCK_SIZE },
+		{ .iov_base = gdt, .iov_len = (size_t)gdt_blocks * HOLLYFS_BLOCK_SIZE },
+		{ .iov_base = jsb, .iov_len = HOLLYFS_BLOCK_SIZE },
+	};
+	if(write_blocks(0, head, 3))
+		return 1;
 	free(sb);
+	free(jsb);
 
-	/*
-	* Here is a rough outline of the hollyfs partition
-	---------------------------------------------------
-	|sb|      1024 data blocks       | 32 inode blocks|
-	---------------------------------------------------
-	*/
+	// The root folder inode goes in slot HOLLYFS_ROOT_INO of the first block of group 0's inode table, that block
+	// is the only inode table block written here, the kernel zeroes every other one when it first needs it
+	char *table = calloc(1, HOLLYFS_BLOCK_SIZE);
+	hollyfs_inode *root = (hollyfs_inode *)(table + HOLLYFS_ROOT_INO * HOLLYFS_INODE_SIZE);
 
-	// Write root folder inode to disk (in first inode, and using first data block for storage
-	printf("Writing new root folder inode\n");
-	hollyfs_inode *root = malloc(sizeof(hollyfs_inode));
-
-	root->inode_num = 0;
-	root->data_block_num = HOLLYFS_DATA_BLOCK_BASE;
-	root->file_size = 0;
+	root->inode_num = HOLLYFS_ROOT_INO;
+	// the root folder's records live in one extent: file block 0 is the first data block of group 0
+	root->extent_count = 1;
+	root->extents[0].logical_block = 0;
+	root->extents[0].start_block = gdt[0].data_block_base;
+	root->extents[0].length = 1;
+	root->file_size = HOLLYFS_BLOCK_SIZE; // one block of records
 	root->dir_child_count = 0; // this folder starts empty
 	root->type = HOLLYFS_FILE_TYPE_DIR;
+	root->mode = S_IFDIR | 0777;
+	root->links_count = 2;
+	root->atime = root->mtime = root->ctime = time(NULL);
+	root->dir_index_blocks = 0; // the kernel builds the hash index when the first name is added
+
+	// Every group's bitmap has the group's own bitmap block and inode table marked in use, bit i lives in byte i / 8
+	// under mask 1 << (i % 8), which is the layout the kernel's _le bitops expect
+	// the bitmaps of all groups but 0 are the same, group 0's also has the root folder's records block
+	printf("Writing group bitmaps\n");
+	unsigned char *bitmap = calloc(1, HOLLYFS_BLOCK_SIZE);
+	unsigned char *bitmap0 = calloc(1, HOLLYFS_BLOCK_SIZE);
+	unsigned int b;
+	for(b = 0; b < 1 + inode_table_blocks; b++)
+		bitmap[b / 8] |= 1 << (b % 8);
+	memcpy(bitmap0, bitmap, HOLLYFS_BLOCK_SIZE);
+	bitmap0[b / 8] |= 1 << (b % 8); // the root folder's records block right after the inode table
 
-	// Copy this struct to disk, using INODE_BLOCK_BASE because that is the index of the first i-node
-	write_to_block(HOLLYFS_INODE_BLOCK_BASE, root, sizeof(hollyfs_inode));
-	free(root);
+	// group 0's bitmap and the inode table block right after it go out together
+	struct iovec group0[2] = {
+		{ .iov_base = bitmap0, .iov_len = HOLLYFS_BLOCK_SIZE },
+		{ .iov_base = table, .iov_len = HOLLYFS_BLOCK_SIZE },
+	};
+	if(write_blocks(gdt[0].bitmap_block, group0, 2))
+		return 1;
+	for(g = 1; g < group_count; g++)
+	{
+		if(write_block(gdt[g].bitmap_block, bitmap, HOLLYFS_BLOCK_SIZE))
+			return 1;
+	}
+	free(bitmap);
+	free(bitmap0);
+	free(table);
 
+	// The root folder's record block starts out as a single free record that covers the whole block
+	printf("Writing root folder records\n");
+	hollyfs_directory_record *rec = calloc(1, HOLLYFS_BLOCK_SIZE);
+	rec->inode_no = 0;
+	rec->rec_len = HOLLYFS_BLOCK_SIZE;
+	if(write_block(gdt[0].data_block_base, rec, HOLLYFS_BLOCK_SIZE))
+		return 1;
+	free(rec);
+	free(gdt);
 
+	// make sure it all reached the disk before anyone mounts it
+	if(fsync(fd) == -1)
+	{
+		printf("Error syncing: %s\n", strerror(errno));
+		return 1;
+	}
 	int res;
 	res = close(fd); // close the disk "file"
 	if(res == -1)
 		printf("Error closing!\n");
-	
-	printf("Done!\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Done in %.1f ms!\n", (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
 	return 0;
 }